@@ -51,9 +51,29 @@ void ccnet_disconnect_peer (CcnetClient *client, const char *id);
 struct CcnetClientPool;
 typedef struct CcnetClientPool CcnetClientPool;
 
+typedef struct CcnetClientPoolStat {
+    int      n_clients;         /* open, idle or in use */
+    int      n_idle;
+    int      n_waiting;         /* callers waiting for a client */
+    guint64  n_created;
+    guint64  n_evicted;         /* closed as dead, idle or discarded */
+    guint64  n_waits;           /* gets that found the pool full */
+    guint64  wait_usec;         /* total time of these waits */
+    guint64  max_wait_usec;
+} CcnetClientPoolStat;
+
+/* Same as ccnet_client_pool_new_full (conf_dir, 0, 64). */
 struct CcnetClientPool *
 ccnet_client_pool_new (const char *conf_dir);
 
+/* Opens @min_clients clients right away and never more than
+ * @max_clients at a time. */
+struct CcnetClientPool *
+ccnet_client_pool_new_full (const char *conf_dir,
+                            int min_clients, int max_clients);
+
+/* Returns NULL if no client could be connected, or none came back
+ * within 30 seconds while the pool was full. */
 CcnetClient *
 ccnet_client_pool_get_client (struct CcnetClientPool *cpool);
 
@@ -61,6 +81,15 @@ void
 ccnet_client_pool_return_client (struct CcnetClientPool *cpool,
                                  CcnetClient *client);
 
+/* Close a client that failed instead of returning it. */
+void
+ccnet_client_pool_discard_client (struct CcnetClientPool *cpool,
+                                  CcnetClient *client);
+
+void
+ccnet_client_pool_get_stat (struct CcnetClientPool *cpool,
+                            CcnetClientPoolStat *stat);
+
 /* rpc wrapper */
 
 /* Create rpc client using a single client for transport. */
@@ -81,6 +110,15 @@ ccnet_create_async_rpc_client (CcnetClient *cclient, const char *peer_id,
 void ccnet_rpc_client_free (SearpcClient *client);
 void ccnet_async_rpc_client_free (SearpcClient *client);
 
+/* Run serialized calls (see searpc_client_fcall__*) in one round trip.
+ * With @parallel, the server may run them concurrently. Returns the
+ * serialized results in order, NULL-terminated, or NULL on error; some
+ * calls may have run then. A server that doesn't know batches gets the
+ * calls one by one. Free with g_strfreev().
+ */
+char **ccnet_rpc_call_batch (SearpcClient *client, char **fcalls, int n_calls,
+                             gboolean parallel);
+
 CcnetPeer *ccnet_get_peer (SearpcClient *client, const char *peer_id);
 CcnetPeer *ccnet_get_peer_by_idname (SearpcClient *client, const char *idname);
 int ccnet_get_peer_net_state (SearpcClient *client, const char *peer_id);
@@ -44,6 +44,7 @@ struct CcnetPacketIO;
  * CcnetClientMode:
  * @CCNET_CLIENT_SYNC: Synchronous mode
  * @CCNET_CLIENT_ASYNC: Asynchronous mode
+ * @CCNET_CLIENT_MUX: Multiplexed synchronous mode
  *
  * #CcnetClient can run in synchronous or asynchronous mode. In
  * synchronous mode, every function call to #CcnetClient is blocked
@@ -51,10 +52,17 @@ struct CcnetPacketIO;
  * calls are not blocked, and the user should use the processor
  * mechanism to interact with the daemon.
  *
+ * Multiplexed mode is for RPC calls from many threads over one
+ * connection. A reader thread routes each response to the thread
+ * waiting on its request id, so calls don't wait for each other.
+ * Only the ccnet_client_mux_*() functions and ccnetrpc_transport_send()
+ * can read responses in this mode.
+ *
  **/
 typedef enum {
     CCNET_CLIENT_SYNC,
-    CCNET_CLIENT_ASYNC
+    CCNET_CLIENT_ASYNC,
+    CCNET_CLIENT_MUX
 } CcnetClientMode;
 
 
@@ -184,9 +192,38 @@ ccnet_client_receive_message (CcnetClient *client);
 uint32_t
 ccnet_client_get_rpc_request_id (CcnetClient *client, const char *peer_id,
                                  const char *service);
+/* Returns the number of segments the rpc server pushes ahead, or 0
+ * if it only supports lock-step transfer. */
+int
+ccnet_client_get_rpc_stream_window (CcnetClient *client, uint32_t req_id);
 void
 ccnet_client_clean_rpc_request (CcnetClient *client, uint32_t req_id);
 
+/* multiplexed mode, these are thread safe */
+
+/* Take an idle rpc request to @service, or start a new one. Returns 0
+ * on error. The request is owned by the caller until it is put back.
+ */
+uint32_t
+ccnet_client_mux_get_rpc_request (CcnetClient *client, const char *peer_id,
+                                  const char *service, int *stream_window);
+
+/* Give back a request from ccnet_client_mux_get_rpc_request(). If
+ * @reuse is FALSE the daemon side is shut down instead of kept idle.
+ */
+void
+ccnet_client_mux_put_rpc_request (CcnetClient *client, uint32_t req_id,
+                                  gboolean reuse);
+
+/* Wait for the next response to @req_id. The fields of @rsp are valid
+ * until the next read or put of @req_id.
+ *
+ * Returns: -1 if disconnected, -2 if response packet format error
+ */
+int
+ccnet_client_mux_read_response (CcnetClient *client, uint32_t req_id,
+                                struct CcnetResponse *rsp);
+
 /* void ccnet_client_send_event (CcnetClient *client, GObject *event); */
 
 #endif
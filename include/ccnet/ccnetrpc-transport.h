@@ -24,6 +24,14 @@ typedef struct {
 char *ccnetrpc_transport_send (void *arg,
         const gchar *fcall_str, size_t fcall_len, size_t *ret_len);
 
+/* Run @n_calls serialized calls in one request, see SC_CLIENT_BATCH_CALL.
+ * Returns their serialized results in order, NULL-terminated, or NULL
+ * on error. @unsupported is set if the server rejected the batch without
+ * running it; after other errors some calls may have run. */
+char **ccnetrpc_transport_send_batch (void *arg, char **fcalls, int n_calls,
+                                      gboolean parallel,
+                                      gboolean *unsupported);
+
 int ccnetrpc_async_transport_send (void *arg, gchar *fcall_str,
                                  size_t fcall_len, void *rpc_priv);
 
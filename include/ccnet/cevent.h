@@ -24,6 +24,8 @@
 #define ccnet_pipe_t int
 #endif
 
+struct CcnetCompletionQueue;
+
 typedef struct CEvent  CEvent;
 
 typedef void (*cevent_handler) (CEvent *event, void *handler_data);
@@ -38,14 +40,12 @@ typedef struct CEventManager CEventManager;
 
 struct CEventManager {
     
-    ccnet_pipe_t  pipefd[2];
-    struct event  event;
+    struct CcnetCompletionQueue *queue;
     GHashTable   *handler_table;
     uint32_t      next_id;
-    
-    pthread_mutex_t  mutex;
 };
 
+/* NULL if the wakeup fd can't be created. */
 CEventManager* cevent_manager_new ();
 
 int cevent_manager_start (CEventManager *manager);
@@ -11,6 +11,7 @@
 #include <glib.h>
 
 struct _CcnetSession;
+struct CcnetCompletionQueue;
 
 typedef struct _CcnetJob CcnetJob;
 typedef struct _CcnetJobManager CcnetJobManager;
@@ -29,18 +30,40 @@ struct _CcnetJobManager {
 
     GThreadPool     *thread_pool;
 
+    /* finished jobs, their done callbacks run in the main loop */
+    struct CcnetCompletionQueue *done_queue;
+
     int              next_job_id;
+
+    int              n_pending; /* scheduled jobs whose done callback
+                                 * hasn't run yet */
+
+    int              max_threads;
+    int              max_queue; /* jobs waiting for a thread, 0 for
+                                 * no limit */
 };
 
 void
 ccnet_job_cancel (CcnetJob *job);
 
+/* NULL if the wakeup fd of the done queue can't be created. */
 CcnetJobManager *
 ccnet_job_manager_new (int max_threads);
 
 void
 ccnet_job_manager_free (CcnetJobManager *mgr);
 
+void
+ccnet_job_manager_set_limits (CcnetJobManager *mgr,
+                              int max_threads, int max_queue);
+
+/**
+ * TRUE if max_queue jobs are already waiting for a thread. Callers
+ * should reject the work instead of scheduling it.
+ */
+gboolean
+ccnet_job_manager_is_full (CcnetJobManager *mgr);
+
 int
 ccnet_job_manager_schedule_job (CcnetJobManager *mgr,
                                 JobThreadFunc func,
@@ -20,6 +20,31 @@ struct ccnet_header {
     uint32_t id;                /* used as length in ecrypted packet */
 };
 
+/*
+ * Protocol version 2 adds a 12-byte header with a 32-bit payload length.
+ * A v2 header is only sent to a peer that advertised version 2, either
+ * in the version field of its handshake packet (remote peers) or in a
+ * CCNET_MSG_HANDSHAKE hello packet right after connecting (local
+ * clients). Handshake packets themselves always use the v1 layout.
+ */
+#define CCNET_PROTO_VERSION_1    1
+#define CCNET_PROTO_VERSION_2    2
+#define CCNET_PROTO_VERSION      CCNET_PROTO_VERSION_2
+
+typedef struct ccnet_header_v2 ccnet_header_v2;
+
+struct ccnet_header_v2 {
+    uint8_t  version;           /* always CCNET_PROTO_VERSION_2 */
+    uint8_t  type;
+    uint8_t  flags;             /* reserved for future use, must be 0 */
+    uint8_t  reserved;
+    uint32_t id;
+    uint32_t length;            /* length of payload */
+};
+
+#define CCNET_HEADER_IS_V2(h) \
+    ((h)->version == CCNET_PROTO_VERSION_2 && (h)->type != CCNET_MSG_HANDSHAKE)
+
 typedef struct ccnet_packet    ccnet_packet;
 
 struct ccnet_packet {
@@ -29,6 +54,9 @@ struct ccnet_packet {
 
 #define CCNET_PACKET_MAX_PAYLOAD_LEN 65535
 #define CCNET_PACKET_LENGTH_HEADER       8
+
+#define CCNET_PACKET_MAX_PAYLOAD_LEN_V2  (16 * 1024 * 1024)
+#define CCNET_PACKET_LENGTH_HEADER_V2    12
 #define CCNET_USER_ID_START           1000
 
 #endif
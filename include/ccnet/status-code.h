@@ -60,5 +60,7 @@
 #define SS_NETDOWN "peer down"
 #define SC_SERV_EXISTED "516"
 #define SS_SERV_EXISTED "The service existed"
+#define SC_SERVER_BUSY "517"
+#define SS_SERVER_BUSY "Server busy"
 
 #endif
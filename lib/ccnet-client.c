@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #ifdef WIN32
     #include <inttypes.h>
@@ -29,6 +30,7 @@
 
 #include "proc-factory.h"
 #include "job-mgr.h"
+#include "rpc-common.h"
 
 #include "ccnet-object.h"
 
@@ -49,9 +51,12 @@ G_DEFINE_TYPE (CcnetClient, ccnet_client, CCNET_TYPE_SESSION_BASE);
 
 
 
-static void handle_packet (ccnet_packet *packet, void *vclient);
+static void handle_packet (ccnet_packet *packet, uint32_t len, void *vclient);
 static void ccnet_client_free (GObject *object);
 static void free_rpc_pool (CcnetClient *client);
+static int mux_start (CcnetClient *client);
+static void mux_stop (CcnetClient *client);
+static void mux_free_priv (CcnetClient *client);
 
 
 static void
@@ -257,10 +262,18 @@ ccnet_client_connect_daemon (CcnetClient *client, CcnetClientMode mode)
 
     client->connfd = sockfd;
     client->io = ccnet_packet_io_new (client->connfd);
+    ccnet_packet_send_hello (client->io);
 
     if (mode == CCNET_CLIENT_ASYNC)
         ccnet_packet_io_set_callback (client->io, handle_packet, client);
 
+    if (mode == CCNET_CLIENT_MUX && mux_start (client) < 0) {
+        ccnet_packet_io_free (client->io);
+        client->io = NULL;
+        client->connfd = -1;
+        return -1;
+    }
+
     client->connected = 1;
 
     g_debug ("connected to daemon\n");
@@ -278,6 +291,8 @@ ccnet_client_run_synchronizer (CcnetClient *client)
 int
 ccnet_client_disconnect_daemon (CcnetClient *client)
 {
+    if (client->priv)
+        mux_stop (client);
     ccnet_packet_io_free (client->io);
     client->io = NULL;
     client->connfd = -1;
@@ -287,16 +302,29 @@ ccnet_client_disconnect_daemon (CcnetClient *client)
     return 0;
 }
 
+static void lock_send (CcnetClient *client);
+static void unlock_send (CcnetClient *client);
+
 uint32_t
 ccnet_client_get_request_id (CcnetClient *client)
 {
-    return (++client->req_id);
+    uint32_t req_id;
+
+    /* only multiplexed clients are used from several threads */
+    if (!client->priv)
+        return (++client->req_id);
+
+    lock_send (client);
+    req_id = ++client->req_id;
+    unlock_send (client);
+    return req_id;
 }
 
 typedef struct RpcPoolItem {
     uint32_t   req_id;
     char      *peer_id;
     char      *service;
+    int        stream_window; /* 0 if the server can't stream */
 } RpcPoolItem;
 
 static void
@@ -333,9 +361,24 @@ get_pool_item (CcnetClient *client, const char *peer_id,
     return NULL;
 }
 
+static int
+parse_stream_window (const char *content, int clen)
+{
+    char *cap;
+    int window = 0;
+
+    if (clen <= 0 || content[clen-1] != '\0')
+        return 0;
+    cap = g_strndup (content, clen);
+    if (sscanf (cap, RPC_STREAM_CAP "=%d", &window) != 1 || window < 0)
+        window = 0;
+    g_free (cap);
+    return window;
+}
+
 static uint32_t
 start_request (CcnetClient *client, const char *peer_id,
-               const char *service)
+               const char *service, int *stream_window)
 {
     uint32_t req_id = ccnet_client_get_request_id (client);
     char buf[512];
@@ -357,6 +400,8 @@ start_request (CcnetClient *client, const char *peer_id,
         return 0;
     }
 
+    *stream_window = parse_stream_window (client->response.content,
+                                          client->response.clen);
     return req_id;
 }
 
@@ -368,18 +413,33 @@ ccnet_client_get_rpc_request_id (CcnetClient *client, const char *peer_id,
     if (item)
         return item->req_id;
 
-    uint32_t req_id = start_request (client, peer_id, service);
+    int stream_window = 0;
+    uint32_t req_id = start_request (client, peer_id, service, &stream_window);
     if (req_id == 0)
         return 0;
 
     item = g_new0 (RpcPoolItem, 1);
     item->req_id = req_id;
+    item->stream_window = stream_window;
     item->peer_id = g_strdup (peer_id);
     item->service = g_strdup (service);
     client->rpc_pool = g_list_prepend (client->rpc_pool, item);
     return req_id;
 }
 
+int
+ccnet_client_get_rpc_stream_window (CcnetClient *client, uint32_t req_id)
+{
+    GList *ptr;
+
+    for (ptr = client->rpc_pool; ptr; ptr = ptr->next) {
+        RpcPoolItem *item = ptr->data;
+        if (req_id == item->req_id)
+            return item->stream_window;
+    }
+    return 0;
+}
+
 void
 ccnet_client_clean_rpc_request (CcnetClient *client, uint32_t req_id)
 {
@@ -398,6 +458,392 @@ ccnet_client_clean_rpc_request (CcnetClient *client, uint32_t req_id)
 }
 
 
+/* functions used in MUX mode */
+
+typedef struct MuxPacket {
+    int        len;
+    char      *data;            /* points right after the struct */
+} MuxPacket;
+
+typedef struct MuxCall {
+    uint32_t        req_id;
+    char           *key;        /* "<peer id> <service>" */
+    int             stream_window;
+
+    pthread_cond_t  cond;       /* signaled when a packet arrives */
+    GQueue         *packets;    /* arrived, not yet read */
+    MuxPacket      *current;    /* last packet read by the owner */
+} MuxCall;
+
+struct CcnetClientPriv {
+    pthread_mutex_t send_lock;  /* serializes writes to client->io */
+
+    pthread_mutex_t lock;       /* protects the fields below */
+    GHashTable     *calls;      /* req_id -> MuxCall owned by a caller */
+    GHashTable     *idle;       /* key -> GList of idle MuxCall */
+    gboolean        dead;       /* the reader has exited */
+
+    pthread_t       reader;
+};
+
+static void
+lock_send (CcnetClient *client)
+{
+    if (client->priv)
+        pthread_mutex_lock (&client->priv->send_lock);
+}
+
+static void
+unlock_send (CcnetClient *client)
+{
+    if (client->priv)
+        pthread_mutex_unlock (&client->priv->send_lock);
+}
+
+static char *
+mux_call_key (const char *peer_id, const char *service)
+{
+    return g_strdup_printf ("%s %s", peer_id ? peer_id : "", service);
+}
+
+static MuxCall *
+mux_call_new (uint32_t req_id, char *key)
+{
+    MuxCall *call = g_new0 (MuxCall, 1);
+
+    call->req_id = req_id;
+    call->key = key;
+    pthread_cond_init (&call->cond, NULL);
+    call->packets = g_queue_new ();
+    return call;
+}
+
+static void
+mux_call_free (MuxCall *call)
+{
+    MuxPacket *pkt;
+
+    while ((pkt = g_queue_pop_head (call->packets)) != NULL)
+        g_free (pkt);
+    g_queue_free (call->packets);
+    g_free (call->current);
+    pthread_cond_destroy (&call->cond);
+    g_free (call->key);
+    g_free (call);
+}
+
+static gboolean
+is_code (ccnet_packet *packet, uint32_t len, const char *code)
+{
+    return len >= 3 && memcmp (packet->data, code, 3) == 0;
+}
+
+/* Routes the responses from the daemon to the waiting callers. */
+static void *
+mux_reader (void *vclient)
+{
+    CcnetClient *client = vclient;
+    CcnetClientPriv *priv = client->priv;
+    ccnet_packet *packet;
+    uint32_t len;
+    MuxCall *call;
+    MuxPacket *pkt;
+    GHashTableIter iter;
+    gpointer value;
+
+    while ((packet = ccnet_packet_io_read_packet (client->io, &len)) != NULL) {
+        if (packet->header.type != CCNET_MSG_RESPONSE) {
+            g_warning ("[client] unexpected packet type %d from daemon\n",
+                       packet->header.type);
+            continue;
+        }
+
+        if (is_code (packet, len, SC_PROC_KEEPALIVE)) {
+            ccnet_client_send_update (client, packet->header.id,
+                                      SC_PROC_ALIVE, SS_PROC_ALIVE, NULL, 0);
+            continue;
+        }
+
+        pthread_mutex_lock (&priv->lock);
+        call = g_hash_table_lookup (priv->calls,
+                                    GUINT_TO_POINTER(packet->header.id));
+        if (call) {
+            pkt = g_malloc (sizeof(MuxPacket) + len);
+            pkt->len = len;
+            pkt->data = (char *)(pkt + 1);
+            memcpy (pkt->data, packet->data, len);
+            g_queue_push_tail (call->packets, pkt);
+            pthread_cond_signal (&call->cond);
+        }
+        pthread_mutex_unlock (&priv->lock);
+
+        if (!call && !is_code (packet, len, SC_PROC_DEAD)) {
+            g_debug ("Delayed response from daemon, id is %d\n",
+                     packet->header.id);
+            ccnet_client_send_update (client, packet->header.id,
+                                      SC_PROC_DEAD, SS_PROC_DEAD, NULL, 0);
+        }
+    }
+
+    pthread_mutex_lock (&priv->lock);
+    priv->dead = TRUE;
+    g_hash_table_iter_init (&iter, priv->calls);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        call = value;
+        pthread_cond_signal (&call->cond);
+    }
+    pthread_mutex_unlock (&priv->lock);
+
+    return NULL;
+}
+
+static int
+mux_start (CcnetClient *client)
+{
+    CcnetClientPriv *priv = g_new0 (CcnetClientPriv, 1);
+
+    pthread_mutex_init (&priv->send_lock, NULL);
+    pthread_mutex_init (&priv->lock, NULL);
+    priv->calls = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->idle = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    client->priv = priv;
+
+    if (pthread_create (&priv->reader, NULL, mux_reader, client) != 0) {
+        g_warning ("[client] failed to start reader thread\n");
+        mux_free_priv (client);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+free_idle_list (gpointer key, gpointer value, gpointer unused)
+{
+    g_list_foreach (value, (GFunc)mux_call_free, NULL);
+    g_list_free (value);
+}
+
+static void
+mux_free_priv (CcnetClient *client)
+{
+    CcnetClientPriv *priv = client->priv;
+
+    if (g_hash_table_size (priv->calls) != 0)
+        g_warning ("[client] disconnected with calls in flight\n");
+    g_hash_table_destroy (priv->calls);
+    g_hash_table_foreach (priv->idle, free_idle_list, NULL);
+    g_hash_table_destroy (priv->idle);
+    pthread_mutex_destroy (&priv->lock);
+    pthread_mutex_destroy (&priv->send_lock);
+    g_free (priv);
+    client->priv = NULL;
+}
+
+/* Callers must have put back their requests. */
+static void
+mux_stop (CcnetClient *client)
+{
+    /* wake up the reader blocked on the socket */
+#ifdef WIN32
+    shutdown (client->connfd, SD_BOTH);
+#else
+    shutdown (client->connfd, SHUT_RDWR);
+#endif
+    pthread_join (client->priv->reader, NULL);
+
+    mux_free_priv (client);
+}
+
+/* Same format as in ccnet_client_read_response(). */
+static int
+parse_response (char *data, int len, struct CcnetResponse *rsp)
+{
+    char *ptr, *end;
+
+    if (len < 4)
+        return -2;
+
+    rsp->code = data;
+    rsp->code_msg = NULL;
+
+    ptr = data + 3;
+    if (*ptr == '\n') {
+        /* no code_msg */
+        *ptr++ = '\0';
+    } else {
+        if (*ptr != ' ')
+            return -2;
+        *ptr++ = '\0';
+        rsp->code_msg = ptr;
+
+        end = data + len;
+        for (; ptr != end && *ptr != '\n'; ptr++) ;
+        if (ptr == end)         /* must end with '\n' */
+            return -2;
+        *ptr++ = '\0';
+    }
+
+    rsp->content = ptr;
+    rsp->clen = len - (ptr - data);
+    return 0;
+}
+
+int
+ccnet_client_mux_read_response (CcnetClient *client, uint32_t req_id,
+                                struct CcnetResponse *rsp)
+{
+    CcnetClientPriv *priv = client->priv;
+    MuxCall *call;
+    MuxPacket *pkt;
+
+    g_return_val_if_fail (priv != NULL, -1);
+
+    pthread_mutex_lock (&priv->lock);
+    call = g_hash_table_lookup (priv->calls, GUINT_TO_POINTER(req_id));
+    if (!call) {
+        pthread_mutex_unlock (&priv->lock);
+        return -1;
+    }
+    g_free (call->current);
+    call->current = NULL;
+
+    while (g_queue_is_empty (call->packets) && !priv->dead)
+        pthread_cond_wait (&call->cond, &priv->lock);
+    pkt = g_queue_pop_head (call->packets);
+    call->current = pkt;
+    pthread_mutex_unlock (&priv->lock);
+
+    if (!pkt)
+        return -1;
+
+    if (parse_response (pkt->data, pkt->len, rsp) < 0) {
+        g_warning ("Bad response format from daemon\n");
+        return -2;
+    }
+    return 0;
+}
+
+static uint32_t
+mux_start_request (CcnetClient *client, MuxCall *call,
+                   const char *peer_id, const char *service)
+{
+    struct CcnetResponse rsp;
+    char buf[512];
+
+    if (!peer_id)
+        snprintf (buf, 512, "%s", service);
+    else
+        snprintf (buf, 512, "remote %s %s", peer_id, service);
+    ccnet_client_send_request (client, call->req_id, buf);
+
+    if (ccnet_client_mux_read_response (client, call->req_id, &rsp) < 0) {
+        g_warning ("[RPC] failed to read response.\n");
+        return 0;
+    }
+
+    if (memcmp (rsp.code, "200", 3) != 0) {
+        g_warning ("[RPC] failed to start rpc server: %s %s.\n",
+                   rsp.code, rsp.code_msg);
+        return 0;
+    }
+
+    call->stream_window = parse_stream_window (rsp.content, rsp.clen);
+    return call->req_id;
+}
+
+uint32_t
+ccnet_client_mux_get_rpc_request (CcnetClient *client, const char *peer_id,
+                                  const char *service, int *stream_window)
+{
+    CcnetClientPriv *priv = client->priv;
+    char *key;
+    GList *list;
+    MuxCall *call = NULL;
+
+    g_return_val_if_fail (priv != NULL, 0);
+
+    key = mux_call_key (peer_id, service);
+
+    pthread_mutex_lock (&priv->lock);
+    if (priv->dead) {
+        pthread_mutex_unlock (&priv->lock);
+        g_free (key);
+        return 0;
+    }
+    list = g_hash_table_lookup (priv->idle, key);
+    if (list) {
+        call = list->data;
+        list = g_list_delete_link (list, list);
+        if (list)
+            g_hash_table_insert (priv->idle, g_strdup(key), list);
+        else
+            g_hash_table_remove (priv->idle, key);
+        g_hash_table_insert (priv->calls, GUINT_TO_POINTER(call->req_id),
+                             call);
+    }
+    pthread_mutex_unlock (&priv->lock);
+
+    if (call) {
+        g_free (key);
+        *stream_window = call->stream_window;
+        return call->req_id;
+    }
+
+    /* register before sending, the reader drops unknown responses */
+    call = mux_call_new (ccnet_client_get_request_id (client), key);
+    pthread_mutex_lock (&priv->lock);
+    g_hash_table_insert (priv->calls, GUINT_TO_POINTER(call->req_id), call);
+    pthread_mutex_unlock (&priv->lock);
+
+    if (mux_start_request (client, call, peer_id, service) == 0) {
+        ccnet_client_mux_put_rpc_request (client, call->req_id, FALSE);
+        return 0;
+    }
+
+    *stream_window = call->stream_window;
+    return call->req_id;
+}
+
+void
+ccnet_client_mux_put_rpc_request (CcnetClient *client, uint32_t req_id,
+                                  gboolean reuse)
+{
+    CcnetClientPriv *priv = client->priv;
+    MuxCall *call;
+    GList *list;
+    gboolean dead;
+
+    g_return_if_fail (priv != NULL);
+
+    pthread_mutex_lock (&priv->lock);
+    call = g_hash_table_lookup (priv->calls, GUINT_TO_POINTER(req_id));
+    if (!call) {
+        pthread_mutex_unlock (&priv->lock);
+        return;
+    }
+    g_hash_table_remove (priv->calls, GUINT_TO_POINTER(req_id));
+
+    dead = priv->dead;
+    /* a response we haven't read means the call is out of step */
+    if (reuse && !dead && g_queue_is_empty (call->packets)) {
+        g_free (call->current);
+        call->current = NULL;
+        list = g_hash_table_lookup (priv->idle, call->key);
+        g_hash_table_insert (priv->idle, g_strdup(call->key),
+                             g_list_prepend (list, call));
+        pthread_mutex_unlock (&priv->lock);
+        return;
+    }
+    pthread_mutex_unlock (&priv->lock);
+
+    if (!dead)
+        ccnet_client_send_update (client, req_id,
+                                  SC_PROC_DONE, SS_PROC_DONE, NULL, 0);
+    mux_call_free (call);
+}
+
+
 /* functions used in ASYNC mode */
 void
 ccnet_client_add_processor (CcnetClient *client, CcnetProcessor *processor)
@@ -620,7 +1066,7 @@ error:
 }
 
 
-static void handle_packet (ccnet_packet *packet, void *vclient)
+static void handle_packet (ccnet_packet *packet, uint32_t len, void *vclient)
 {
     CcnetClient *client = vclient;
     
@@ -632,16 +1078,13 @@ static void handle_packet (ccnet_packet *packet, void *vclient)
 
     switch (packet->header.type) {
     case CCNET_MSG_REQUEST:
-        handle_request (client, packet->header.id,
-                        packet->data, packet->header.length);
+        handle_request (client, packet->header.id, packet->data, len);
         break;
     case CCNET_MSG_RESPONSE:
-        handle_response (client, packet->header.id, 
-                         packet->data, packet->header.length);
+        handle_response (client, packet->header.id, packet->data, len);
         break;
     case CCNET_MSG_UPDATE:
-        handle_update (client, packet->header.id, 
-                         packet->data, packet->header.length);
+        handle_update (client, packet->header.id, packet->data, len);
         break;
     default:
         g_return_if_reached ();
@@ -652,9 +1095,11 @@ static void handle_packet (ccnet_packet *packet, void *vclient)
 void
 ccnet_client_send_request (CcnetClient *client, int req_id, const char *req)
 {
+    lock_send (client);
     ccnet_packet_prepare (client->io, CCNET_MSG_REQUEST, req_id);
     ccnet_packet_write_string (client->io, req);
     ccnet_packet_finish_send (client->io);
+    unlock_send (client);
 
     g_debug ("Send a request: id %d, cmd %s\n", req_id, req);
 }
@@ -676,6 +1121,7 @@ ccnet_client_send_update (CcnetClient *client, int req_id,
     g_return_if_fail (req_id > 0);
     g_return_if_fail (clen < CCNET_PACKET_MAX_PAYLOAD_LEN);
 
+    lock_send (client);
     ccnet_packet_prepare (client->io, CCNET_MSG_UPDATE, req_id);
     /* code line */
     ccnet_packet_add (client->io, code, 3);
@@ -688,6 +1134,7 @@ ccnet_client_send_update (CcnetClient *client, int req_id,
         ccnet_packet_add (client->io, content, clen);
 
     ccnet_packet_finish_send (client->io);
+    unlock_send (client);
 
     /* g_debug ("[client] Send an update: id %d: %s %s len=%d\n", */
     /*          req_id, code, reason, clen); */
@@ -701,6 +1148,7 @@ ccnet_client_send_response (CcnetClient *client, int req_id,
 {
     g_return_if_fail (clen < CCNET_PACKET_MAX_PAYLOAD_LEN);
 
+    lock_send (client);
     ccnet_packet_prepare (client->io, CCNET_MSG_RESPONSE, req_id);
     /* code line */
     ccnet_packet_add (client->io, code, 3);
@@ -713,6 +1161,7 @@ ccnet_client_send_response (CcnetClient *client, int req_id,
         ccnet_packet_add (client->io, content, clen);
 
     ccnet_packet_finish_send (client->io);
+    unlock_send (client);
 
     /* g_debug ("[client] Send an response: id %d: %s %s len=%d\n", */
     /*          req_id, code, reason, clen); */
@@ -735,19 +1184,19 @@ ccnet_client_read_response (CcnetClient *client)
 {
     ccnet_packet *packet;
     char *data;
-    int len, clen;
+    uint32_t len;
+    int clen;
     char *code, *code_msg = 0, *content = 0;
     char *ptr, *end;
 
 restart:
-    if ( (packet = ccnet_packet_io_read_packet (client->io)) == NULL)
+    if ( (packet = ccnet_packet_io_read_packet (client->io, &len)) == NULL)
         return -1;
     
     if (packet->header.type != CCNET_MSG_RESPONSE)
         goto error;
 
     data = packet->data;
-    len = packet->header.length;
 
     g_return_val_if_fail (len >= 4, -1);
     
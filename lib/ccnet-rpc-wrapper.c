@@ -96,6 +96,36 @@ ccnet_async_rpc_client_free (SearpcClient *client)
     searpc_client_free (client);
 }
 
+char **
+ccnet_rpc_call_batch (SearpcClient *client, char **fcalls, int n_calls,
+                      gboolean parallel)
+{
+    char **results;
+    gboolean unsupported = FALSE;
+    size_t len;
+    int i;
+
+    if (n_calls <= 0)
+        return NULL;
+
+    results = ccnetrpc_transport_send_batch (client->arg, fcalls, n_calls,
+                                             parallel, &unsupported);
+    if (results || !unsupported)
+        return results;
+
+    /* the server doesn't know batches, call one by one */
+    results = g_new0 (char *, n_calls + 1);
+    for (i = 0; i < n_calls; ++i) {
+        results[i] = ccnetrpc_transport_send (client->arg, fcalls[i],
+                                              strlen(fcalls[i]), &len);
+        if (!results[i]) {
+            g_strfreev (results);
+            return NULL;
+        }
+    }
+    return results;
+}
+
 CcnetPeer *
 ccnet_get_peer (SearpcClient *client, const char *peer_id)
 {
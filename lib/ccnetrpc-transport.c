@@ -7,95 +7,128 @@
 #include "rpc-common.h"
 #include <ccnet/async-rpc-proc.h>
 
+/* Read one segment of the reply. Returns 1 if more segments follow,
+ * 0 on the last one, -2 if the server didn't know the update code and
+ * -1 on other errors.
+ */
+static int
+read_segment (CcnetClient *session, uint32_t req_id, GString *buf)
+{
+    struct CcnetResponse mux_rsp, *rsp;
+
+    if (session->mode == CCNET_CLIENT_MUX) {
+        if (ccnet_client_mux_read_response (session, req_id, &mux_rsp) < 0)
+            return -1;
+        rsp = &mux_rsp;
+    } else {
+        if (ccnet_client_read_response (session) < 0) {
+            ccnet_client_clean_rpc_request (session, req_id);
+            return -1;
+        }
+        rsp = &session->response;
+    }
+
+    if (memcmp (rsp->code, SC_SERVER_RET, 3) == 0) {
+        g_string_append_len (buf, rsp->content, rsp->clen);
+        return 0;
+    } else if (memcmp (rsp->code, SC_SERVER_MORE, 3) == 0) {
+        g_string_append_len (buf, rsp->content, rsp->clen);
+        return 1;
+    }
+
+    g_warning ("[Sea RPC] Bad response: %s %s.\n", rsp->code, rsp->code_msg);
+    /* the server is done with the request after an error */
+    if (session->mode != CCNET_CLIENT_MUX)
+        ccnet_client_clean_rpc_request (session, req_id);
+    return memcmp (rsp->code, SC_BAD_UPDATE_CODE, 3) == 0 ? -2 : -1;
+}
+
+/* @batch_code is SC_CLIENT_BATCH_CALL or SC_CLIENT_PARALLEL_BATCH_CALL
+ * for a batch, NULL for a single call. If @rejected isn't NULL, it is set
+ * when the server answered the call with SC_BAD_UPDATE_CODE, that is it
+ * didn't run anything. */
 static char *
 invoke_service (CcnetClient *session,
                 const char *peer_id,
                 const char *service,
+                const char *batch_code,
                 const char *fcall_str,
                 size_t fcall_len,
-                size_t *ret_len)
+                size_t *ret_len,
+                gboolean *rejected)
 {
-    struct CcnetResponse *rsp;
     uint32_t req_id;
     GString *buf;
+    int window, received = 0;
+    int ret;
 
-    req_id = ccnet_client_get_rpc_request_id (session, peer_id, service);
+    /* A multiplexed client runs each call on its own request, so
+     * calls from several threads don't mix up their responses.
+     */
+    if (session->mode == CCNET_CLIENT_MUX)
+        req_id = ccnet_client_mux_get_rpc_request (session, peer_id, service,
+                                                   &window);
+    else
+        req_id = ccnet_client_get_rpc_request_id (session, peer_id, service);
     if (req_id == 0) {
         *ret_len = 0;
         return NULL;
     }
 
-    ccnet_client_send_update (session, req_id,
-                              SC_CLIENT_CALL, SS_CLIENT_CALL,
-                              fcall_str, fcall_len);
-
-    if (ccnet_client_read_response (session) < 0) {
-        *ret_len = 0;
-        ccnet_client_clean_rpc_request (session, req_id);
-        return NULL;
-    }
-    rsp = &session->response;
-
-    if (memcmp (rsp->code, SC_SERVER_RET, 3) == 0) {
-        *ret_len = (size_t) rsp->clen;
-        return g_strndup (rsp->content, rsp->clen);
-    } else if (memcmp (rsp->code, SC_SERVER_MORE, 3) != 0) {
-        g_warning ("[Sea RPC] Bad response: %s %s.\n", rsp->code, rsp->code_msg);
-        *ret_len = 0;
-        return NULL;
-    }
-
-    buf = g_string_new_len (rsp->content, rsp->clen);
-    while (1) {
+    /* The server pushes up to `window' segments ahead; we hand the
+     * credits back in batches of half a window instead of asking
+     * for every segment.
+     */
+    if (session->mode != CCNET_CLIENT_MUX)
+        window = ccnet_client_get_rpc_stream_window (session, req_id);
+    if (batch_code) {
+        /* batch results always come in lock-step */
+        window = 0;
+        const char *msg = strcmp (batch_code, SC_CLIENT_BATCH_CALL) == 0 ?
+            SS_CLIENT_BATCH_CALL : SS_CLIENT_PARALLEL_BATCH_CALL;
+        ccnet_client_send_update (session, req_id, batch_code, msg,
+                                  fcall_str, fcall_len);
+    } else if (window > 0)
         ccnet_client_send_update (session, req_id,
-                                  SC_CLIENT_MORE, SS_CLIENT_MORE,
+                                  SC_CLIENT_STREAM_CALL, SS_CLIENT_STREAM_CALL,
+                                  fcall_str, fcall_len);
+    else
+        ccnet_client_send_update (session, req_id,
+                                  SC_CLIENT_CALL, SS_CLIENT_CALL,
                                   fcall_str, fcall_len);
 
-        if (ccnet_client_read_response (session) < 0) {
-            *ret_len = 0;
-            ccnet_client_clean_rpc_request (session, req_id);
-            g_string_free (buf, TRUE);
-            return NULL;
+    buf = g_string_new (NULL);
+    while ((ret = read_segment (session, req_id, buf)) > 0) {
+        if (window == 0) {
+            ccnet_client_send_update (session, req_id,
+                                      SC_CLIENT_MORE, SS_CLIENT_MORE,
+                                      NULL, 0);
+            continue;
         }
-        rsp = &session->response;
 
-        if (memcmp (rsp->code, SC_SERVER_RET, 3) == 0) {
-            g_string_append_len (buf, rsp->content, rsp->clen);
-            *ret_len = buf->len;
-            return g_string_free (buf, FALSE);
-        } else if (memcmp (rsp->code, SC_SERVER_MORE, 3) == 0) { 
-            g_string_append_len (buf, rsp->content, rsp->clen);
-        } else {
-            g_warning ("[Sea RPC] Bad response: %s %s.\n",
-                       rsp->code, rsp->code_msg);
-            *ret_len = 0;
-            g_string_free (buf, TRUE);
-            return NULL;
+        if (++received >= (window + 1) / 2) {
+            char credit[16];
+            int len = snprintf (credit, sizeof(credit), "%d", received);
+            ccnet_client_send_update (session, req_id,
+                                      SC_CLIENT_CREDIT, SS_CLIENT_CREDIT,
+                                      credit, len + 1);
+            received = 0;
         }
     }
 
-    /* Never reach here. */
-    return NULL;
-}
+    if (session->mode == CCNET_CLIENT_MUX)
+        ccnet_client_mux_put_rpc_request (session, req_id, ret == 0);
 
-static CcnetClient *
-create_new_client (const char *conf_dir)
-{
-    CcnetClient *client;
-
-    client = ccnet_client_new ();
-    if (ccnet_client_load_confdir (client, conf_dir) < 0) {
-        g_warning ("[Sea RPC] Failed to load conf dir.\n");
-        g_object_unref (client);
-        return NULL;
-    }
-    if (ccnet_client_connect_daemon (client, CCNET_CLIENT_SYNC) < 0) {
-        g_warning ("[Sea RPC] Failed to connect ccnet.\n");
-        g_object_unref (client);
+    if (ret < 0) {
+        if (rejected)
+            *rejected = (ret == -2);
+        *ret_len = 0;
+        g_string_free (buf, TRUE);
         return NULL;
     }
 
-    return client;
+    *ret_len = buf->len;
+    return g_string_free (buf, FALSE);
 }
 
 char *
@@ -112,7 +145,7 @@ ccnetrpc_transport_send (void *arg, const gchar *fcall_str,
     if (priv->session != NULL) {
         /* Use single ccnet client as transport. */
         return invoke_service (priv->session, priv->peer_id, priv->service,
-                               fcall_str, fcall_len, ret_len);
+                               NULL, fcall_str, fcall_len, ret_len, NULL);
     } else {
         /* Use client pool as transport. */
 
@@ -124,7 +157,7 @@ ccnetrpc_transport_send (void *arg, const gchar *fcall_str,
         }
 
         char *ret = invoke_service (session, priv->peer_id, priv->service,
-                                    fcall_str, fcall_len, ret_len);
+                                    NULL, fcall_str, fcall_len, ret_len, NULL);
         if (ret != NULL) {
             ccnet_client_pool_return_client (priv->pool, session);
             return ret;
@@ -132,30 +165,95 @@ ccnetrpc_transport_send (void *arg, const gchar *fcall_str,
 
         /* If we failed to send data through the ccnet client returned by
          * client pool, ccnet may have been restarted.
-         * In this case, we create a new ccnet client and put it into
-         * the client pool after use.
+         * In this case, we drop the client and retry once with another
+         * one; the pool checks idle clients and connects a new one if
+         * none is alive.
          */
 
         g_message ("[Sea RPC] Ccnet disconnected. Connect again.\n");
 
-        new_session = create_new_client (session->config_dir);
+        ccnet_client_pool_discard_client (priv->pool, session);
+        new_session = ccnet_client_pool_get_client (priv->pool);
         if (!new_session) {
             *ret_len = 0;
             return NULL;
         }
-        g_object_unref (session);
 
         ret = invoke_service (new_session, priv->peer_id, priv->service,
-                              fcall_str, fcall_len, ret_len);
+                              NULL, fcall_str, fcall_len, ret_len, NULL);
         if (ret != NULL)
             ccnet_client_pool_return_client (priv->pool, new_session);
         else
-            g_object_unref (new_session);
+            ccnet_client_pool_discard_client (priv->pool, new_session);
 
         return ret;
     }
 }
 
+char **
+ccnetrpc_transport_send_batch (void *arg, char **fcalls, int n_calls,
+                               gboolean parallel, gboolean *unsupported)
+{
+    CcnetrpcTransportParam *priv = arg;
+    CcnetClient *session;
+    GString *buf;
+    const char *code;
+    char *ret, *p, *end, **results;
+    size_t ret_len;
+    int i;
+
+    g_return_val_if_fail (arg != NULL && n_calls > 0, NULL);
+
+    *unsupported = FALSE;
+
+    buf = g_string_new (NULL);
+    for (i = 0; i < n_calls; ++i)
+        g_string_append_len (buf, fcalls[i], strlen(fcalls[i]) + 1);
+    code = parallel ? SC_CLIENT_PARALLEL_BATCH_CALL : SC_CLIENT_BATCH_CALL;
+
+    if (priv->session != NULL) {
+        ret = invoke_service (priv->session, priv->peer_id, priv->service,
+                              code, buf->str, buf->len, &ret_len,
+                              unsupported);
+    } else {
+        session = ccnet_client_pool_get_client (priv->pool);
+        if (!session) {
+            g_warning ("[Sea RPC] Failed to get client from pool.\n");
+            g_string_free (buf, TRUE);
+            return NULL;
+        }
+        /* Unlike a single call, don't retry: the batch may have run
+         * before the reply got lost. An old server rejects batches and
+         * the client is fine. */
+        ret = invoke_service (session, priv->peer_id, priv->service,
+                              code, buf->str, buf->len, &ret_len,
+                              unsupported);
+        if (ret || *unsupported)
+            ccnet_client_pool_return_client (priv->pool, session);
+        else
+            ccnet_client_pool_discard_client (priv->pool, session);
+    }
+    g_string_free (buf, TRUE);
+
+    if (!ret)
+        return NULL;
+
+    /* "ret\0ret\0...", one for each call */
+    results = g_new0 (char *, n_calls + 1);
+    end = ret + ret_len;
+    for (i = 0, p = ret; i < n_calls && p < end; ++i) {
+        results[i] = g_strndup (p, end - p);
+        p += strlen (results[i]) + 1;
+    }
+    g_free (ret);
+
+    if (i < n_calls || p != end) {
+        g_warning ("[Sea RPC] Bad batch result.\n");
+        g_strfreev (results);
+        return NULL;
+    }
+    return results;
+}
 
 int
 ccnetrpc_async_transport_send (void *arg, gchar *fcall_str,
@@ -2,59 +2,58 @@
 
 #include "include.h"
 #include "cevent.h"
-
-#define CEVENT_SIZE  (sizeof(CEvent))
+#include "completion-queue.h"
 
 typedef struct Handler {
     cevent_handler handler;
     void *handler_data;
 } Handler;
 
+typedef struct QueuedEvent {
+    CcnetCQNode node;           /* must be the first field */
+    CEvent      cevent;
+} QueuedEvent;
+
+static void
+dispatch_event (CcnetCQNode *node, void *vmgr)
+{
+    CEventManager *manager = (CEventManager *) vmgr;
+    QueuedEvent *qe = (QueuedEvent *)node;
+    CEvent *cevent = &qe->cevent;
+
+    Handler *h = g_hash_table_lookup (manager->handler_table,
+                                      (gconstpointer)(long)cevent->id);
+    if (h == NULL)
+        g_warning ("no handler for event type %d\n", cevent->id);
+    else
+        h->handler(cevent, h->handler_data);
+
+    g_free (qe);
+}
+
 CEventManager* cevent_manager_new ()
 {
     CEventManager *manager;
 
     manager = g_new0 (CEventManager, 1);
-    pthread_mutex_init (&manager->mutex, NULL);
+    manager->queue = ccnet_completion_queue_new (dispatch_event, manager);
+    if (!manager->queue) {
+        g_free (manager);
+        return NULL;
+    }
     manager->handler_table = g_hash_table_new_full (g_direct_hash,
                                         g_direct_equal, NULL, g_free);
     
     return manager;
 }
 
-void pipe_callback (int fd, short event, void *vmgr)
-{
-    CEventManager *manager = (CEventManager *) vmgr;
-    CEvent *cevent;
-    char buf[CEVENT_SIZE];
-    
-    if (ccnet_util_pipereadn(fd, buf, CEVENT_SIZE) != CEVENT_SIZE) {
-        g_warning ("read pipe error\n");
-        return;
-    }
-
-    cevent = (CEvent *)buf;
-    Handler *h = g_hash_table_lookup (manager->handler_table,
-                                      (gconstpointer)(long)cevent->id);
-    if (h == NULL) {
-        g_warning ("no handler for event type %d\n", cevent->id);
-        return;
-    }
-
-    h->handler(cevent, h->handler_data);
-}
-
 int cevent_manager_start (CEventManager *manager)
 {
-    if (ccnet_util_pipe(manager->pipefd) < 0) {
-        g_warning ("pipe error: %s\n", strerror(errno));
+    if (!manager->queue || ccnet_completion_queue_start (manager->queue) < 0) {
+        g_warning ("failed to start cevent queue\n");
         return -1;
     }
 
-    event_set (&manager->event, manager->pipefd[0],
-               EV_READ | EV_PERSIST, pipe_callback, manager);
-    event_add (&manager->event, NULL);
-
     return 0;
 }
 
@@ -90,16 +89,9 @@ void
 cevent_manager_add_event (CEventManager *manager, uint32_t id,
                           void *data)
 {
-    pthread_mutex_lock (&manager->mutex);
-
-    struct CEvent cevent;
-    char *buf = (char *) &cevent;
-
-    cevent.id = id;
-    cevent.data = data;
-    if (ccnet_util_pipewriten(manager->pipefd[1], buf, CEVENT_SIZE) != CEVENT_SIZE) {
-        g_warning ("add event error\n");
-    }
+    QueuedEvent *qe = g_new (QueuedEvent, 1);
 
-    pthread_mutex_unlock (&manager->mutex);
+    qe->cevent.id = id;
+    qe->cevent.data = data;
+    ccnet_completion_queue_push (manager->queue, &qe->node);
 }
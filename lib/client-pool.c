@@ -1,3 +1,5 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
 #include "include.h"
 
 #include <ccnet.h>
@@ -5,47 +7,382 @@
 
 #include <glib.h>
 #include <pthread.h>
+#include <sys/time.h>
+
+#ifdef WIN32
+    #include <winsock2.h>
+#else
+    #include <poll.h>
+#endif
+
+/*
+ * The pool keeps at most max_clients connections open, idle or in use.
+ * A caller finding no idle client and no room waits for one to come
+ * back. Idle clients are kept most recently used first; the ones idle
+ * for longer than IDLE_TIMEOUT are closed as long as more than
+ * min_clients are open, and every client is checked for a closed
+ * connection before it is handed out.
+ *
+ * Each thread also parks the last client it returned in a thread local
+ * slot, and takes it back from there without locking the pool. A parked
+ * client counts as open; a caller finding the pool full takes one from
+ * another thread's slot before it waits, and parked clients idle for
+ * longer than IDLE_TIMEOUT are closed like idle ones.
+ */
+
+#define DEFAULT_MAX_CLIENTS 64
+#define IDLE_TIMEOUT        300     /* seconds */
+#define WAIT_TIMEOUT        30      /* seconds */
+#define SWEEP_INTERVAL      60      /* seconds, for parked clients */
+
+typedef struct IdleClient {
+    CcnetClient *client;
+    time_t       last_used;
+} IdleClient;
+
+typedef struct ThreadSlot {
+    struct CcnetClientPool *pool;
+    gpointer                client;     /* atomic, see take_parked() */
+    time_t                  parked;     /* when the client was parked */
+} ThreadSlot;
 
 struct CcnetClientPool {
-    GQueue *clients;
+    GQueue *clients;            /* IdleClient, most recently used first */
     pthread_mutex_t lock;
+    pthread_cond_t  cond;       /* an idle client or room for a new one */
     const char *conf_dir;
+
+    int min_clients;
+    int max_clients;
+    int n_clients;              /* open, including the ones being created */
+
+    pthread_key_t thread_slot;
+    GList *slots;               /* ThreadSlot of all threads */
+    time_t next_sweep;
+
+    CcnetClientPoolStat stat;
 };
 
+static gint64
+now_usec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+}
+
+static CcnetClient *
+connect_client (const char *conf_dir)
+{
+    CcnetClient *client;
+
+    client = ccnet_client_new ();
+    if (ccnet_client_load_confdir (client, conf_dir) < 0) {
+        g_warning ("[client pool] Failed to load conf dir.\n");
+        g_object_unref (client);
+        return NULL;
+    }
+    if (ccnet_client_connect_daemon (client, CCNET_CLIENT_SYNC) < 0) {
+        g_warning ("[client pool] Failed to connect.\n");
+        g_object_unref (client);
+        return NULL;
+    }
+
+    return client;
+}
+
+/* An idle client has nothing to read; readable means the daemon closed
+ * the connection or sent something nobody waits for. */
+static gboolean
+client_is_alive (CcnetClient *client)
+{
+    if (!client->connected)
+        return FALSE;
+
+#ifdef WIN32
+    fd_set fds;
+    struct timeval tv = { 0, 0 };
+
+    FD_ZERO (&fds);
+    FD_SET (client->connfd, &fds);
+    return select (client->connfd + 1, &fds, NULL, NULL, &tv) == 0;
+#else
+    struct pollfd pfd;
+
+    pfd.fd = client->connfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll (&pfd, 1, 0) == 0;
+#endif
+}
+
+/* Called with the pool unlocked. */
+static void
+close_client (struct CcnetClientPool *cpool, CcnetClient *client)
+{
+    g_object_unref (client);
+
+    pthread_mutex_lock (&cpool->lock);
+    cpool->n_clients--;
+    cpool->stat.n_evicted++;
+    pthread_cond_signal (&cpool->cond);
+    pthread_mutex_unlock (&cpool->lock);
+}
+
+/* Take the client parked in @slot, from any thread. */
+static CcnetClient *
+take_parked (ThreadSlot *slot)
+{
+    gpointer client;
+
+    do {
+        client = g_atomic_pointer_get (&slot->client);
+        if (!client)
+            return NULL;
+    } while (!g_atomic_pointer_compare_and_exchange (&slot->client,
+                                                     client, NULL));
+    return client;
+}
+
+static void
+free_thread_slot (void *vslot)
+{
+    ThreadSlot *slot = vslot;
+    struct CcnetClientPool *cpool = slot->pool;
+    CcnetClient *client;
+
+    pthread_mutex_lock (&cpool->lock);
+    cpool->slots = g_list_remove (cpool->slots, slot);
+    pthread_mutex_unlock (&cpool->lock);
+
+    client = take_parked (slot);
+    if (client)
+        close_client (cpool, client);
+    g_free (slot);
+}
+
+static ThreadSlot *
+get_thread_slot (struct CcnetClientPool *cpool)
+{
+    ThreadSlot *slot = pthread_getspecific (cpool->thread_slot);
+
+    if (!slot) {
+        slot = g_new0 (ThreadSlot, 1);
+        slot->pool = cpool;
+        pthread_setspecific (cpool->thread_slot, slot);
+
+        pthread_mutex_lock (&cpool->lock);
+        cpool->slots = g_list_prepend (cpool->slots, slot);
+        pthread_mutex_unlock (&cpool->lock);
+    }
+    return slot;
+}
+
+/* Called with the pool locked. A client parked by another thread. */
+static CcnetClient *
+steal_parked_client (struct CcnetClientPool *cpool)
+{
+    GList *ptr;
+    CcnetClient *client;
+
+    for (ptr = cpool->slots; ptr; ptr = ptr->next) {
+        client = take_parked (ptr->data);
+        if (client)
+            return client;
+    }
+    return NULL;
+}
+
+/* Close the parked clients idle for longer than IDLE_TIMEOUT, as long as
+ * more than min_clients are open. Does the work once a SWEEP_INTERVAL. */
+static void
+sweep_parked_clients (struct CcnetClientPool *cpool, time_t now)
+{
+    GList *ptr, *expired = NULL;
+    ThreadSlot *slot;
+    CcnetClient *client;
+    int n_open;
+
+    /* read unlocked, only a hint */
+    if (now < cpool->next_sweep)
+        return;
+
+    pthread_mutex_lock (&cpool->lock);
+    if (now < cpool->next_sweep) {
+        pthread_mutex_unlock (&cpool->lock);
+        return;
+    }
+    cpool->next_sweep = now + SWEEP_INTERVAL;
+
+    n_open = cpool->n_clients;
+    for (ptr = cpool->slots; ptr && n_open > cpool->min_clients;
+         ptr = ptr->next) {
+        slot = ptr->data;
+        if (now - slot->parked <= IDLE_TIMEOUT)
+            continue;
+        client = take_parked (slot);
+        if (client) {
+            expired = g_list_prepend (expired, client);
+            n_open--;
+        }
+    }
+    pthread_mutex_unlock (&cpool->lock);
+
+    for (ptr = expired; ptr; ptr = ptr->next)
+        close_client (cpool, ptr->data);
+    g_list_free (expired);
+}
+
 struct CcnetClientPool *
 ccnet_client_pool_new (const char *conf_dir)
+{
+    return ccnet_client_pool_new_full (conf_dir, 0, DEFAULT_MAX_CLIENTS);
+}
+
+struct CcnetClientPool *
+ccnet_client_pool_new_full (const char *conf_dir,
+                            int min_clients, int max_clients)
 {
     CcnetClientPool *pool = g_new0 (CcnetClientPool, 1);
+    CcnetClient *client;
+    IdleClient *idle;
+    int i;
+
+    if (max_clients <= 0)
+        max_clients = DEFAULT_MAX_CLIENTS;
+    if (min_clients > max_clients)
+        min_clients = max_clients;
 
     pool->clients = g_queue_new ();
     pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->cond, NULL);
+    pthread_key_create (&pool->thread_slot, free_thread_slot);
     pool->conf_dir = g_strdup(conf_dir);
+    pool->min_clients = min_clients;
+    pool->max_clients = max_clients;
+    pool->next_sweep = time (NULL) + SWEEP_INTERVAL;
+
+    /* prewarm, the pool is usable even if the daemon isn't up yet */
+    for (i = 0; i < min_clients; ++i) {
+        client = connect_client (conf_dir);
+        if (!client)
+            break;
+        idle = g_new (IdleClient, 1);
+        idle->client = client;
+        idle->last_used = time (NULL);
+        g_queue_push_tail (pool->clients, idle);
+        pool->n_clients++;
+        pool->stat.n_created++;
+    }
 
     return pool;
 }
 
+/* Called with the pool locked. */
+static CcnetClient *
+pop_idle_client (struct CcnetClientPool *cpool)
+{
+    IdleClient *idle = g_queue_pop_head (cpool->clients);
+    CcnetClient *client;
+
+    if (!idle)
+        return NULL;
+    client = idle->client;
+    g_free (idle);
+    return client;
+}
+
 CcnetClient *
 ccnet_client_pool_get_client (struct CcnetClientPool *cpool)
 {
+    ThreadSlot *slot = get_thread_slot (cpool);
     CcnetClient *client;
+    struct timespec deadline;
+    gint64 start = 0, waited;
+    gboolean timed_out = FALSE;
+    int rc;
+
+    /* fast path, the client this thread returned last */
+    client = take_parked (slot);
+    if (client) {
+        if (client_is_alive (client))
+            return client;
+        close_client (cpool, client);
+    }
 
     pthread_mutex_lock (&cpool->lock);
-    client = g_queue_pop_head (cpool->clients);
-    pthread_mutex_unlock (&cpool->lock);
+    while (1) {
+        while ((client = pop_idle_client (cpool)) != NULL) {
+            if (client_is_alive (client))
+                goto out;
+            /* don't hold the lock over the unref */
+            pthread_mutex_unlock (&cpool->lock);
+            close_client (cpool, client);
+            pthread_mutex_lock (&cpool->lock);
+        }
 
-    if (!client) {
-        client = ccnet_client_new ();
-        if (ccnet_client_load_confdir (client, cpool->conf_dir) < 0) {
-            g_warning ("[client pool] Failed to load conf dir.\n");
-            g_object_unref (client);
-            return NULL;
+        if (cpool->n_clients < cpool->max_clients)
+            break;
+
+        /* announce the wait before looking at the parked clients, a
+         * thread parking one at the same time then sees it, see
+         * ccnet_client_pool_return_client() */
+        g_atomic_int_inc (&cpool->stat.n_waiting);
+        client = steal_parked_client (cpool);
+        if (client) {
+            g_atomic_int_add (&cpool->stat.n_waiting, -1);
+            if (client_is_alive (client))
+                goto out;
+            pthread_mutex_unlock (&cpool->lock);
+            close_client (cpool, client);
+            pthread_mutex_lock (&cpool->lock);
+            continue;
         }
-        if (ccnet_client_connect_daemon (client, CCNET_CLIENT_SYNC) < 0) {
-            g_warning ("[client pool] Failed to connect.\n");
-            g_object_unref (client);
-            return NULL;
+
+        if (timed_out) {
+            g_atomic_int_add (&cpool->stat.n_waiting, -1);
+            g_warning ("[client pool] No client available after %d seconds.\n",
+                       WAIT_TIMEOUT);
+            client = NULL;
+            goto out;
+        }
+
+        if (!start) {
+            start = now_usec ();
+            deadline.tv_sec = start / G_USEC_PER_SEC + WAIT_TIMEOUT;
+            deadline.tv_nsec = (start % G_USEC_PER_SEC) * 1000;
+            cpool->stat.n_waits++;
         }
+
+        rc = pthread_cond_timedwait (&cpool->cond, &cpool->lock, &deadline);
+        g_atomic_int_add (&cpool->stat.n_waiting, -1);
+        /* look once more before giving up */
+        timed_out = (rc == ETIMEDOUT);
+    }
+
+    /* reserve the room, connect without the lock */
+    cpool->n_clients++;
+    cpool->stat.n_created++;
+    pthread_mutex_unlock (&cpool->lock);
+
+    client = connect_client (cpool->conf_dir);
+
+    pthread_mutex_lock (&cpool->lock);
+    if (!client) {
+        cpool->n_clients--;
+        cpool->stat.n_created--;
+        pthread_cond_signal (&cpool->cond);
+    }
+
+out:
+    if (start) {
+        waited = now_usec () - start;
+        cpool->stat.wait_usec += waited;
+        if (waited > cpool->stat.max_wait_usec)
+            cpool->stat.max_wait_usec = waited;
     }
+    pthread_mutex_unlock (&cpool->lock);
 
     return client;
 }
@@ -54,8 +391,64 @@ void
 ccnet_client_pool_return_client (struct CcnetClientPool *cpool,
                                  CcnetClient *client)
 {
+    ThreadSlot *slot = get_thread_slot (cpool);
+    IdleClient *idle, *oldest;
+    CcnetClient *evicted = NULL;
+    time_t now = time (NULL);
+
+    /* Park it for this thread if nobody waits. Parking before looking at
+     * n_waiting pairs with the waiter announcing itself before looking
+     * at the slots: at least one of the two sees the other. */
+    if (!g_atomic_pointer_get (&slot->client)) {
+        slot->parked = now;
+        g_atomic_pointer_set (&slot->client, client);
+        if (g_atomic_int_get (&cpool->stat.n_waiting) == 0) {
+            sweep_parked_clients (cpool, now);
+            return;
+        }
+        /* hand it to the waiter, unless it took it already */
+        client = take_parked (slot);
+        if (!client)
+            return;
+    }
+
+    idle = g_new (IdleClient, 1);
+    idle->client = client;
+    idle->last_used = now;
+
     pthread_mutex_lock (&cpool->lock);
-    g_queue_push_tail (cpool->clients, client);
+    g_queue_push_head (cpool->clients, idle);
+    pthread_cond_signal (&cpool->cond);
+
+    /* one at a time is enough to drain the pool after a burst */
+    oldest = g_queue_peek_tail (cpool->clients);
+    if (cpool->n_clients > cpool->min_clients &&
+        now - oldest->last_used > IDLE_TIMEOUT) {
+        g_queue_pop_tail (cpool->clients);
+        evicted = oldest->client;
+        g_free (oldest);
+    }
     pthread_mutex_unlock (&cpool->lock);
+
+    if (evicted)
+        close_client (cpool, evicted);
+    sweep_parked_clients (cpool, now);
 }
 
+void
+ccnet_client_pool_discard_client (struct CcnetClientPool *cpool,
+                                  CcnetClient *client)
+{
+    close_client (cpool, client);
+}
+
+void
+ccnet_client_pool_get_stat (struct CcnetClientPool *cpool,
+                            CcnetClientPoolStat *stat)
+{
+    pthread_mutex_lock (&cpool->lock);
+    *stat = cpool->stat;
+    stat->n_clients = cpool->n_clients;
+    stat->n_idle = g_queue_get_length (cpool->clients);
+    pthread_mutex_unlock (&cpool->lock);
+}
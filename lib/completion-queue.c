@@ -0,0 +1,194 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#ifdef CCNET_LIB
+    #include "libccnet_utils.h"
+    #define pipereadn       ccnet_util_pipereadn
+    #define pipewriten      ccnet_util_pipewriten
+    #define pipeclose       ccnet_util_pipeclose
+    #define ccnet_pipe      ccnet_util_pipe
+#else
+    #include "utils.h"
+#endif
+
+#include "completion-queue.h"
+
+struct CcnetCompletionQueue {
+    CcnetCQNode    *head;       /* pushed items, newest first */
+
+    CcnetCQFunc     func;
+    void           *user_data;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    int             efd;
+#else
+    ccnet_pipe_t    pipefd[2];
+#endif
+    struct event    event;
+    gboolean        started;
+};
+
+static int
+open_wakeup (CcnetCompletionQueue *cq)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    cq->efd = eventfd (0, EFD_CLOEXEC);
+    return cq->efd < 0 ? -1 : 0;
+#else
+    return ccnet_pipe (cq->pipefd);
+#endif
+}
+
+static int
+wakeup_fd (CcnetCompletionQueue *cq)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    return cq->efd;
+#else
+    return cq->pipefd[0];
+#endif
+}
+
+static void
+signal_wakeup (CcnetCompletionQueue *cq)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t v = 1;
+    if (write (cq->efd, &v, sizeof(v)) != sizeof(v))
+        g_warning ("[Completion Queue] write eventfd error: %s\n",
+                   strerror(errno));
+#else
+    if (pipewriten (cq->pipefd[1], "c", 1) != 1)
+        g_warning ("[Completion Queue] write to pipe error: %s\n",
+                   strerror(errno));
+#endif
+}
+
+/* The fd is readable when this is called, so it doesn't block. */
+static void
+clear_wakeup (CcnetCompletionQueue *cq)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t v;
+    if (read (cq->efd, &v, sizeof(v)) != sizeof(v))
+        g_warning ("[Completion Queue] read eventfd error: %s\n",
+                   strerror(errno));
+#else
+    char buf[1];
+    if (pipereadn (cq->pipefd[0], buf, 1) != 1)
+        g_warning ("[Completion Queue] read pipe error: %s\n",
+                   strerror(errno));
+#endif
+}
+
+static void
+drain (CcnetCompletionQueue *cq)
+{
+    CcnetCQNode *head, *node, *next, *list = NULL;
+
+    /* Take the whole list. As this is the only consumer and it never
+     * pops single nodes, the push side is free of ABA problems. */
+    do {
+        head = g_atomic_pointer_get (&cq->head);
+    } while (!g_atomic_pointer_compare_and_exchange (&cq->head, head, NULL));
+
+    /* restore push order */
+    for (node = head; node; node = next) {
+        next = node->next;
+        node->next = list;
+        list = node;
+    }
+
+    for (node = list; node; node = next) {
+        next = node->next;
+        cq->func (node, cq->user_data);
+    }
+}
+
+static void
+wakeup_cb (evutil_socket_t fd, short event, void *vcq)
+{
+    CcnetCompletionQueue *cq = vcq;
+
+    clear_wakeup (cq);
+    drain (cq);
+}
+
+CcnetCompletionQueue *
+ccnet_completion_queue_new (CcnetCQFunc func, void *user_data)
+{
+    CcnetCompletionQueue *cq = g_new0 (CcnetCompletionQueue, 1);
+
+    cq->func = func;
+    cq->user_data = user_data;
+    if (open_wakeup (cq) < 0) {
+        g_warning ("[Completion Queue] failed to create wakeup fd: %s\n",
+                   strerror(errno));
+        g_free (cq);
+        return NULL;
+    }
+
+    return cq;
+}
+
+void
+ccnet_completion_queue_free (CcnetCompletionQueue *cq)
+{
+    if (cq->started)
+        event_del (&cq->event);
+#ifdef HAVE_SYS_EVENTFD_H
+    close (cq->efd);
+#else
+    pipeclose (cq->pipefd[0]);
+    pipeclose (cq->pipefd[1]);
+#endif
+    g_free (cq);
+}
+
+int
+ccnet_completion_queue_start (CcnetCompletionQueue *cq)
+{
+    if (cq->started)
+        return 0;
+
+    event_set (&cq->event, wakeup_fd (cq), EV_READ | EV_PERSIST,
+               wakeup_cb, cq);
+    if (event_add (&cq->event, NULL) < 0)
+        return -1;
+    cq->started = TRUE;
+
+    return 0;
+}
+
+void
+ccnet_completion_queue_push (CcnetCompletionQueue *cq, CcnetCQNode *node)
+{
+    CcnetCQNode *head;
+
+    do {
+        head = g_atomic_pointer_get (&cq->head);
+        node->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange (&cq->head, head, node));
+
+    /* Only the push that makes the queue non-empty wakes the main loop,
+     * later ones are picked up by the same drain. */
+    if (head == NULL)
+        signal_wakeup (cq);
+}
+
+void
+ccnet_completion_queue_wait (CcnetCompletionQueue *cq)
+{
+    clear_wakeup (cq);
+    drain (cq);
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * A completion queue passes items from any number of threads to the
+ * main loop. Pushing is lock free; a single eventfd (a pipe where
+ * eventfd is not available) wakes the main loop up, at most once per
+ * batch, and the main loop drains all queued items at once.
+ */
+
+#ifndef CCNET_COMPLETION_QUEUE_H
+#define CCNET_COMPLETION_QUEUE_H
+
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <event2/event.h>
+#include <event2/event_compat.h>
+#include <event2/event_struct.h>
+#else
+#include <event.h>
+#endif
+
+#include <glib.h>
+
+/* Embedded in the queued item. */
+typedef struct CcnetCQNode CcnetCQNode;
+struct CcnetCQNode {
+    CcnetCQNode *next;
+};
+
+/* Called in the main loop for every item, in push order. */
+typedef void (*CcnetCQFunc) (CcnetCQNode *node, void *user_data);
+
+typedef struct CcnetCompletionQueue CcnetCompletionQueue;
+
+CcnetCompletionQueue *
+ccnet_completion_queue_new (CcnetCQFunc func, void *user_data);
+
+void
+ccnet_completion_queue_free (CcnetCompletionQueue *cq);
+
+/* Register the wakeup fd in the main loop. Can be called many times. */
+int
+ccnet_completion_queue_start (CcnetCompletionQueue *cq);
+
+/* Thread safe. */
+void
+ccnet_completion_queue_push (CcnetCompletionQueue *cq, CcnetCQNode *node);
+
+/* Block until something is pushed, then drain the queue. Only for
+ * callers without a main loop. */
+void
+ccnet_completion_queue_wait (CcnetCompletionQueue *cq);
+
+#endif
@@ -17,21 +17,19 @@
 
 #ifdef CCNET_LIB
     #include "libccnet_utils.h"
-    #define pipereadn       ccnet_util_pipereadn
-    #define pipewriten      ccnet_util_pipewriten
-    #define pipeclose       ccnet_util_pipeclose
-    #define ccnet_pipe      ccnet_util_pipe
 #else
     #include "utils.h"
 #endif
 
 #include "job-mgr.h"
+#include "completion-queue.h"
 
 struct _CcnetJob {
+    CcnetCQNode     node;       /* must be the first field */
+
     CcnetJobManager *manager;
 
     int             id;
-    ccnet_pipe_t    pipefd[2];
 
     JobThreadFunc   thread_func;
     JobDoneCallback done_func;  /* called when the thread is done */
@@ -52,43 +50,35 @@ job_thread_wrapper (void *vdata, void *unused)
 
     
     job->result = job->thread_func (job->data);
-    if (pipewriten (job->pipefd[1], "a", 1) != 1) {
-        g_warning ("[Job Manager] write to pipe error: %s\n", strerror(errno));
-    }
+    ccnet_completion_queue_push (job->manager->done_queue, &job->node);
 }
 
 static void
-job_done_cb (int fd, short event, void *vdata)
+job_done_cb (CcnetCQNode *node, void *unused)
 {
-    CcnetJob *job = vdata;
-    char buf[1];
+    CcnetJob *job = (CcnetJob *)node;
 
-    if (pipereadn (job->pipefd[0], buf, 1) != 1) {
-        g_warning ("[Job Manager] read pipe error: %s\n", strerror(errno));
-    }
-    pipeclose (job->pipefd[0]);
-    pipeclose (job->pipefd[1]);
     if (job->done_func) {
         job->done_func (job->result);
     }
 
+    job->manager->n_pending--;
     ccnet_job_manager_remove_job (job->manager, job->id);
 }
 
 int
 job_thread_create (CcnetJob *job)
 {
-    if (ccnet_pipe (job->pipefd) < 0) {
-        g_warning ("pipe error: %s\n", strerror(errno));
+#ifndef UNIT_TEST
+    /* The main loop may not exist yet when the manager is created. */
+    if (ccnet_completion_queue_start (job->manager->done_queue) < 0) {
+        g_warning ("[Job Manager] failed to watch the done queue\n");
         return -1;
     }
+#endif
 
     g_thread_pool_push (job->manager->thread_pool, job, NULL);
 
-#ifndef UNIT_TEST
-    event_once (job->pipefd[0], EV_READ, job_done_cb, job, NULL);
-#endif
-
     return 0;
 }
 
@@ -113,6 +103,13 @@ ccnet_job_manager_new (int max_threads)
     CcnetJobManager *mgr;
 
     mgr = g_new0 (CcnetJobManager, 1);
+    mgr->done_queue = ccnet_completion_queue_new (job_done_cb, NULL);
+    if (!mgr->done_queue) {
+        g_warning ("[Job Manager] failed to create the done queue\n");
+        g_free (mgr);
+        return NULL;
+    }
+    mgr->max_threads = max_threads;
     mgr->jobs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
                                        NULL, (GDestroyNotify)ccnet_job_free);
     mgr->thread_pool = g_thread_pool_new (job_thread_wrapper,
@@ -130,9 +127,29 @@ ccnet_job_manager_free (CcnetJobManager *mgr)
 {
     g_hash_table_destroy (mgr->jobs);
     g_thread_pool_free (mgr->thread_pool, TRUE, FALSE);
+    ccnet_completion_queue_free (mgr->done_queue);
     g_free (mgr);
 }
 
+void
+ccnet_job_manager_set_limits (CcnetJobManager *mgr,
+                              int max_threads, int max_queue)
+{
+    if (max_threads > 0 && max_threads != mgr->max_threads) {
+        g_thread_pool_set_max_threads (mgr->thread_pool, max_threads, NULL);
+        mgr->max_threads = max_threads;
+    }
+    mgr->max_queue = max_queue;
+}
+
+gboolean
+ccnet_job_manager_is_full (CcnetJobManager *mgr)
+{
+    if (mgr->max_queue <= 0)
+        return FALSE;
+    return mgr->n_pending >= mgr->max_threads + mgr->max_queue;
+}
+
 int
 ccnet_job_manager_schedule_job (CcnetJobManager *mgr,
                                JobThreadFunc func,
@@ -147,6 +164,7 @@ ccnet_job_manager_schedule_job (CcnetJobManager *mgr,
     job->data = data;
     
     g_hash_table_insert (mgr->jobs, (gpointer)(long)job->id, job);
+    mgr->n_pending++;
 
     job_thread_create (job);
 
@@ -163,10 +181,8 @@ ccnet_job_manager_remove_job (CcnetJobManager *mgr, int job_id)
 void
 ccnet_job_manager_wait_job (CcnetJobManager *mgr, int job_id)
 {
-    CcnetJob *job;
-    
-    job = g_hash_table_lookup (mgr->jobs, (gpointer)(long)job_id);
-    /* manually call job_done_cb */
-    job_done_cb (0, 0, (void *)job);
+    /* manually run the done callbacks */
+    while (g_hash_table_lookup (mgr->jobs, (gpointer)(long)job_id))
+        ccnet_completion_queue_wait (mgr->done_queue);
 }
 #endif
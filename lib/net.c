@@ -241,6 +241,33 @@ ccnet_net_accept (evutil_socket_t b, struct sockaddr_storage *cliaddr,
     return s;
 }
 
+int
+ccnet_net_listen_queue_full (evutil_socket_t fd)
+{
+#ifdef __linux__
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    /* for listening sockets tcpi_unacked is the accept queue length
+     * and tcpi_sacked the backlog */
+    if (getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        return 0;
+    return info.tcpi_sacked > 0 && info.tcpi_unacked >= info.tcpi_sacked;
+#else
+    return 0;
+#endif
+}
+
+int
+ccnet_net_accept_resource_error (int err)
+{
+#ifdef WIN32
+    return err == WSAEMFILE || err == WSAENOBUFS;
+#else
+    return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+#endif
+}
+
 
 evutil_socket_t
 ccnet_net_bind_v4 (const char *ipaddr, int *port)
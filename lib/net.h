@@ -50,6 +50,15 @@ evutil_socket_t ccnet_net_accept (evutil_socket_t b,
                                   struct sockaddr_storage *cliaddr,
                                   socklen_t *len, int nonblock);
 
+/* TRUE if the accept queue of the listening TCP socket @fd is at its
+ * backlog, the kernel drops new SYNs then. Always FALSE where the
+ * system does not report it. */
+int ccnet_net_listen_queue_full (evutil_socket_t fd);
+
+/* TRUE if accept() failed for lack of fds or memory, rather than
+ * because the queue is empty. */
+int ccnet_net_accept_resource_error (int err);
+
 /* bind to an IPv4 address, if (*port == 0) the port number will be returned */
 evutil_socket_t ccnet_net_bind_v4 (const char *ipaddr, int *port);
 
@@ -152,11 +152,73 @@ ccnet_packet_finish_send (CcnetPacketIO *io)
     ccnet_packet_send (io);
 }
 
+/*
+ * Tell the daemon the highest protocol version we speak. Daemons before
+ * protocol v2 silently drop packets with id 0.
+ */
+void
+ccnet_packet_send_hello (CcnetPacketIO *io)
+{
+    ccnet_header header;
+
+    header.version = CCNET_PROTO_VERSION;
+    header.type = CCNET_MSG_HANDSHAKE;
+    header.length = 0;
+    header.id = 0;
+    buffer_add (io->buffer, &header, sizeof (header));
+    ccnet_packet_send (io);
+}
+
+/* Convert the header at the beginning of @buf to host byte order, and
+ * return the packet view of it. For v2 packets, a v1-shaped header is
+ * rebuilt just before the payload. */
+static ccnet_packet *
+packet_from_frame (char *buf, uint32_t *len)
+{
+    ccnet_packet *packet = (ccnet_packet *)buf;
+    ccnet_header_v2 v2;
+
+    if (!CCNET_HEADER_IS_V2 (&packet->header)) {
+        *len = ntohs (packet->header.length);
+        packet->header.length = *len;
+        packet->header.id = ntohl (packet->header.id);
+        return packet;
+    }
+
+    memcpy (&v2, buf, sizeof(v2));
+    *len = ntohl (v2.length);
+    packet = (ccnet_packet *)(buf + CCNET_PACKET_LENGTH_HEADER_V2
+                              - CCNET_PACKET_LENGTH_HEADER);
+    packet->header.version = v2.version;
+    packet->header.type = v2.type;
+    packet->header.length = 0;
+    packet->header.id = ntohl (v2.id);
+    return packet;
+}
+
+/* Return the header length and the payload length of the packet at the
+ * beginning of @buf, which holds at least CCNET_PACKET_LENGTH_HEADER bytes.
+ * Returns 0 if more bytes are needed to know. */
+static int
+peek_lengths (char *buf, int buflen, uint32_t *len)
+{
+    ccnet_header *header = (ccnet_header *)buf;
+
+    if (!CCNET_HEADER_IS_V2 (header)) {
+        *len = ntohs (header->length);
+        return CCNET_PACKET_LENGTH_HEADER;
+    }
+
+    if (buflen < CCNET_PACKET_LENGTH_HEADER_V2)
+        return 0;
+    *len = ntohl (((ccnet_header_v2 *)buf)->length);
+    return CCNET_PACKET_LENGTH_HEADER_V2;
+}
+
 ccnet_packet *
-ccnet_packet_io_read_packet (CcnetPacketIO* io)
+ccnet_packet_io_read_packet (CcnetPacketIO* io, uint32_t *len)
 {
     ccnet_packet *packet;
-    int len;
 
     buffer_drain (io->in_buf, io->in_buf->off);
 
@@ -164,18 +226,23 @@ ccnet_packet_io_read_packet (CcnetPacketIO* io)
         return NULL;
 
     packet = (ccnet_packet *) BUFFER_DATA(io->in_buf);
-    len = ntohs (packet->header.length);
-    if (len > 0) {
-        if (readn (io->fd, io->in_buf, len) <= 0)
+    if (CCNET_HEADER_IS_V2 (&packet->header)) {
+        if (readn (io->fd, io->in_buf, CCNET_PACKET_LENGTH_HEADER_V2
+                   - CCNET_PACKET_LENGTH_HEADER) <= 0)
             return NULL;
     }
 
-    /* Note: must reset packet since readn() may cause realloc of buffer */
-    packet = (ccnet_packet *) BUFFER_DATA(io->in_buf);
-    packet->header.length = len;
-    packet->header.id = ntohl (packet->header.id);
+    peek_lengths ((char *)BUFFER_DATA(io->in_buf),
+                  BUFFER_LENGTH(io->in_buf), len);
+    if (*len > CCNET_PACKET_MAX_PAYLOAD_LEN_V2)
+        return NULL;
+    if (*len > 0) {
+        if (readn (io->fd, io->in_buf, *len) <= 0)
+            return NULL;
+    }
 
-    return packet;
+    /* Note: must reset packet since readn() may cause realloc of buffer */
+    return packet_from_frame ((char *)BUFFER_DATA(io->in_buf), len);
 }
 
 void
@@ -193,7 +260,8 @@ ccnet_packet_io_read (CcnetPacketIO *io)
 {
     int n;
     ccnet_packet *packet;
-    int len;
+    uint32_t len;
+    int hlen;
     
 again:
     if ( (n = buffer_read(io->in_buf, io->fd, 1024)) < 0) {
@@ -206,23 +274,29 @@ again:
 
     if (n == 0) {
         if (io->func)
-            io->func (NULL, io->user_data);
+            io->func (NULL, 0, io->user_data);
         return 0;
     }
     
     while (BUFFER_LENGTH(io->in_buf) >= CCNET_PACKET_LENGTH_HEADER)
     {
-        packet = (ccnet_packet *) BUFFER_DATA(io->in_buf);
-        len = ntohs (packet->header.length);
+        hlen = peek_lengths ((char *)BUFFER_DATA(io->in_buf),
+                             BUFFER_LENGTH(io->in_buf), &len);
+        if (hlen == 0)
+            break;
 
-        if (BUFFER_LENGTH (io->in_buf) - CCNET_PACKET_LENGTH_HEADER < len)
+        if (len > CCNET_PACKET_MAX_PAYLOAD_LEN_V2) {
+            g_warning ("Received a too large packet (%u bytes).\n", len);
+            return -1;
+        }
+
+        if (BUFFER_LENGTH (io->in_buf) - hlen < len)
             break;
 
-        packet->header.length = len;
-        packet->header.id = ntohl (packet->header.id);
+        packet = packet_from_frame ((char *)BUFFER_DATA(io->in_buf), &len);
 
-        io->func (packet, io->user_data);
-        buffer_drain (io->in_buf, len + CCNET_PACKET_LENGTH_HEADER);
+        io->func (packet, len, io->user_data);
+        buffer_drain (io->in_buf, len + hlen);
     }
 
     return 1;
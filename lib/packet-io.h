@@ -15,7 +15,9 @@ struct buffer;
 
 typedef struct CcnetPacketIO CcnetPacketIO;
 
-typedef void (*got_packet_callback) (ccnet_packet *packet, void *user_data);
+/* @len is the payload length; it can exceed 65535 for v2 packets */
+typedef void (*got_packet_callback) (ccnet_packet *packet, uint32_t len,
+                                     void *user_data);
 
 struct CcnetPacketIO {
     evutil_socket_t fd;
@@ -38,6 +40,7 @@ void ccnet_packet_add (CcnetPacketIO *io, const char *buf, int len);
 void ccnet_packet_finish (CcnetPacketIO *io);
 void ccnet_packet_send (CcnetPacketIO *io);
 void ccnet_packet_finish_send (CcnetPacketIO *io);
+void ccnet_packet_send_hello (CcnetPacketIO *io);
 
 void ccnet_packet_io_set_callback (CcnetPacketIO *io,
                                    got_packet_callback func,
@@ -45,6 +48,6 @@ void ccnet_packet_io_set_callback (CcnetPacketIO *io,
 
 int ccnet_packet_io_read (CcnetPacketIO *io);
 
-ccnet_packet* ccnet_packet_io_read_packet (CcnetPacketIO* io);
+ccnet_packet* ccnet_packet_io_read_packet (CcnetPacketIO* io, uint32_t *len);
 
 #endif
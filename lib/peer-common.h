@@ -121,6 +121,10 @@ set_roles (CcnetPeer *peer, const char *roles)
     
     string_list_free (peer->role_list);
     peer->role_list = role_list;
+#ifndef CCNET_LIB
+    /* the cached permission mask was computed from the old roles */
+    peer->perm_epoch = 0;
+#endif
 }
 
 static void
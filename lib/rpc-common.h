@@ -9,6 +9,14 @@
 #define SS_CLIENT_CALL  "CLIENT CALL"
 #define SC_CLIENT_MORE  "302"
 #define SS_CLIENT_MORE  "MORE"
+#define SC_CLIENT_STREAM_CALL "304"
+#define SS_CLIENT_STREAM_CALL "CLIENT STREAM CALL"
+#define SC_CLIENT_CREDIT "305"
+#define SS_CLIENT_CREDIT "CREDIT"
+#define SC_CLIENT_BATCH_CALL "306"
+#define SS_CLIENT_BATCH_CALL "CLIENT BATCH CALL"
+#define SC_CLIENT_PARALLEL_BATCH_CALL "307"
+#define SS_CLIENT_PARALLEL_BATCH_CALL "CLIENT PARALLEL BATCH CALL"
 #define SC_SERVER_RET   "311"
 #define SS_SERVER_RET   "SERVER RET"
 #define SC_SERVER_MORE  "312"
@@ -20,6 +28,12 @@
 #define MESSAGE_HEADER 64                  /* leave enough space */
 #define MAX_TRANSFER_LENGTH (CCNET_PACKET_MAX_PAYLOAD_LEN - MESSAGE_HEADER)
 
+/* Advertised in the content of the "200 OK" reply to start, e.g.
+ * "stream-window=8". Clients that don't understand it ignore it.
+ */
+#define RPC_STREAM_CAP     "stream-window"
+#define RPC_STREAM_WINDOW  8
+
 /* 
    Client                       Server
               <xxx>-rpcserver
@@ -38,4 +52,41 @@
         <-----------------------
  */
 
+/*
+   Streaming mode, used when the server advertised RPC_STREAM_CAP.
+   The client starts with <window> credits; each segment consumes
+   one. Credits are returned in batches, "305 CREDIT <n>".
+
+   Client                       Server
+              200 OK stream-window=8
+        <----------------------
+         304 Func String
+         ---------------------->
+            312  HAS MORE
+        <-----------------------
+            312  HAS MORE
+        <-----------------------
+            ...
+            305  CREDIT 4
+         ---------------------->
+            312  HAS MORE
+        <-----------------------
+            311 SERVER RET
+        <-----------------------
+ */
+
+/*
+   Batch mode, only the threaded rpc server supports it; others
+   reply with SC_BAD_UPDATE_CODE. The content is the func strings,
+   each followed by '\0'; the result is the return strings in the
+   same order, each followed by '\0', sent in lock-step segments.
+   With 307 the server may run the calls in parallel.
+
+   Client                       Server
+         306 Func String\0Func String\0...
+         ---------------------->
+            311 SERVER RET Ret String\0Ret String\0...
+        <-----------------------
+ */
+
 #endif
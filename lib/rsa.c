@@ -4,13 +4,54 @@
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/objects.h>
 
 #include <string.h>
+#include <pthread.h>
 #include <glib.h>
 
 #include "rsa.h"
 #include "utils.h"
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_mutex_t *ssl_locks;
+
+static void
+ssl_locking_cb (int mode, int n, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK)
+        pthread_mutex_lock (&ssl_locks[n]);
+    else
+        pthread_mutex_unlock (&ssl_locks[n]);
+}
+
+static unsigned long
+ssl_thread_id_cb (void)
+{
+    return (unsigned long)pthread_self ();
+}
+#endif
+
+void
+ccnet_openssl_thread_setup (void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    int i;
+
+    if (ssl_locks)
+        return;
+
+    ssl_locks = g_new (pthread_mutex_t, CRYPTO_num_locks ());
+    for (i = 0; i < CRYPTO_num_locks (); ++i)
+        pthread_mutex_init (&ssl_locks[i], NULL);
+
+    CRYPTO_set_id_callback (ssl_thread_id_cb);
+    CRYPTO_set_locking_callback (ssl_locking_cb);
+#endif
+}
+
 RSA*
 private_key_to_pub(RSA *priv)
 {
@@ -134,6 +175,119 @@ public_key_encrypt(RSA *key, unsigned char *data, int len, int *encrypt_len)
     return buf;
 }
 
+unsigned char *
+private_key_sign(RSA *key, const unsigned char *data, int len, int *sig_len)
+{
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    unsigned char *buf;
+    unsigned int size;
+
+    SHA256 (data, len, md);
+
+    buf = g_malloc(RSA_size(key));
+    if (!RSA_sign (NID_sha256, md, sizeof(md), buf, &size, key)) {
+        g_free (buf);
+        *sig_len = -1;
+        return NULL;
+    }
+
+    *sig_len = size;
+    return buf;
+}
+
+gboolean
+public_key_verify(RSA *key, const unsigned char *data, int len,
+                  const unsigned char *sig, int sig_len)
+{
+    unsigned char md[SHA256_DIGEST_LENGTH];
+
+    if (sig_len <= 0)
+        return FALSE;
+
+    SHA256 (data, len, md);
+    return RSA_verify (NID_sha256, md, sizeof(md),
+                       sig, sig_len, key) == 1;
+}
+
+#ifdef CCNET_HAVE_X25519
+
+int
+x25519_generate_key (unsigned char *priv, unsigned char *pub)
+{
+    EVP_PKEY_CTX *ctx;
+    EVP_PKEY *pkey = NULL;
+    size_t priv_len = X25519_KEY_LEN, pub_len = X25519_KEY_LEN;
+    int ret = -1;
+
+    ctx = EVP_PKEY_CTX_new_id (EVP_PKEY_X25519, NULL);
+    if (!ctx)
+        return -1;
+
+    if (EVP_PKEY_keygen_init (ctx) <= 0 || EVP_PKEY_keygen (ctx, &pkey) <= 0)
+        goto out;
+
+    if (EVP_PKEY_get_raw_private_key (pkey, priv, &priv_len) <= 0 ||
+        EVP_PKEY_get_raw_public_key (pkey, pub, &pub_len) <= 0)
+        goto out;
+
+    ret = 0;
+
+out:
+    EVP_PKEY_free (pkey);
+    EVP_PKEY_CTX_free (ctx);
+    return ret;
+}
+
+int
+x25519_derive (const unsigned char *priv, const unsigned char *peer_pub,
+               unsigned char *secret)
+{
+    EVP_PKEY *mine, *theirs;
+    EVP_PKEY_CTX *ctx = NULL;
+    size_t len = X25519_KEY_LEN;
+    int ret = -1;
+
+    mine = EVP_PKEY_new_raw_private_key (EVP_PKEY_X25519, NULL,
+                                         priv, X25519_KEY_LEN);
+    theirs = EVP_PKEY_new_raw_public_key (EVP_PKEY_X25519, NULL,
+                                          peer_pub, X25519_KEY_LEN);
+    if (!mine || !theirs)
+        goto out;
+
+    ctx = EVP_PKEY_CTX_new (mine, NULL);
+    /* openssl rejects low order points here */
+    if (!ctx || EVP_PKEY_derive_init (ctx) <= 0 ||
+        EVP_PKEY_derive_set_peer (ctx, theirs) <= 0 ||
+        EVP_PKEY_derive (ctx, secret, &len) <= 0 ||
+        len != X25519_KEY_LEN)
+        goto out;
+
+    ret = 0;
+
+out:
+    EVP_PKEY_CTX_free (ctx);
+    EVP_PKEY_free (mine);
+    EVP_PKEY_free (theirs);
+    return ret;
+}
+
+#else
+
+int
+x25519_generate_key (unsigned char *priv, unsigned char *pub)
+{
+    return -1;
+}
+
+int
+x25519_derive (const unsigned char *priv, const unsigned char *peer_pub,
+               unsigned char *secret)
+{
+    return -1;
+}
+
+#endif  /* CCNET_HAVE_X25519 */
+
 char *
 id_from_pubkey (RSA *pubkey)
 {
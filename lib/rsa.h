@@ -23,9 +23,33 @@ unsigned char* public_key_encrypt(RSA *key, unsigned char *data,
                                   int len, int *encrypt_len);
 
 
+/* RSA-SHA256 signatures with a peer's identity key */
+unsigned char* private_key_sign(RSA *key, const unsigned char *data,
+                                int len, int *sig_len);
+
+gboolean public_key_verify(RSA *key, const unsigned char *data, int len,
+                           const unsigned char *sig, int sig_len);
+
+/* X25519 key agreement, needs openssl 1.1.1. Without it the functions
+ * fail and CCNET_HAVE_X25519 is not defined. */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define CCNET_HAVE_X25519 1
+#endif
+
+#define X25519_KEY_LEN 32
+
+int x25519_generate_key (unsigned char *priv, unsigned char *pub);
+
+int x25519_derive (const unsigned char *priv, const unsigned char *peer_pub,
+                   unsigned char *secret);
+
 char *id_from_pubkey (RSA *pubkey);
 
 RSA* generate_private_key(u_int bits);
 
+/* Install the locking callbacks openssl < 1.1 needs before keys are
+ * used from several threads. Safe to call more than once. */
+void ccnet_openssl_thread_setup (void);
+
 
 #endif
@@ -16,6 +16,8 @@ typedef struct {
     gsize len;
     int   off;
     char *error_message;
+    gboolean stream;            /* client asked for streamed segments */
+    int   credits;              /* segments we may push ahead */
 } CcnetThreadedRpcserverProcPriv;
 
 #define GET_PRIV(o) \
@@ -61,7 +63,12 @@ ccnet_threaded_rpcserver_proc_init (CcnetThreadedRpcserverProc *processor)
 static int
 start (CcnetProcessor *processor, int argc, char **argv)
 {
-    ccnet_processor_send_response (processor, SC_OK, SS_OK, NULL, 0);
+    char cap[32];
+    int len;
+
+    len = snprintf (cap, sizeof(cap), "%s=%d",
+                    RPC_STREAM_CAP, RPC_STREAM_WINDOW);
+    ccnet_processor_send_response (processor, SC_OK, SS_OK, cap, len + 1);
 
     return 0;
 }
@@ -80,6 +87,38 @@ call_function_job (void *vprocessor)
     return vprocessor;
 }
 
+/* Send the next segment, or the last one as SERVER_RET. */
+static void
+send_next_segment (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    if (priv->off + MAX_TRANSFER_LENGTH < priv->len) {
+        ccnet_processor_send_response (
+            processor, SC_SERVER_MORE, SS_SERVER_MORE,
+            priv->buf + priv->off, MAX_TRANSFER_LENGTH);
+        priv->off += MAX_TRANSFER_LENGTH;
+    } else {
+        ccnet_processor_send_response (
+            processor, SC_SERVER_RET, SS_SERVER_RET,
+            priv->buf + priv->off, priv->len - priv->off);
+        g_free (priv->buf);
+        priv->buf = NULL;
+        /* ccnet_processor_done (processor, TRUE); */
+    }
+}
+
+static void
+push_segments (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    while (priv->buf && priv->credits > 0) {
+        send_next_segment (processor);
+        --priv->credits;
+    }
+}
+
 static void
 call_function_done (void *vprocessor)
 {
@@ -99,10 +138,12 @@ call_function_done (void *vprocessor)
         }
 
         /* we need to split data into multiple segments */
-        ccnet_processor_send_response (processor, SC_SERVER_MORE,
-                                       SS_SERVER_MORE, priv->buf,
-                                       MAX_TRANSFER_LENGTH);
-        priv->off = MAX_TRANSFER_LENGTH;
+        priv->off = 0;
+        if (priv->stream) {
+            push_segments (processor);
+            return;
+        }
+        send_next_segment (processor);
     } else {
         char *message = priv->error_message ? priv->error_message : "";
         ccnet_processor_send_response (processor, SC_SERVER_ERR, 
@@ -120,7 +161,10 @@ handle_update (CcnetProcessor *processor,
 {
     CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
 
-    if (memcmp (code, SC_CLIENT_CALL, 3) == 0) {
+    if (memcmp (code, SC_CLIENT_CALL, 3) == 0 ||
+        memcmp (code, SC_CLIENT_STREAM_CALL, 3) == 0) {
+        priv->stream = (memcmp (code, SC_CLIENT_STREAM_CALL, 3) == 0);
+        priv->credits = RPC_STREAM_WINDOW;
         priv->call_buf = g_memdup (content, clen);
         priv->call_len = (gsize)clen;
         ccnet_processor_thread_create (processor,
@@ -132,19 +176,18 @@ handle_update (CcnetProcessor *processor,
     }
 
     if (memcmp (code, SC_CLIENT_MORE, 3) == 0) {
-        if (priv->off + MAX_TRANSFER_LENGTH < priv->len) {
-            ccnet_processor_send_response (
-                processor, SC_SERVER_MORE, SS_SERVER_MORE,
-                priv->buf + priv->off, MAX_TRANSFER_LENGTH);
-            priv->off += MAX_TRANSFER_LENGTH;
-        } else {
-            ccnet_processor_send_response (
-                processor, SC_SERVER_RET, SS_SERVER_RET,
-                priv->buf + priv->off, priv->len - priv->off);
-            g_free (priv->buf);
-            priv->buf = NULL;
-            /* ccnet_processor_done (processor, TRUE); */
-        }
+        if (priv->buf)
+            send_next_segment (processor);
+        return;
+    }
+
+    if (memcmp (code, SC_CLIENT_CREDIT, 3) == 0) {
+        /* A late credit for a finished stream is harmless. */
+        if (clen > 0 && content[clen-1] == '\0')
+            priv->credits += atoi (content);
+        if (priv->credits > RPC_STREAM_WINDOW)
+            priv->credits = RPC_STREAM_WINDOW;
+        push_segments (processor);
         return;
     }
 
@@ -19,31 +19,264 @@
 
 #include "timer.h"
 
+/*
+ * All timers live in one hierarchical timing wheel, driven by a single
+ * libevent timer. Level 0 has one slot per tick, each higher level has
+ * slots 64 times as coarse; a timer sits in the level its remaining
+ * time falls into and moves down a level each time the level below
+ * wraps around. Adding and freeing a timer is O(1).
+ *
+ * The libevent timer is only armed up to the next non-empty level 0
+ * slot, or the next wrap of level 0, so an idle wheel doesn't tick.
+ */
+
+#define TICK_MSEC    10
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/* about 46 hours, longer timers are cascaded again when they get there */
+#define MAX_TICKS    (((guint64)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+typedef struct TimerLink TimerLink;
+struct TimerLink {
+    TimerLink *prev;
+    TimerLink *next;
+};
+
 struct CcnetTimer
 {
-    struct event   event;
-    struct timeval tv;
+    TimerLink      link;        /* must be the first field */
+    guint64        expire;      /* in ticks */
+    guint64        interval;    /* in milliseconds */
     TimerCB        func;
     void          *user_data;
     uint8_t        inCallback;
 };
 
+typedef struct TimerWheel {
+    TimerLink      slots[WHEEL_LEVELS][WHEEL_SIZE];
+    guint64        tick;        /* next tick to run */
+    gint64         base_usec;   /* monotonic time of tick 0 */
+    int            n_timers;
+
+    struct event   event;
+    gboolean       armed;
+    guint64        armed_tick;
+} TimerWheel;
+
+static TimerWheel *wheel;
+
+static inline void
+link_init (TimerLink *l)
+{
+    l->prev = l->next = l;
+}
+
+static inline void
+link_remove (TimerLink *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->prev = l->next = l;
+}
+
+static inline void
+link_append (TimerLink *head, TimerLink *l)
+{
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+/* Move all of @from to the empty list @to. */
+static inline void
+link_splice (TimerLink *from, TimerLink *to)
+{
+    if (from->next == from) {
+        link_init (to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    link_init (from);
+}
+
+static gint64
+monotonic_usec ()
+{
+#if GLIB_CHECK_VERSION(2, 28, 0)
+    return g_get_monotonic_time ();
+#else
+    GTimeVal tv;
+    g_get_current_time (&tv);
+    return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+static guint64
+current_tick ()
+{
+    return (monotonic_usec () - wheel->base_usec) / (TICK_MSEC * 1000);
+}
+
+/* First tick at least @msec from now, so a timer never fires early. */
+static guint64
+expire_tick (guint64 msec)
+{
+    guint64 usec = monotonic_usec () - wheel->base_usec + msec * 1000;
+
+    return (usec + TICK_MSEC * 1000 - 1) / (TICK_MSEC * 1000);
+}
+
+static void wheel_callback (int fd, short event, void *vwheel);
+
+static void
+wheel_init ()
+{
+    int i, j;
+
+    wheel = g_new0 (TimerWheel, 1);
+    for (i = 0; i < WHEEL_LEVELS; ++i)
+        for (j = 0; j < WHEEL_SIZE; ++j)
+            link_init (&wheel->slots[i][j]);
+    wheel->base_usec = monotonic_usec ();
+
+    evtimer_set (&wheel->event, wheel_callback, wheel);
+}
+
+static void
+wheel_insert (CcnetTimer *timer)
+{
+    guint64 expire = timer->expire;
+    guint64 delta;
+    int level;
+
+    if (expire < wheel->tick)
+        expire = wheel->tick;
+    delta = expire - wheel->tick;
+    if (delta > MAX_TICKS) {
+        delta = MAX_TICKS;
+        expire = wheel->tick + MAX_TICKS;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+        if (delta < ((guint64)1 << (WHEEL_BITS * (level + 1))))
+            break;
+
+    link_append (&wheel->slots[level][(expire >> (WHEEL_BITS * level))
+                                      & WHEEL_MASK],
+                 &timer->link);
+}
+
+/* Re-insert the timers of a slot, they end up in lower levels. Returns
+ * the slot index, 0 means the level wrapped around too. */
+static int
+cascade (int level)
+{
+    int index = (wheel->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    TimerLink list, *l;
+
+    link_splice (&wheel->slots[level][index], &list);
+    while ((l = list.next) != &list) {
+        link_remove (l);
+        wheel_insert ((CcnetTimer *)l);
+    }
+
+    return index;
+}
+
+/* The earliest tick something may have to be done. */
+static guint64
+next_event_tick ()
+{
+    int index = wheel->tick & WHEEL_MASK;
+    int i;
+
+    /* level 0 wrapped around, the next tick cascades */
+    if (index == 0)
+        return wheel->tick;
+
+    for (i = index; i < WHEEL_SIZE; ++i)
+        if (wheel->slots[0][i].next != &wheel->slots[0][i])
+            return wheel->tick + (i - index);
+
+    /* cascade at the next wrap */
+    return wheel->tick + (WHEEL_SIZE - index);
+}
+
 static void
-timer_callback (int fd, short event, void *vtimer)
+wheel_schedule (gboolean force)
+{
+    guint64 next, now;
+    struct timeval tv;
+
+    if (wheel->n_timers == 0) {
+        if (wheel->armed) {
+            evtimer_del (&wheel->event);
+            wheel->armed = FALSE;
+        }
+        return;
+    }
+
+    next = next_event_tick ();
+    if (wheel->armed && !force && next >= wheel->armed_tick)
+        return;
+
+    now = current_tick ();
+    tv = timeval_from_msec (next > now ? (next - now) * TICK_MSEC : 0);
+    evtimer_add (&wheel->event, &tv);
+    wheel->armed = TRUE;
+    wheel->armed_tick = next;
+}
+
+static void
+run_timer (CcnetTimer *timer)
 {
     int more;
-    struct CcnetTimer *timer = vtimer;
 
     timer->inCallback = 1;
     more = (*timer->func) (timer->user_data);
     timer->inCallback = 0;
 
-    if (more)
-        evtimer_add (&timer->event, &timer->tv);
-    else
+    if (more) {
+        timer->expire = expire_tick (timer->interval);
+        wheel_insert (timer);
+    } else
         ccnet_timer_free (&timer);
 }
 
+static void
+wheel_callback (int fd, short event, void *vwheel)
+{
+    guint64 now = current_tick ();
+    TimerLink list, *l;
+    int index;
+
+    wheel->armed = FALSE;
+
+    while (wheel->tick <= now) {
+        index = wheel->tick & WHEEL_MASK;
+        if (index == 0 && cascade (1) == 0 && cascade (2) == 0)
+            cascade (3);
+
+        link_splice (&wheel->slots[0][index], &list);
+        wheel->tick++;
+
+        /* the callbacks may free other timers of the list */
+        while ((l = list.next) != &list) {
+            link_remove (l);
+            run_timer ((CcnetTimer *)l);
+        }
+    }
+
+    wheel_schedule (TRUE);
+}
+
 void
 ccnet_timer_free (CcnetTimer **ptimer)
 {
@@ -55,11 +288,12 @@ ccnet_timer_free (CcnetTimer **ptimer)
     timer = *ptimer;
     *ptimer = NULL;
 
-    /* destroy the timer directly or via the command queue */
+    /* a timer in its callback is freed once the callback returns FALSE */
     if (timer && !timer->inCallback)
     {
-        event_del (&timer->event);
+        link_remove (&timer->link);
         g_free (timer);
+        wheel->n_timers--;
     }
 }
 
@@ -70,12 +304,22 @@ ccnet_timer_new (TimerCB         func,
 {
     CcnetTimer *timer = g_new0 (CcnetTimer, 1);
 
-    timer->tv = timeval_from_msec (interval_milliseconds);
+    if (!wheel)
+        wheel_init ();
+
+    timer->interval = interval_milliseconds;
     timer->func = func;
     timer->user_data = user_data;
 
-    evtimer_set (&timer->event, timer_callback, timer);
-    evtimer_add (&timer->event, &timer->tv);
+    /* catch up with the clock, so the interval counts from now */
+    if (wheel->n_timers == 0)
+        wheel->tick = current_tick ();
+    timer->expire = expire_tick (timer->interval);
+
+    link_init (&timer->link);
+    wheel_insert (timer);
+    wheel->n_timers++;
+    wheel_schedule (FALSE);
 
     return timer;
 }
@@ -997,6 +997,7 @@ pgpipe (ccnet_pipe_t handles[2])
 
 #include <openssl/aes.h>
 #include <openssl/evp.h>
+#include <openssl/rand.h>
 
 /* Block size, in bytes. For AES it can only be 16 bytes. */
 #define BLK_SIZE 16
@@ -1190,6 +1191,463 @@ dec_error:
     return -1;
 }
 
+/*
+ * A CcnetCipher keeps the expanded key of a channel around, so that
+ * encrypting a packet only resets the IV/nonce instead of setting up a
+ * new context.
+ *
+ * With CCNET_CIPHER_AES_256_CBC each packet is encrypted independently
+ * with the same key and IV, the output is identical to
+ * ccnet_encrypt_with_key().
+ *
+ * With the AEAD suites a packet is
+ *
+ *     <8 bytes sequence number> <ciphertext> <16 bytes tag>
+ *
+ * and the 12 bytes nonce is the direction (4 bytes) followed by the
+ * sequence number. Both ends share one key, the direction keeps their
+ * nonces apart. Sequence numbers must strictly increase.
+ */
+
+#define AEAD_SEQ_LEN   8
+#define AEAD_TAG_LEN   16
+#define AEAD_NONCE_LEN 12
+
+struct CcnetCipher {
+    int             suite;
+    EVP_CIPHER_CTX *enc_ctx;
+    EVP_CIPHER_CTX *dec_ctx;
+    unsigned char   iv[BLK_SIZE];
+
+    uint32_t        send_dir;
+    uint32_t        recv_dir;
+    uint64_t        send_seq;
+    uint64_t        recv_seq;   /* next acceptable sequence number */
+};
+
+static const char *cipher_suite_names[] = {
+    "aes-256-cbc",
+    "aes-256-gcm",
+    "chacha20-poly1305",
+};
+
+static const EVP_CIPHER *
+suite_to_evp (int suite)
+{
+    switch (suite) {
+    case CCNET_CIPHER_AES_256_CBC:
+        return EVP_aes_256_cbc();
+    case CCNET_CIPHER_AES_256_GCM:
+        return EVP_aes_256_gcm();
+#ifdef NID_chacha20_poly1305
+    case CCNET_CIPHER_CHACHA20_POLY1305:
+        return EVP_chacha20_poly1305();
+#endif
+    default:
+        return NULL;
+    }
+}
+
+const char *
+ccnet_cipher_suite_name (int suite)
+{
+    if (suite < 0 || suite >= CCNET_CIPHER_N_SUITES)
+        return NULL;
+    return cipher_suite_names[suite];
+}
+
+int
+ccnet_cipher_suite_from_name (const char *name)
+{
+    int i;
+
+    for (i = 0; i < CCNET_CIPHER_N_SUITES; ++i)
+        if (g_strcmp0 (name, cipher_suite_names[i]) == 0 &&
+            suite_to_evp (i) != NULL)
+            return i;
+    return -1;
+}
+
+static gboolean
+cpu_has_aes (void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports ("aes");
+#else
+    return TRUE;
+#endif
+}
+
+char *
+ccnet_cipher_supported_suites (void)
+{
+    GString *buf = g_string_new (NULL);
+    int order[3];
+    int i;
+
+    /* AES-GCM is fastest with AES-NI, ChaCha20 without it. */
+    if (cpu_has_aes ()) {
+        order[0] = CCNET_CIPHER_AES_256_GCM;
+        order[1] = CCNET_CIPHER_CHACHA20_POLY1305;
+    } else {
+        order[0] = CCNET_CIPHER_CHACHA20_POLY1305;
+        order[1] = CCNET_CIPHER_AES_256_GCM;
+    }
+    order[2] = CCNET_CIPHER_AES_256_CBC;
+
+    for (i = 0; i < 3; ++i) {
+        if (!suite_to_evp (order[i]))
+            continue;
+        if (buf->len > 0)
+            g_string_append_c (buf, ',');
+        g_string_append (buf, cipher_suite_names[order[i]]);
+    }
+
+    return g_string_free (buf, FALSE);
+}
+
+int
+ccnet_cipher_choose_suite (const char *peer_suites)
+{
+    char *mine = ccnet_cipher_supported_suites ();
+    char **ours, **theirs, **p, **q;
+    int suite = CCNET_CIPHER_AES_256_CBC;
+
+    if (!peer_suites)
+        goto out;
+
+    ours = g_strsplit (mine, ",", -1);
+    theirs = g_strsplit (peer_suites, ",", -1);
+    for (p = ours; *p; ++p) {
+        for (q = theirs; *q; ++q)
+            if (strcmp (*p, *q) == 0)
+                break;
+        if (*q) {
+            suite = ccnet_cipher_suite_from_name (*p);
+            break;
+        }
+    }
+    g_strfreev (ours);
+    g_strfreev (theirs);
+
+out:
+    g_free (mine);
+    return suite;
+}
+
+CcnetCipher *
+ccnet_cipher_new (int suite, const unsigned char *key,
+                  const unsigned char *iv, gboolean initiator)
+{
+    const EVP_CIPHER *evp = suite_to_evp (suite);
+    CcnetCipher *cipher;
+
+    if (!evp) {
+        g_warning ("unsupported cipher suite %d.\n", suite);
+        return NULL;
+    }
+
+    cipher = g_new0 (CcnetCipher, 1);
+    cipher->suite = suite;
+    cipher->send_dir = initiator ? 0 : 1;
+    cipher->recv_dir = initiator ? 1 : 0;
+
+    cipher->enc_ctx = EVP_CIPHER_CTX_new ();
+    cipher->dec_ctx = EVP_CIPHER_CTX_new ();
+    if (!cipher->enc_ctx || !cipher->dec_ctx)
+        goto error;
+
+    if (suite == CCNET_CIPHER_AES_256_CBC) {
+        if (EVP_EncryptInit_ex (cipher->enc_ctx, evp,
+                                NULL, key, iv) == ENC_FAILURE)
+            goto error;
+        if (EVP_DecryptInit_ex (cipher->dec_ctx, evp,
+                                NULL, key, iv) == DEC_FAILURE)
+            goto error;
+        memcpy (cipher->iv, iv, BLK_SIZE);
+    } else {
+        if (EVP_EncryptInit_ex (cipher->enc_ctx, evp,
+                                NULL, NULL, NULL) == ENC_FAILURE ||
+            EVP_CIPHER_CTX_ctrl (cipher->enc_ctx, EVP_CTRL_GCM_SET_IVLEN,
+                                 AEAD_NONCE_LEN, NULL) != 1 ||
+            EVP_EncryptInit_ex (cipher->enc_ctx, NULL,
+                                NULL, key, NULL) == ENC_FAILURE)
+            goto error;
+        if (EVP_DecryptInit_ex (cipher->dec_ctx, evp,
+                                NULL, NULL, NULL) == DEC_FAILURE ||
+            EVP_CIPHER_CTX_ctrl (cipher->dec_ctx, EVP_CTRL_GCM_SET_IVLEN,
+                                 AEAD_NONCE_LEN, NULL) != 1 ||
+            EVP_DecryptInit_ex (cipher->dec_ctx, NULL,
+                                NULL, key, NULL) == DEC_FAILURE)
+            goto error;
+    }
+
+    return cipher;
+
+error:
+    g_warning ("failed to init cipher context.\n");
+    ccnet_cipher_free (cipher);
+    return NULL;
+}
+
+void
+ccnet_cipher_free (CcnetCipher *cipher)
+{
+    if (!cipher)
+        return;
+    if (cipher->enc_ctx)
+        EVP_CIPHER_CTX_free (cipher->enc_ctx);
+    if (cipher->dec_ctx)
+        EVP_CIPHER_CTX_free (cipher->dec_ctx);
+    g_free (cipher);
+}
+
+int
+ccnet_cipher_encrypted_len (CcnetCipher *cipher, int in_len)
+{
+    if (cipher->suite != CCNET_CIPHER_AES_256_CBC)
+        return AEAD_SEQ_LEN + in_len + AEAD_TAG_LEN;
+
+    /* padding is always used, see ccnet_encrypt_with_key() */
+    return (in_len / BLK_SIZE + 1) * BLK_SIZE;
+}
+
+static void
+make_nonce (unsigned char *nonce, uint32_t dir, const unsigned char *seq)
+{
+    uint8_t *ptr = nonce;
+
+    put32bit (&ptr, dir);
+    memcpy (ptr, seq, AEAD_SEQ_LEN);
+}
+
+static int
+aead_encrypt (CcnetCipher *cipher, char *data_out, int *out_len,
+              const char *data_in, int in_len)
+{
+    unsigned char *seq = (unsigned char *)data_out;
+    unsigned char *ctext = seq + AEAD_SEQ_LEN;
+    unsigned char nonce[AEAD_NONCE_LEN];
+    int update_len, final_len;
+    uint8_t *ptr = seq;
+
+    put64bit (&ptr, cipher->send_seq);
+    make_nonce (nonce, cipher->send_dir, seq);
+
+    if (EVP_EncryptInit_ex (cipher->enc_ctx, NULL, NULL,
+                            NULL, nonce) == ENC_FAILURE)
+        return -1;
+    if (EVP_EncryptUpdate (cipher->enc_ctx, ctext, &update_len,
+                           (unsigned char *)data_in, in_len) == ENC_FAILURE)
+        return -1;
+    if (EVP_EncryptFinal_ex (cipher->enc_ctx, ctext + update_len,
+                             &final_len) == ENC_FAILURE)
+        return -1;
+    if (EVP_CIPHER_CTX_ctrl (cipher->enc_ctx, EVP_CTRL_GCM_GET_TAG,
+                             AEAD_TAG_LEN,
+                             ctext + update_len + final_len) != 1)
+        return -1;
+
+    cipher->send_seq++;
+    *out_len = AEAD_SEQ_LEN + update_len + final_len + AEAD_TAG_LEN;
+    return 0;
+}
+
+static int
+aead_decrypt (CcnetCipher *cipher, char *data_out, int *out_len,
+              const char *data_in, int in_len)
+{
+    const unsigned char *seq = (const unsigned char *)data_in;
+    const unsigned char *ctext = seq + AEAD_SEQ_LEN;
+    int clen = in_len - AEAD_SEQ_LEN - AEAD_TAG_LEN;
+    unsigned char nonce[AEAD_NONCE_LEN];
+    int update_len, final_len;
+    uint64_t seqno;
+
+    if (clen <= 0)
+        return -1;
+
+    /* reject replayed or reordered packets */
+    memcpy (&seqno, seq, AEAD_SEQ_LEN);
+    seqno = ntoh64 (seqno);
+    if (seqno < cipher->recv_seq)
+        return -1;
+
+    make_nonce (nonce, cipher->recv_dir, seq);
+
+    if (EVP_DecryptInit_ex (cipher->dec_ctx, NULL, NULL,
+                            NULL, nonce) == DEC_FAILURE)
+        return -1;
+    if (EVP_DecryptUpdate (cipher->dec_ctx, (unsigned char *)data_out,
+                           &update_len, ctext, clen) == DEC_FAILURE)
+        return -1;
+    if (EVP_CIPHER_CTX_ctrl (cipher->dec_ctx, EVP_CTRL_GCM_SET_TAG,
+                             AEAD_TAG_LEN,
+                             (void *)(ctext + clen)) != 1)
+        return -1;
+    if (EVP_DecryptFinal_ex (cipher->dec_ctx,
+                             (unsigned char *)data_out + update_len,
+                             &final_len) == DEC_FAILURE)
+        return -1;
+
+    cipher->recv_seq = seqno + 1;
+    *out_len = update_len + final_len;
+    return 0;
+}
+
+int
+ccnet_cipher_encrypt (CcnetCipher *cipher,
+                      char *data_out,
+                      int *out_len,
+                      const char *data_in,
+                      const int in_len)
+{
+    int update_len, final_len;
+
+    *out_len = -1;
+    if (data_in == NULL || in_len <= 0)
+        return -1;
+
+    if (cipher->suite != CCNET_CIPHER_AES_256_CBC)
+        return aead_encrypt (cipher, data_out, out_len, data_in, in_len);
+
+    /* only reset the IV, the key schedule is kept */
+    if (EVP_EncryptInit_ex (cipher->enc_ctx, NULL, NULL,
+                            NULL, cipher->iv) == ENC_FAILURE)
+        return -1;
+
+    if (EVP_EncryptUpdate (cipher->enc_ctx,
+                           (unsigned char *)data_out, &update_len,
+                           (unsigned char *)data_in, in_len) == ENC_FAILURE)
+        return -1;
+
+    if (EVP_EncryptFinal_ex (cipher->enc_ctx,
+                             (unsigned char *)data_out + update_len,
+                             &final_len) == ENC_FAILURE)
+        return -1;
+
+    *out_len = update_len + final_len;
+    return 0;
+}
+
+int
+ccnet_cipher_decrypt (CcnetCipher *cipher,
+                      char *data_out,
+                      int *out_len,
+                      const char *data_in,
+                      const int in_len)
+{
+    int update_len, final_len;
+
+    *out_len = -1;
+    if (data_in == NULL || in_len <= 0)
+        return -1;
+
+    if (cipher->suite != CCNET_CIPHER_AES_256_CBC)
+        return aead_decrypt (cipher, data_out, out_len, data_in, in_len);
+
+    if (in_len % BLK_SIZE != 0)
+        return -1;
+
+    if (EVP_DecryptInit_ex (cipher->dec_ctx, NULL, NULL,
+                            NULL, cipher->iv) == DEC_FAILURE)
+        return -1;
+
+    if (EVP_DecryptUpdate (cipher->dec_ctx,
+                           (unsigned char *)data_out, &update_len,
+                           (unsigned char *)data_in, in_len) == DEC_FAILURE)
+        return -1;
+
+    if (EVP_DecryptFinal_ex (cipher->dec_ctx,
+                             (unsigned char *)data_out + update_len,
+                             &final_len) == DEC_FAILURE)
+        return -1;
+
+    *out_len = update_len + final_len;
+    return 0;
+}
+
+/*
+ * One-shot AES-256-GCM with a random nonce, for small opaque blobs
+ * such as resumption tickets. The output is
+ *
+ *     <12 bytes nonce> <ciphertext> <16 bytes tag>
+ */
+unsigned char *
+ccnet_aead_seal (const unsigned char *key,
+                 const unsigned char *data_in, int in_len,
+                 int *out_len)
+{
+    EVP_CIPHER_CTX *ctx;
+    unsigned char *out, *ctext;
+    int update_len, final_len;
+
+    *out_len = -1;
+    out = g_malloc (AEAD_NONCE_LEN + in_len + AEAD_TAG_LEN);
+    ctext = out + AEAD_NONCE_LEN;
+    if (RAND_bytes (out, AEAD_NONCE_LEN) != 1) {
+        g_free (out);
+        return NULL;
+    }
+
+    ctx = EVP_CIPHER_CTX_new ();
+    if (!ctx ||
+        EVP_EncryptInit_ex (ctx, EVP_aes_256_gcm(), NULL,
+                            key, out) == ENC_FAILURE ||
+        EVP_EncryptUpdate (ctx, ctext, &update_len,
+                           data_in, in_len) == ENC_FAILURE ||
+        EVP_EncryptFinal_ex (ctx, ctext + update_len,
+                             &final_len) == ENC_FAILURE ||
+        EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_LEN,
+                             ctext + update_len + final_len) != 1) {
+        if (ctx)
+            EVP_CIPHER_CTX_free (ctx);
+        g_free (out);
+        return NULL;
+    }
+    EVP_CIPHER_CTX_free (ctx);
+
+    *out_len = AEAD_NONCE_LEN + update_len + final_len + AEAD_TAG_LEN;
+    return out;
+}
+
+unsigned char *
+ccnet_aead_open (const unsigned char *key,
+                 const unsigned char *data_in, int in_len,
+                 int *out_len)
+{
+    EVP_CIPHER_CTX *ctx;
+    const unsigned char *ctext = data_in + AEAD_NONCE_LEN;
+    int clen = in_len - AEAD_NONCE_LEN - AEAD_TAG_LEN;
+    unsigned char *out;
+    int update_len, final_len;
+
+    *out_len = -1;
+    if (clen <= 0)
+        return NULL;
+
+    out = g_malloc (clen);
+    ctx = EVP_CIPHER_CTX_new ();
+    if (!ctx ||
+        EVP_DecryptInit_ex (ctx, EVP_aes_256_gcm(), NULL,
+                            key, data_in) == DEC_FAILURE ||
+        EVP_DecryptUpdate (ctx, out, &update_len,
+                           ctext, clen) == DEC_FAILURE ||
+        EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_LEN,
+                             (void *)(ctext + clen)) != 1 ||
+        EVP_DecryptFinal_ex (ctx, out + update_len,
+                             &final_len) == DEC_FAILURE) {
+        if (ctx)
+            EVP_CIPHER_CTX_free (ctx);
+        g_free (out);
+        return NULL;
+    }
+    EVP_CIPHER_CTX_free (ctx);
+
+    *out_len = update_len + final_len;
+    return out;
+}
+
 /* convert locale specific input to utf8 encoded string  */
 char *ccnet_locale_to_utf8 (const gchar *src)
 {
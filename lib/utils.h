@@ -190,6 +190,72 @@ ccnet_decrypt_with_key (char **data_out,
                         const unsigned char *key,
                         const unsigned char *iv);
 
+/* Channel cipher suites, negotiated in session key v2. */
+enum {
+    CCNET_CIPHER_AES_256_CBC = 0,
+    CCNET_CIPHER_AES_256_GCM,
+    CCNET_CIPHER_CHACHA20_POLY1305,
+    CCNET_CIPHER_N_SUITES
+};
+
+const char *
+ccnet_cipher_suite_name (int suite);
+
+/* Returns -1 if @name is unknown or not supported by this openssl. */
+int
+ccnet_cipher_suite_from_name (const char *name);
+
+/* Comma separated list of the suites we support, preferred first. */
+char *
+ccnet_cipher_supported_suites (void);
+
+/* Our most preferred suite in @peer_suites, CBC if there is none. */
+int
+ccnet_cipher_choose_suite (const char *peer_suites);
+
+/* Reusable per-channel cipher state. @initiator tells the two ends of
+ * the channel apart, they must pass different values. */
+typedef struct CcnetCipher CcnetCipher;
+
+CcnetCipher *
+ccnet_cipher_new (int suite, const unsigned char *key,
+                  const unsigned char *iv, gboolean initiator);
+
+void
+ccnet_cipher_free (CcnetCipher *cipher);
+
+/* Size of the ciphertext for @in_len bytes of plaintext. */
+int
+ccnet_cipher_encrypted_len (CcnetCipher *cipher, int in_len);
+
+/* @data_out must hold ccnet_cipher_encrypted_len(@in_len) bytes. */
+int
+ccnet_cipher_encrypt (CcnetCipher *cipher,
+                      char *data_out,
+                      int *out_len,
+                      const char *data_in,
+                      const int in_len);
+
+/* @data_out must hold @in_len bytes. */
+int
+ccnet_cipher_decrypt (CcnetCipher *cipher,
+                      char *data_out,
+                      int *out_len,
+                      const char *data_in,
+                      const int in_len);
+
+/* AES-256-GCM with a random nonce for small blobs, @key is 32 bytes.
+ * Returned buffers are g_malloc'ed, NULL on failure or bad tag. */
+unsigned char *
+ccnet_aead_seal (const unsigned char *key,
+                 const unsigned char *data_in, int in_len,
+                 int *out_len);
+
+unsigned char *
+ccnet_aead_open (const unsigned char *key,
+                 const unsigned char *data_in, int in_len,
+                 int *out_len);
+
 int
 ccnet_encrypt (char **data_out,
                int *out_len,
@@ -3,20 +3,124 @@
 #include "common.h"
 
 #include <zdb.h>
+#include <pthread.h>
 #include "ccnet-db.h"
 
-#ifdef WIN32
-#include <windows.h>
-#define sleep(n) Sleep(1000 * (n))
-#endif
-
-#define MAX_GET_CONNECTION_RETRIES 3
+#include <sys/time.h>
+
+/*
+ * Connections are taken from the zdb pool and kept checked out in our
+ * own idle list, so the statements prepared on them survive: zdb frees
+ * all statements of a connection when it goes back to its pool. Each
+ * connection caches its statements by SQL text.
+ *
+ * zdb can't free a single statement, so when a connection has more than
+ * STMT_CACHE_SIZE of them, or a result was left unfinished (which keeps
+ * a read lock on SQLite and blocks the connection on MySQL), all of its
+ * statements are dropped with Connection_clear().
+ *
+ * At most max_conns connections are open, idle or in use. A caller
+ * finding none idle and no room waits until one is released, up to
+ * wait_timeout seconds.
+ */
+
+#define STMT_CACHE_SIZE     64      /* per connection */
+#define CONN_IDLE_TIMEOUT   300     /* seconds */
+#define CONN_PING_INTERVAL  60      /* seconds */
+
+#define DEFAULT_MAX_CONNECTIONS 20  /* zdb's default */
+#define DEFAULT_WAIT_TIMEOUT    3   /* seconds */
+
+typedef struct DBConnection {
+    Connection_T conn;
+    GHashTable  *stmts;         /* sql -> PreparedStatement_T */
+    time_t       last_used;
+    gboolean     dirty;         /* clear it before the next use */
+} DBConnection;
 
 struct CcnetDB {
     int type;
     ConnectionPool_T pool;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* an idle connection or room for one */
+    GQueue *idle;               /* DBConnection, most recently used first */
+    int n_conns;                /* open, including the ones being created */
+    int n_waiting;
+    int min_conns;
+    int max_conns;
+    int wait_timeout;
+};
+
+/* Upper limits of the wait time buckets, in usec; the last is open. */
+static const gint64 wait_bucket_limits[CCNET_DB_WAIT_BUCKETS - 1] = {
+    1000, 10000, 100000, 1000000,
 };
 
+static pthread_mutex_t stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static CcnetDBStat db_stat;
+static GList *all_dbs;
+
+static gint64
+now_usec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+}
+
+/* Queries run by each thread, see ccnet_db_get_thread_query_count(). */
+static pthread_key_t query_count_key;
+static pthread_once_t query_count_once = PTHREAD_ONCE_INIT;
+
+static void
+create_query_count_key ()
+{
+    pthread_key_create (&query_count_key, g_free);
+}
+
+static gint64 *
+get_query_count ()
+{
+    gint64 *count;
+
+    pthread_once (&query_count_once, create_query_count_key);
+    count = pthread_getspecific (query_count_key);
+    if (!count) {
+        count = g_new0 (gint64, 1);
+        pthread_setspecific (query_count_key, count);
+    }
+    return count;
+}
+
+static inline void
+count_query ()
+{
+    ++*get_query_count ();
+}
+
+gint64
+ccnet_db_get_thread_query_count ()
+{
+    return *get_query_count ();
+}
+
+static void
+init_db_pool (CcnetDB *db)
+{
+    pthread_mutex_init (&db->lock, NULL);
+    pthread_cond_init (&db->cond, NULL);
+    db->idle = g_queue_new ();
+    db->max_conns = DEFAULT_MAX_CONNECTIONS;
+    db->wait_timeout = DEFAULT_WAIT_TIMEOUT;
+    ConnectionPool_setMaxConnections (db->pool, db->max_conns);
+
+    pthread_mutex_lock (&stat_lock);
+    all_dbs = g_list_prepend (all_dbs, db);
+    pthread_mutex_unlock (&stat_lock);
+}
+
 struct CcnetDBRow {
     ResultSet_T res;
 };
@@ -74,6 +178,7 @@ ccnet_db_new_mysql (const char *host,
 
     ConnectionPool_start (db->pool);
     db->type = CCNET_DB_TYPE_MYSQL;
+    init_db_pool (db);
 
     return db;
 }
@@ -113,6 +218,7 @@ ccnet_db_new_pgsql (const char *host,
 
     ConnectionPool_start (db->pool);
     db->type = CCNET_DB_TYPE_PGSQL;
+    init_db_pool (db);
 
     return db;
 }
@@ -143,13 +249,41 @@ ccnet_db_new_sqlite (const char *db_path)
 
     ConnectionPool_start (db->pool);
     db->type = CCNET_DB_TYPE_SQLITE;
+    init_db_pool (db);
 
     return db;
 }
 
+/* Called with the db unlocked. */
+static void
+close_db_connection (CcnetDB *db, DBConnection *dbc)
+{
+    /* back to the zdb pool, which frees the statements */
+    Connection_close (dbc->conn);
+    g_hash_table_destroy (dbc->stmts);
+    g_free (dbc);
+
+    pthread_mutex_lock (&db->lock);
+    db->n_conns--;
+    pthread_cond_signal (&db->cond);
+    pthread_mutex_unlock (&db->lock);
+}
+
 void
 ccnet_db_free (CcnetDB *db)
 {
+    DBConnection *dbc;
+
+    pthread_mutex_lock (&stat_lock);
+    all_dbs = g_list_remove (all_dbs, db);
+    pthread_mutex_unlock (&stat_lock);
+
+    while ((dbc = g_queue_pop_head (db->idle)) != NULL)
+        close_db_connection (db, dbc);
+    g_queue_free (db->idle);
+    pthread_cond_destroy (&db->cond);
+    pthread_mutex_destroy (&db->lock);
+
     ConnectionPool_stop (db->pool);
     ConnectionPool_free (&db->pool);
     g_free (db);
@@ -161,85 +295,264 @@ ccnet_db_type (CcnetDB *db)
     return db->type;
 }
 
-static Connection_T
-get_db_connection (CcnetDB *db)
+static DBConnection *
+new_db_connection (CcnetDB *db)
 {
+    DBConnection *dbc;
     Connection_T conn;
-    int retries = 0;
 
     conn = ConnectionPool_getConnection (db->pool);
-    /* If max_connections of the pool has been reached, retry 3 times
-     * and then return NULL.
-     */
-    while (!conn) {
-        if (retries++ == MAX_GET_CONNECTION_RETRIES) {
+    if (!conn) {
+        g_warning ("Failed to create new connection.\n");
+        return NULL;
+    }
+
+    dbc = g_new0 (DBConnection, 1);
+    dbc->conn = conn;
+    dbc->stmts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    dbc->last_used = time(NULL);
+    return dbc;
+}
+
+void
+ccnet_db_set_pool_config (CcnetDB *db, int min_conns, int max_conns,
+                          int wait_timeout)
+{
+    DBConnection *dbc;
+    int n_new = 0;
+
+    if (max_conns <= 0)
+        max_conns = DEFAULT_MAX_CONNECTIONS;
+    if (min_conns > max_conns)
+        min_conns = max_conns;
+
+    /* zdb must never be the one to refuse, we wait for a connection;
+     * it asserts that the initial connections fit in the maximum */
+    if (ConnectionPool_getInitialConnections (db->pool) > max_conns)
+        ConnectionPool_setInitialConnections (db->pool, max_conns);
+    ConnectionPool_setMaxConnections (db->pool, max_conns);
+
+    pthread_mutex_lock (&db->lock);
+    db->min_conns = MAX (min_conns, 0);
+    db->max_conns = max_conns;
+    if (wait_timeout > 0)
+        db->wait_timeout = wait_timeout;
+    if (db->n_conns < db->min_conns) {
+        n_new = db->min_conns - db->n_conns;
+        db->n_conns += n_new;
+    }
+    pthread_mutex_unlock (&db->lock);
+
+    /* prewarm */
+    while (n_new-- > 0) {
+        dbc = new_db_connection (db);
+        pthread_mutex_lock (&db->lock);
+        if (dbc)
+            g_queue_push_tail (db->idle, dbc);
+        else
+            db->n_conns--;
+        pthread_cond_signal (&db->cond);
+        pthread_mutex_unlock (&db->lock);
+    }
+}
+
+static void
+record_wait (gint64 usec, gboolean timeout)
+{
+    int i;
+
+    pthread_mutex_lock (&stat_lock);
+    db_stat.n_waits++;
+    if (timeout)
+        db_stat.n_timeouts++;
+    for (i = 0; i < CCNET_DB_WAIT_BUCKETS - 1; ++i)
+        if (usec < wait_bucket_limits[i])
+            break;
+    db_stat.wait_hist[i]++;
+    db_stat.wait_usec += usec;
+    pthread_mutex_unlock (&stat_lock);
+}
+
+static DBConnection *
+get_db_connection (CcnetDB *db)
+{
+    DBConnection *dbc;
+    struct timespec deadline;
+    gint64 start = 0;
+    gboolean timeout = FALSE;
+
+    pthread_mutex_lock (&db->lock);
+    while (1) {
+        while ((dbc = g_queue_pop_head (db->idle)) != NULL) {
+            /* the server may have dropped a connection idle for long */
+            if (time(NULL) - dbc->last_used < CONN_PING_INTERVAL)
+                goto out;
+            pthread_mutex_unlock (&db->lock);
+            if (Connection_ping (dbc->conn)) {
+                pthread_mutex_lock (&db->lock);
+                goto out;
+            }
+            close_db_connection (db, dbc);
+            pthread_mutex_lock (&db->lock);
+        }
+
+        if (db->n_conns < db->max_conns)
+            break;
+
+        if (!start) {
+            start = now_usec ();
+            deadline.tv_sec = start / G_USEC_PER_SEC + db->wait_timeout;
+            deadline.tv_nsec = (start % G_USEC_PER_SEC) * 1000;
+        }
+
+        db->n_waiting++;
+        int rc = pthread_cond_timedwait (&db->cond, &db->lock, &deadline);
+        db->n_waiting--;
+        if (rc == ETIMEDOUT && g_queue_is_empty (db->idle) &&
+            db->n_conns >= db->max_conns) {
             g_warning ("Too many concurrent connections. "
-                       "Failed to create new connection.\n");
+                       "No connection available after %d seconds.\n",
+                       db->wait_timeout);
+            timeout = TRUE;
             goto out;
         }
-        sleep (1);
-        conn = ConnectionPool_getConnection (db->pool);
     }
 
-    if (!conn)
-        g_warning ("Failed to create new connection.\n");
+    /* reserve the room, connect without the lock */
+    db->n_conns++;
+    pthread_mutex_unlock (&db->lock);
+
+    dbc = new_db_connection (db);
+
+    pthread_mutex_lock (&db->lock);
+    if (!dbc) {
+        db->n_conns--;
+        pthread_cond_signal (&db->cond);
+    }
 
 out:
-    return conn;
+    pthread_mutex_unlock (&db->lock);
+
+    if (start)
+        record_wait (now_usec () - start, timeout);
+
+    return dbc;
+}
+
+/* Forget all statements of the connection, and their results. */
+static void
+clear_db_connection (DBConnection *dbc)
+{
+    if (g_hash_table_size (dbc->stmts) > 0) {
+        pthread_mutex_lock (&stat_lock);
+        db_stat.n_stmt_flushes++;
+        pthread_mutex_unlock (&stat_lock);
+    }
+
+    Connection_clear (dbc->conn);
+    g_hash_table_remove_all (dbc->stmts);
+    dbc->dirty = FALSE;
+}
+
+/* @error: a statement on the connection failed, it may be broken. */
+static void
+release_db_connection (CcnetDB *db, DBConnection *dbc, gboolean error)
+{
+    DBConnection *oldest;
+    time_t now = time(NULL);
+
+    if (error && !Connection_ping (dbc->conn)) {
+        close_db_connection (db, dbc);
+        return;
+    }
+    if (error || dbc->dirty)
+        clear_db_connection (dbc);
+
+    dbc->last_used = now;
+
+    pthread_mutex_lock (&db->lock);
+    g_queue_push_head (db->idle, dbc);
+    pthread_cond_signal (&db->cond);
+
+    /* one at a time is enough to shrink after a burst */
+    oldest = g_queue_peek_tail (db->idle);
+    if (db->n_conns > db->min_conns &&
+        now - oldest->last_used > CONN_IDLE_TIMEOUT)
+        g_queue_pop_tail (db->idle);
+    else
+        oldest = NULL;
+    pthread_mutex_unlock (&db->lock);
+
+    if (oldest)
+        close_db_connection (db, oldest);
+}
+
+/* Call after the first row was read from a result expected to have at
+ * most one row. A result not read to the end keeps the statement busy. */
+static void
+finish_result (DBConnection *dbc, ResultSet_T result)
+{
+    if (ResultSet_next (result))
+        dbc->dirty = TRUE;
 }
 
 int
 ccnet_db_query (CcnetDB *db, const char *sql)
 {
-    Connection_T conn = get_db_connection (db);
-    if (!conn)
+    DBConnection *dbc;
+
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc)
         return -1;
 
     /* Handle zdb "exception"s. */
     TRY
-        Connection_execute (conn, "%s", sql);
-        Connection_close (conn);
-        RETURN (0);
+        Connection_execute (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
-    /* Should not be reached. */
+    release_db_connection (db, dbc, FALSE);
     return 0;
 }
 
 gboolean
 ccnet_db_check_for_existence (CcnetDB *db, const char *sql)
 {
-    Connection_T conn;
+    DBConnection *dbc;
     ResultSet_T result;
     gboolean ret = TRUE;
 
-    conn = get_db_connection (db);
-    if (!conn) {
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc) {
         return FALSE;
     }
 
     TRY
-        result = Connection_executeQuery (conn, "%s", sql);
+        result = Connection_executeQuery (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return FALSE;
     END_TRY;
 
     TRY
         if (!ResultSet_next (result))
             ret = FALSE;
+        else
+            finish_result (dbc, result);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return FALSE;
     END_TRY;
 
-    Connection_close (conn);
+    release_db_connection (db, dbc, FALSE);
 
     return ret;
 }
@@ -248,20 +561,21 @@ int
 ccnet_db_foreach_selected_row (CcnetDB *db, const char *sql, 
                                CcnetDBRowFunc callback, void *data)
 {
-    Connection_T conn;
+    DBConnection *dbc;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
     int n_rows = 0;
 
-    conn = get_db_connection (db);
-    if (!conn)
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc)
         return -1;
 
     TRY
-        result = Connection_executeQuery (conn, "%s", sql);
+        result = Connection_executeQuery (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
@@ -269,16 +583,18 @@ ccnet_db_foreach_selected_row (CcnetDB *db, const char *sql,
     TRY
         while (ResultSet_next (result)) {
             n_rows++;
-            if (!callback (&ccnet_row, data))
+            if (!callback (&ccnet_row, data)) {
+                dbc->dirty = TRUE;
                 break;
+            }
         }
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
-    Connection_close (conn);
+    release_db_connection (db, dbc, FALSE);
     return n_rows;
 }
 
@@ -310,34 +626,37 @@ int
 ccnet_db_get_int (CcnetDB *db, const char *sql)
 {
     int ret = -1;
-    Connection_T conn;
+    DBConnection *dbc;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    conn = get_db_connection (db);
-    if (!conn)
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc)
         return -1;
 
     TRY
-        result = Connection_executeQuery (conn, "%s", sql);
+        result = Connection_executeQuery (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
     ccnet_row.res = result;
 
     TRY
-        if (ResultSet_next (result))
+        if (ResultSet_next (result)) {
             ret = ccnet_db_row_get_column_int (&ccnet_row, 0);
+            finish_result (dbc, result);
+        }
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
-    Connection_close (conn);
+    release_db_connection (db, dbc, FALSE);
     return ret;
 }
 
@@ -345,34 +664,37 @@ gint64
 ccnet_db_get_int64 (CcnetDB *db, const char *sql)
 {
     gint64 ret = -1;
-    Connection_T conn;
+    DBConnection *dbc;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    conn = get_db_connection (db);
-    if (!conn)
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc)
         return -1;
 
     TRY
-        result = Connection_executeQuery (conn, "%s", sql);
+        result = Connection_executeQuery (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
     ccnet_row.res = result;
 
     TRY
-        if (ResultSet_next (result))
+        if (ResultSet_next (result)) {
             ret = ccnet_db_row_get_column_int64 (&ccnet_row, 0);
+            finish_result (dbc, result);
+        }
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return -1;
     END_TRY;
 
-    Connection_close (conn);
+    release_db_connection (db, dbc, FALSE);
     return ret;
 }
 
@@ -381,19 +703,20 @@ ccnet_db_get_string (CcnetDB *db, const char *sql)
 {
     char *ret = NULL;
     const char *s;
-    Connection_T conn;
+    DBConnection *dbc;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    conn = get_db_connection (db);
-    if (!conn)
+    count_query ();
+    dbc = get_db_connection (db);
+    if (!dbc)
         return NULL;
 
     TRY
-        result = Connection_executeQuery (conn, "%s", sql);
+        result = Connection_executeQuery (dbc->conn, "%s", sql);
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return NULL;
     END_TRY;
 
@@ -403,14 +726,15 @@ ccnet_db_get_string (CcnetDB *db, const char *sql)
         if (ResultSet_next (result)) {
             s = ccnet_db_row_get_column_text (&ccnet_row, 0);
             ret = g_strdup(s);
+            finish_result (dbc, result);
         }
     CATCH (SQLException)
         g_warning ("Error exec query %s: %s.\n", sql, Exception_frame.message);
-        Connection_close (conn);
+        release_db_connection (db, dbc, TRUE);
         return NULL;
     END_TRY;
 
-    Connection_close (conn);
+    release_db_connection (db, dbc, FALSE);
     return ret;
 }
 
@@ -447,44 +771,102 @@ ccnet_db_escape_string (CcnetDB *db, const char *from)
     return to;
 }
 
+struct CcnetDBTrans {
+    CcnetDB *db;
+    DBConnection *dbc;
+    gboolean done;              /* committed or rolled back */
+    gboolean error;             /* a statement failed */
+};
+
 struct CcnetDBStatement {
     PreparedStatement_T p;
-    Connection_T conn;
+    DBConnection *dbc;
+    CcnetDB *db;
+    CcnetDBTrans *trans;        /* the connection belongs to it */
+    gboolean error;             /* executing it failed */
 };
 typedef struct CcnetDBStatement CcnetDBStatement;
 
-CcnetDBStatement *
-ccnet_db_prepare_statement (CcnetDB *db, const char *sql)
+/* Returns NULL on error, the connection is still the caller's. */
+static CcnetDBStatement *
+prepare_on_connection (CcnetDB *db, DBConnection *dbc, const char *sql)
 {
     PreparedStatement_T p;
-    CcnetDBStatement *ret = g_new0 (CcnetDBStatement, 1);
+    CcnetDBStatement *ret;
 
-    Connection_T conn = get_db_connection (db);
-    if (!conn) {
-        g_free (ret);
-        return NULL;
+    count_query ();
+
+    ret = g_new0 (CcnetDBStatement, 1);
+    ret->dbc = dbc;
+    ret->db = db;
+
+    p = g_hash_table_lookup (dbc->stmts, sql);
+    if (p) {
+        pthread_mutex_lock (&stat_lock);
+        db_stat.n_stmt_hits++;
+        pthread_mutex_unlock (&stat_lock);
+        ret->p = p;
+        return ret;
     }
 
+    if (g_hash_table_size (dbc->stmts) >= STMT_CACHE_SIZE)
+        clear_db_connection (dbc);
+
     TRY
-        p = Connection_prepareStatement (conn, "%s", sql);
+        p = Connection_prepareStatement (dbc->conn, "%s", sql);
+        g_hash_table_insert (dbc->stmts, g_strdup(sql), p);
         ret->p = p;
-        ret->conn = conn;
-        RETURN (ret);
     CATCH (SQLException)
         g_warning ("Error prepare statement %s: %s.\n", sql, Exception_frame.message);
         g_free (ret);
-        Connection_close (conn);
         return NULL;
     END_TRY;
 
-    /* Should not be reached. */
-    return NULL;
+    pthread_mutex_lock (&stat_lock);
+    db_stat.n_prepares++;
+    pthread_mutex_unlock (&stat_lock);
+
+    return ret;
+}
+
+CcnetDBStatement *
+ccnet_db_prepare_statement (CcnetDB *db, const char *sql)
+{
+    CcnetDBStatement *ret;
+
+    DBConnection *dbc = get_db_connection (db);
+    if (!dbc)
+        return NULL;
+
+    ret = prepare_on_connection (db, dbc, sql);
+    if (!ret)
+        release_db_connection (db, dbc, TRUE);
+    return ret;
+}
+
+static CcnetDBStatement *
+trans_prepare_statement (CcnetDBTrans *trans, const char *sql)
+{
+    CcnetDBStatement *ret;
+
+    ret = prepare_on_connection (trans->db, trans->dbc, sql);
+    if (!ret) {
+        trans->error = TRUE;
+        return NULL;
+    }
+    ret->trans = trans;
+    return ret;
 }
 
 void
 ccnet_db_statement_free (CcnetDBStatement *p)
 {
-    Connection_close (p->conn);
+    /* the statement stays cached with the connection */
+    if (p->trans) {
+        if (p->error)
+            p->trans->error = TRUE;
+    } else
+        release_db_connection (p->db, p->dbc, p->error);
     g_free (p);
 }
 
@@ -561,29 +943,16 @@ set_parameters_va (CcnetDBStatement *p, int n, va_list args)
     return 0;
 }
 
-int
-ccnet_db_statement_query (CcnetDB *db, const char *sql, int n, ...)
+static int
+execute_statement (CcnetDBStatement *p)
 {
-    CcnetDBStatement *p;
     volatile int ret = 0;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return -1;
-
-    va_list args;
-    va_start (args, n);
-    if (set_parameters_va (p, n, args) < 0) {
-        ccnet_db_statement_free (p);
-        va_end (args);
-        return -1;
-    }
-    va_end (args);
-
     TRY
         PreparedStatement_execute (p->p);
     CATCH (SQLException)
         g_warning ("Error execute prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ret = -1;
     END_TRY;
 
@@ -591,30 +960,33 @@ ccnet_db_statement_query (CcnetDB *db, const char *sql, int n, ...)
     return ret;
 }
 
-gboolean
-ccnet_db_statement_exists (CcnetDB *db, const char *sql, int n, ...)
+static int
+statement_query_va (CcnetDBStatement *p, int n, va_list args)
+{
+    if (set_parameters_va (p, n, args) < 0) {
+        ccnet_db_statement_free (p);
+        return -1;
+    }
+
+    return execute_statement (p);
+}
+
+static gboolean
+statement_exists_va (CcnetDBStatement *p, int n, va_list args)
 {
-    CcnetDBStatement *p;
     ResultSet_T result;
     volatile gboolean ret = TRUE;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return FALSE;
-
-    va_list args;
-    va_start (args, n);
     if (set_parameters_va (p, n, args) < 0) {
         ccnet_db_statement_free (p);
-        va_end (args);
         return FALSE;
     }
-    va_end (args);
 
     TRY
         result = PreparedStatement_executeQuery (p->p);
     CATCH (SQLException)
         g_warning ("Error exec prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return FALSE;
     END_TRY;
@@ -622,9 +994,12 @@ ccnet_db_statement_exists (CcnetDB *db, const char *sql, int n, ...)
     TRY
         if (!ResultSet_next (result))
             ret = FALSE;
+        else
+            finish_result (p->dbc, result);
     CATCH (SQLException)
         g_warning ("Error get next result from prep stmt: %s.\n",
                    Exception_frame.message);
+        p->error = TRUE;
         ret = FALSE;
     END_TRY;
 
@@ -633,34 +1008,25 @@ ccnet_db_statement_exists (CcnetDB *db, const char *sql, int n, ...)
     return ret;
 }
 
-int
-ccnet_db_statement_foreach_row (CcnetDB *db,
-                                const char *sql,
-                                CcnetDBRowFunc callback, void *data,
-                                int n, ...)
+static int
+statement_foreach_row_va (CcnetDBStatement *p,
+                          CcnetDBRowFunc callback, void *data,
+                          int n, va_list args)
 {
-    CcnetDBStatement *p;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
     volatile int n_rows = 0;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return -1;
-
-    va_list args;
-    va_start (args, n);
     if (set_parameters_va (p, n, args) < 0) {
         ccnet_db_statement_free (p);
-        va_end (args);
         return -1;
     }
-    va_end (args);
 
     TRY
         result = PreparedStatement_executeQuery (p->p);
     CATCH (SQLException)
         g_warning ("Error exec prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -669,12 +1035,15 @@ ccnet_db_statement_foreach_row (CcnetDB *db,
     TRY
         while (ResultSet_next (result)) {
             n_rows++;
-            if (!callback (&ccnet_row, data))
+            if (!callback (&ccnet_row, data)) {
+                p->dbc->dirty = TRUE;
                 break;
+            }
         }
     CATCH (SQLException)
         g_warning ("Error get next result for prep stmt: %s.\n",
                    Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -683,31 +1052,23 @@ ccnet_db_statement_foreach_row (CcnetDB *db,
     return n_rows;
 }
 
-int
-ccnet_db_statement_get_int (CcnetDB *db, const char *sql, int n, ...)
+static int
+statement_get_int_va (CcnetDBStatement *p, int n, va_list args)
 {
-    CcnetDBStatement *p;
     volatile int ret = -1;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return -1;
-
-    va_list args;
-    va_start (args, n);
     if (set_parameters_va (p, n, args) < 0) {
         ccnet_db_statement_free (p);
-        va_end (args);
         return -1;
     }
-    va_end (args);
 
     TRY
         result = PreparedStatement_executeQuery (p->p);
     CATCH (SQLException)
         g_warning ("Error exec prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -715,11 +1076,14 @@ ccnet_db_statement_get_int (CcnetDB *db, const char *sql, int n, ...)
     ccnet_row.res = result;
 
     TRY
-        if (ResultSet_next (result))
+        if (ResultSet_next (result)) {
             ret = ccnet_db_row_get_column_int (&ccnet_row, 0);
+            finish_result (p->dbc, result);
+        }
     CATCH (SQLException)
         g_warning ("Error get next result for prep stmt: %s.\n",
                    Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -728,31 +1092,23 @@ ccnet_db_statement_get_int (CcnetDB *db, const char *sql, int n, ...)
     return ret;
 }
 
-gint64
-ccnet_db_statement_get_int64 (CcnetDB *db, const char *sql, int n, ...)
+static gint64
+statement_get_int64_va (CcnetDBStatement *p, int n, va_list args)
 {
-    CcnetDBStatement *p;
     volatile gint64 ret = -1;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return -1;
-
-    va_list args;
-    va_start (args, n);
     if (set_parameters_va (p, n, args) < 0) {
         ccnet_db_statement_free (p);
-        va_end (args);
         return -1;
     }
-    va_end (args);
 
     TRY
         result = PreparedStatement_executeQuery (p->p);
     CATCH (SQLException)
         g_warning ("Error exec prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -760,11 +1116,14 @@ ccnet_db_statement_get_int64 (CcnetDB *db, const char *sql, int n, ...)
     ccnet_row.res = result;
 
     TRY
-        if (ResultSet_next (result))
+        if (ResultSet_next (result)) {
             ret = ccnet_db_row_get_column_int64 (&ccnet_row, 0);
+            finish_result (p->dbc, result);
+        }
     CATCH (SQLException)
         g_warning ("Error get next result for prep stmt: %s.\n",
                    Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return -1;
     END_TRY;
@@ -773,32 +1132,24 @@ ccnet_db_statement_get_int64 (CcnetDB *db, const char *sql, int n, ...)
     return ret;
 }
 
-char *
-ccnet_db_statement_get_string (CcnetDB *db, const char *sql, int n, ...)
+static char *
+statement_get_string_va (CcnetDBStatement *p, int n, va_list args)
 {
-    CcnetDBStatement *p;
     char *ret = NULL;
     const char *s;
     ResultSet_T result;
     CcnetDBRow ccnet_row;
 
-    p = ccnet_db_prepare_statement (db, sql);
-    if (!p)
-        return NULL;
-
-    va_list args;
-    va_start (args, n);
     if (set_parameters_va (p, n, args) < 0) {
         ccnet_db_statement_free (p);
-        va_end (args);
         return NULL;
     }
-    va_end (args);
 
     TRY
         result = PreparedStatement_executeQuery (p->p);
     CATCH (SQLException)
         g_warning ("Error exec prep stmt: %s.\n", Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return NULL;
     END_TRY;
@@ -809,10 +1160,12 @@ ccnet_db_statement_get_string (CcnetDB *db, const char *sql, int n, ...)
         if (ResultSet_next (result)) {
             s = ccnet_db_row_get_column_text (&ccnet_row, 0);
             ret = g_strdup(s);
+            finish_result (p->dbc, result);
         }
     CATCH (SQLException)
         g_warning ("Error get next result for prep stmt: %s.\n",
                    Exception_frame.message);
+        p->error = TRUE;
         ccnet_db_statement_free (p);
         return NULL;
     END_TRY;
@@ -820,3 +1173,535 @@ ccnet_db_statement_get_string (CcnetDB *db, const char *sql, int n, ...)
     ccnet_db_statement_free (p);
     return ret;
 }
+
+int
+ccnet_db_statement_query (CcnetDB *db, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_query_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+gboolean
+ccnet_db_statement_exists (CcnetDB *db, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    gboolean ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return FALSE;
+
+    va_start (args, n);
+    ret = statement_exists_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+int
+ccnet_db_statement_foreach_row (CcnetDB *db,
+                                const char *sql,
+                                CcnetDBRowFunc callback, void *data,
+                                int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_foreach_row_va (p, callback, data, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+int
+ccnet_db_statement_get_int (CcnetDB *db, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_get_int_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+gint64
+ccnet_db_statement_get_int64 (CcnetDB *db, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    gint64 ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_get_int64_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+char *
+ccnet_db_statement_get_string (CcnetDB *db, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    char *ret;
+    va_list args;
+
+    p = ccnet_db_prepare_statement (db, sql);
+    if (!p)
+        return NULL;
+
+    va_start (args, n);
+    ret = statement_get_string_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+/* Transactions */
+
+CcnetDBTrans *
+ccnet_db_begin_transaction (CcnetDB *db)
+{
+    CcnetDBTrans *trans;
+    DBConnection *dbc;
+
+    dbc = get_db_connection (db);
+    if (!dbc)
+        return NULL;
+
+    TRY
+        Connection_beginTransaction (dbc->conn);
+    CATCH (SQLException)
+        g_warning ("Error begin transaction: %s.\n", Exception_frame.message);
+        release_db_connection (db, dbc, TRUE);
+        return NULL;
+    END_TRY;
+
+    trans = g_new0 (CcnetDBTrans, 1);
+    trans->db = db;
+    trans->dbc = dbc;
+    return trans;
+}
+
+int
+ccnet_db_commit (CcnetDBTrans *trans)
+{
+    g_return_val_if_fail (!trans->done, -1);
+
+    if (trans->error) {
+        g_warning ("A statement of the transaction failed, rolling back.\n");
+        ccnet_db_rollback (trans);
+        return -1;
+    }
+
+    TRY
+        Connection_commit (trans->dbc->conn);
+    CATCH (SQLException)
+        g_warning ("Error commit transaction: %s.\n", Exception_frame.message);
+        trans->error = TRUE;
+    END_TRY;
+
+    if (trans->error) {
+        ccnet_db_rollback (trans);
+        return -1;
+    }
+    trans->done = TRUE;
+    return 0;
+}
+
+int
+ccnet_db_rollback (CcnetDBTrans *trans)
+{
+    g_return_val_if_fail (!trans->done, -1);
+
+    trans->done = TRUE;
+
+    TRY
+        Connection_rollback (trans->dbc->conn);
+    CATCH (SQLException)
+        g_warning ("Error rollback transaction: %s.\n", Exception_frame.message);
+        trans->error = TRUE;
+        return -1;
+    END_TRY;
+
+    return 0;
+}
+
+void
+ccnet_db_trans_close (CcnetDBTrans *trans)
+{
+    if (!trans)
+        return;
+
+    if (!trans->done)
+        ccnet_db_rollback (trans);
+    release_db_connection (trans->db, trans->dbc, trans->error);
+    g_free (trans);
+}
+
+int
+ccnet_db_trans_query (CcnetDBTrans *trans, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = trans_prepare_statement (trans, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_query_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+gboolean
+ccnet_db_trans_exists (CcnetDBTrans *trans, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    gboolean ret;
+    va_list args;
+
+    p = trans_prepare_statement (trans, sql);
+    if (!p)
+        return FALSE;
+
+    va_start (args, n);
+    ret = statement_exists_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+int
+ccnet_db_trans_foreach_row (CcnetDBTrans *trans,
+                            const char *sql,
+                            CcnetDBRowFunc callback, void *data,
+                            int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = trans_prepare_statement (trans, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_foreach_row_va (p, callback, data, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+int
+ccnet_db_trans_get_int (CcnetDBTrans *trans, const char *sql, int n, ...)
+{
+    CcnetDBStatement *p;
+    int ret;
+    va_list args;
+
+    p = trans_prepare_statement (trans, sql);
+    if (!p)
+        return -1;
+
+    va_start (args, n);
+    ret = statement_get_int_va (p, n, args);
+    va_end (args);
+
+    return ret;
+}
+
+/* Bulk statements
+ *
+ * Lists are split into chunks of a power of two length, so only a few
+ * distinct statements are prepared and they stay in the cache. An IN
+ * list is padded with its last key, a row insert is split further.
+ */
+
+#define BULK_MAX_CHUNK  1024
+
+/* SQLite is usually built with SQLITE_MAX_VARIABLE_NUMBER 999. */
+static int
+max_parameters (CcnetDB *db)
+{
+    switch (db->type) {
+    case CCNET_DB_TYPE_MYSQL:
+        return 65535;
+    case CCNET_DB_TYPE_PGSQL:
+        return 32767;
+    default:
+        return 999;
+    }
+}
+
+/* Largest power of two not above @n, @n > 0. */
+static int
+floor_pow2 (int n)
+{
+    int ret = 1;
+
+    while (ret * 2 <= n)
+        ret *= 2;
+    return ret;
+}
+
+static int
+ceil_pow2 (int n)
+{
+    int ret = 1;
+
+    while (ret < n)
+        ret *= 2;
+    return ret;
+}
+
+/* "(?,?,...)" for @n parameters, appended to @buf. */
+static void
+append_placeholders (GString *buf, int n)
+{
+    int i;
+
+    g_string_append_c (buf, '(');
+    for (i = 0; i < n; ++i)
+        g_string_append (buf, i ? ",?" : "?");
+    g_string_append_c (buf, ')');
+}
+
+static int
+bind_value (CcnetDBStatement *p, int idx, const char *type,
+            const void *values, int i)
+{
+    if (strcmp (type, "int") == 0)
+        return ccnet_db_statement_set_int (p, idx, ((const int *)values)[i]);
+    if (strcmp (type, "int64") == 0)
+        return ccnet_db_statement_set_int64 (p, idx,
+                                             ((const gint64 *)values)[i]);
+    if (strcmp (type, "string") == 0)
+        return ccnet_db_statement_set_string (p, idx,
+                                              ((const char **)values)[i]);
+
+    g_warning ("BUG: invalid prep stmt parameter type %s.\n", type);
+    g_return_val_if_reached (-1);
+}
+
+typedef struct ForeachInData {
+    CcnetDBRowFunc callback;
+    void *data;
+    gboolean stopped;
+} ForeachInData;
+
+static gboolean
+foreach_in_cb (CcnetDBRow *row, void *vdata)
+{
+    ForeachInData *d = vdata;
+
+    if (!d->callback (row, d->data))
+        d->stopped = TRUE;
+    return !d->stopped;
+}
+
+int
+ccnet_db_statement_foreach_row_in (CcnetDB *db,
+                                   const char *sql,
+                                   const char *key_type,
+                                   const void *keys, int n_keys,
+                                   CcnetDBRowFunc callback, void *data,
+                                   int n, ...)
+{
+    const char *marker = strstr (sql, "(?*)");
+    CcnetDBTrans *trans = NULL;
+    CcnetDBStatement *p;
+    ForeachInData d = { callback, data, FALSE };
+    GString *buf;
+    va_list args, aq;
+    int max_chunk, chunk, off, i, rc, n_rows = 0;
+
+    g_return_val_if_fail (marker != NULL, -1);
+    if (n_keys <= 0)
+        return 0;
+
+    max_chunk = MIN (floor_pow2 (max_parameters (db) - n), BULK_MAX_CHUNK);
+
+    /* the same view of the data for all chunks */
+    if (n_keys > max_chunk) {
+        trans = ccnet_db_begin_transaction (db);
+        if (!trans)
+            return -1;
+    }
+
+    buf = g_string_new (NULL);
+    va_start (args, n);
+    for (off = 0; off < n_keys && !d.stopped; off += chunk) {
+        chunk = MIN (ceil_pow2 (n_keys - off), max_chunk);
+
+        g_string_truncate (buf, 0);
+        g_string_append_len (buf, sql, marker - sql);
+        append_placeholders (buf, chunk);
+        g_string_append (buf, marker + 4);
+
+        if (trans)
+            p = trans_prepare_statement (trans, buf->str);
+        else
+            p = ccnet_db_prepare_statement (db, buf->str);
+        if (!p) {
+            n_rows = -1;
+            break;
+        }
+
+        /* the keys follow the other parameters */
+        for (i = 0; i < chunk; ++i) {
+            if (bind_value (p, n + i + 1, key_type, keys,
+                            MIN (off + i, n_keys - 1)) < 0)
+                break;
+        }
+        if (i < chunk) {
+            ccnet_db_statement_free (p);
+            n_rows = -1;
+            break;
+        }
+
+        va_copy (aq, args);
+        rc = statement_foreach_row_va (p, foreach_in_cb, &d, n, aq);
+        va_end (aq);
+        if (rc < 0) {
+            n_rows = -1;
+            break;
+        }
+        n_rows += rc;
+    }
+    va_end (args);
+    g_string_free (buf, TRUE);
+
+    if (trans) {
+        if (n_rows >= 0 && ccnet_db_commit (trans) < 0)
+            n_rows = -1;
+        ccnet_db_trans_close (trans);
+    }
+    return n_rows;
+}
+
+int
+ccnet_db_trans_bulk_insert (CcnetDBTrans *trans, const char *sql,
+                            int n_cols, const char **types,
+                            const void **columns, int n_rows)
+{
+    CcnetDBStatement *p;
+    GString *buf;
+    int max_chunk, chunk, off, r, c, i;
+    int ret = 0;
+
+    if (n_rows <= 0)
+        return 0;
+
+    max_chunk = MIN (floor_pow2 (max_parameters (trans->db) / n_cols),
+                     BULK_MAX_CHUNK);
+
+    buf = g_string_new (NULL);
+    for (off = 0; off < n_rows; off += chunk) {
+        chunk = MIN (floor_pow2 (n_rows - off), max_chunk);
+
+        g_string_assign (buf, sql);
+        g_string_append (buf, " VALUES ");
+        for (r = 0; r < chunk; ++r) {
+            if (r)
+                g_string_append_c (buf, ',');
+            append_placeholders (buf, n_cols);
+        }
+
+        p = trans_prepare_statement (trans, buf->str);
+        if (!p) {
+            ret = -1;
+            break;
+        }
+
+        for (r = 0, i = 1; r < chunk; ++r)
+            for (c = 0; c < n_cols; ++c, ++i)
+                if (bind_value (p, i, types[c], columns[c], off + r) < 0)
+                    ret = -1;
+        if (ret < 0) {
+            ccnet_db_statement_free (p);
+            break;
+        }
+
+        if (execute_statement (p) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    g_string_free (buf, TRUE);
+    return ret;
+}
+
+int
+ccnet_db_bulk_insert (CcnetDB *db, const char *sql,
+                      int n_cols, const char **types, const void **columns,
+                      int n_rows)
+{
+    CcnetDBTrans *trans;
+    int ret;
+
+    if (n_rows <= 0)
+        return 0;
+
+    trans = ccnet_db_begin_transaction (db);
+    if (!trans)
+        return -1;
+
+    ret = ccnet_db_trans_bulk_insert (trans, sql, n_cols, types, columns,
+                                      n_rows);
+    if (ret == 0)
+        ret = ccnet_db_commit (trans);
+    ccnet_db_trans_close (trans);
+    return ret;
+}
+
+void
+ccnet_db_get_stat (CcnetDBStat *stat)
+{
+    GList *ptr;
+    CcnetDB *db;
+
+    pthread_mutex_lock (&stat_lock);
+    *stat = db_stat;
+    stat->n_active = stat->n_idle = stat->n_waiting = 0;
+    for (ptr = all_dbs; ptr; ptr = ptr->next) {
+        db = ptr->data;
+        pthread_mutex_lock (&db->lock);
+        stat->n_idle += g_queue_get_length (db->idle);
+        stat->n_active += db->n_conns - g_queue_get_length (db->idle);
+        stat->n_waiting += db->n_waiting;
+        pthread_mutex_unlock (&db->lock);
+    }
+    pthread_mutex_unlock (&stat_lock);
+}
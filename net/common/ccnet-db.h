@@ -46,6 +46,12 @@ ccnet_db_new_sqlite (const char *db_path);
 void
 ccnet_db_free (CcnetDB *db);
 
+/* Keep at least @min_conns and at most @max_conns connections open. A
+ * caller finding none available waits up to @wait_timeout seconds. */
+void
+ccnet_db_set_pool_config (CcnetDB *db, int min_conns, int max_conns,
+                          int wait_timeout);
+
 int
 ccnet_db_type (CcnetDB *db);
 
@@ -105,6 +111,96 @@ ccnet_db_statement_get_int64 (CcnetDB *db, const char *sql, int n, ...);
 char *
 ccnet_db_statement_get_string (CcnetDB *db, const char *sql, int n, ...);
 
+/* Transactions. The statements of a transaction run on one connection,
+ * which is held until ccnet_db_trans_close(). If a statement failed,
+ * commit rolls back and returns -1; close rolls back unless committed.
+ */
+
+typedef struct CcnetDBTrans CcnetDBTrans;
+
+CcnetDBTrans *
+ccnet_db_begin_transaction (CcnetDB *db);
+
+int
+ccnet_db_commit (CcnetDBTrans *trans);
+
+int
+ccnet_db_rollback (CcnetDBTrans *trans);
+
+void
+ccnet_db_trans_close (CcnetDBTrans *trans);
+
+int
+ccnet_db_trans_query (CcnetDBTrans *trans, const char *sql, int n, ...);
+
+gboolean
+ccnet_db_trans_exists (CcnetDBTrans *trans, const char *sql, int n, ...);
+
+int
+ccnet_db_trans_foreach_row (CcnetDBTrans *trans,
+                            const char *sql,
+                            CcnetDBRowFunc callback, void *data,
+                            int n, ...);
+
+int
+ccnet_db_trans_get_int (CcnetDBTrans *trans, const char *sql, int n, ...);
+
+/* Bulk statements. Long lists are split into several statements. */
+
+/* Like ccnet_db_statement_foreach_row(), for the keys in @keys: "(?*)" in
+ * @sql stands for the list, e.g. "... WHERE email IN (?*)". @key_type
+ * is "int", "int64" or "string", and @keys an array of int, gint64 or
+ * const char *. The other @n parameters must come before the list.
+ */
+int
+ccnet_db_statement_foreach_row_in (CcnetDB *db,
+                                   const char *sql,
+                                   const char *key_type,
+                                   const void *keys, int n_keys,
+                                   CcnetDBRowFunc callback, void *data,
+                                   int n, ...);
+
+/* Insert @n_rows rows in one transaction. @sql is the statement without
+ * values, e.g. "INSERT INTO GroupUser (group_id, user_name, is_staff)";
+ * column i has type @types[i] and its values in the array @columns[i].
+ */
+int
+ccnet_db_bulk_insert (CcnetDB *db, const char *sql,
+                      int n_cols, const char **types, const void **columns,
+                      int n_rows);
+
+/* The same within @trans, which is left open. */
+int
+ccnet_db_trans_bulk_insert (CcnetDBTrans *trans, const char *sql,
+                            int n_cols, const char **types,
+                            const void **columns, int n_rows);
+
+/* Waits for a connection under 1ms, 10ms, 100ms, 1s and longer. */
+#define CCNET_DB_WAIT_BUCKETS 5
+
+/* Counted over all dbs. Prepared statements are cached per connection. */
+typedef struct CcnetDBStat {
+    gint64 n_prepares;          /* statements prepared on the server */
+    gint64 n_stmt_hits;         /* statements reused from the cache */
+    gint64 n_stmt_flushes;      /* caches dropped, full or unfinished */
+
+    gint64 n_waits;             /* waited for a connection */
+    gint64 n_timeouts;          /* waited and got none */
+    gint64 wait_usec;           /* total wait time */
+    gint64 wait_hist[CCNET_DB_WAIT_BUCKETS];
+
+    int    n_active;            /* connections in use */
+    int    n_idle;
+    int    n_waiting;           /* callers waiting now */
+} CcnetDBStat;
+
+void
+ccnet_db_get_stat (CcnetDBStat *stat);
+
+/* Queries run by the calling thread so far, monotonic. */
+gint64
+ccnet_db_get_thread_query_count ();
+
 #else
 
 #define CcnetDB sqlite3
@@ -19,7 +19,8 @@
 
 
 #define MAX_RECONNECTIONS_PER_PULSE  5
-#define LISTEN_INTERVAL 1000        /* 1s */
+#define ACCEPT_BATCH                 64   /* accepts per wakeup */
+#define ACCEPT_PAUSE_MSEC            100  /* back off when out of fds */
 #define RECONNECT_PERIOD_MSEC             10000
 
 
@@ -469,28 +470,60 @@ ccnet_conn_manager_add_incoming (CcnetConnManager    *manager,
 }
 
 
+static void accept_peers (evutil_socket_t fd, short event, void *vmanager);
+
 static int
-listen_pulse (void * vmanager)
+resume_listen (void *vmanager)
+{
+    CcnetConnManager *manager = vmanager;
+
+    event_add (&manager->listen_event, NULL);
+    /* the timer frees itself */
+    manager->listen_timer = NULL;
+    return FALSE;
+}
+
+static void
+pause_listen (CcnetConnManager *manager)
+{
+    /* Without free fds the pending connection stays in the queue and
+     * the listener would fire again at once. */
+    event_del (&manager->listen_event);
+    ccnet_timer_free (&manager->listen_timer);
+    manager->listen_timer = ccnet_timer_new (resume_listen, manager,
+                                             ACCEPT_PAUSE_MSEC);
+}
+
+static void
+accept_peers (evutil_socket_t fd, short event, void *vmanager)
 {
     CcnetConnManager *manager = vmanager;
+    int i;
 
-    for ( ;; ) /* check for new incoming peer connections */    
-    {
+    if (ccnet_net_listen_queue_full (fd))
+        manager->n_accept_overflows++;
+
+    /* bounded so a connect storm can't starve established peers */
+    for (i = 0; i < ACCEPT_BATCH; ++i) {
         evutil_socket_t socket;
         struct sockaddr_storage cliaddr;
         socklen_t len = sizeof (struct sockaddr_storage);
 
-        if (manager->bind_socket < 0)
-            break;
+        if ((socket = ccnet_net_accept (fd, &cliaddr, &len, 1)) < 0) {
+            int err = EVUTIL_SOCKET_ERROR();
 
-        if ((socket = ccnet_net_accept (manager->bind_socket, 
-                                        &cliaddr, &len, 1)) < 0)
+            if (ccnet_net_accept_resource_error (err)) {
+                manager->n_accept_overflows++;
+                ccnet_warning ("[Conn] accept failed: %s\n",
+                               evutil_socket_error_to_string (err));
+                pause_listen (manager);
+            }
             break;
+        }
 
+        manager->n_accepted++;
         ccnet_conn_manager_add_incoming (manager, &cliaddr, len, socket);
     }
- 
-    return TRUE;
 }
 
 
@@ -514,7 +547,7 @@ ccnet_conn_listen_init (CcnetConnManager *manager)
         ccnet_message ("Opened port %d to listen for "
                        "incoming peer connections\n", session->base.public_port);
         manager->bind_socket = socket;
-        listen (manager->bind_socket, 5);
+        listen (manager->bind_socket, session->listen_backlog);
     } else {
         ccnet_error ("Couldn't open port %d to listen for "
                      "incoming peer connections (errno %d - %s)",
@@ -522,8 +555,9 @@ ccnet_conn_listen_init (CcnetConnManager *manager)
         exit (1);
     }
 
-    manager->listen_timer = ccnet_timer_new (listen_pulse, manager,
-                                             LISTEN_INTERVAL);
+    event_set (&manager->listen_event, manager->bind_socket,
+               EV_READ | EV_PERSIST, accept_peers, manager);
+    event_add (&manager->listen_event, NULL);
 }
 
 typedef struct DNSLookupData {
@@ -614,13 +648,19 @@ static void
 dns_lookup_peer (CcnetPeer* peer)
 {
     DNSLookupData *data;
+    CcnetJobManager *pool;
 
     if (peer->dns_done)
         return;
 
+    /* try again on the next connect round */
+    pool = ccnet_session_get_job_pool (peer->manager->session, "dns");
+    if (ccnet_job_manager_is_full (pool))
+        return;
+
     data = g_new0 (DNSLookupData, 1);
     data->peer = peer;
-    ccnet_job_manager_schedule_job (peer->manager->session->job_mgr,
+    ccnet_job_manager_schedule_job (pool,
                                     dns_lookup,
                                     dns_lookup_cb,
                                     data);
@@ -639,6 +679,8 @@ ccnet_conn_manager_start (CcnetConnManager *manager)
 void
 ccnet_conn_manager_stop (CcnetConnManager *manager)
 {
+    if (manager->bind_socket > 0)
+        event_del (&manager->listen_event);
     evutil_closesocket (manager->bind_socket);
     manager->bind_socket = 0;
 
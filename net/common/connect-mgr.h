@@ -18,9 +18,15 @@ struct CcnetConnManager
     CcnetSession    *session;
 
     CcnetTimer      *reconnect_timer;
-    CcnetTimer      *listen_timer;
+    CcnetTimer      *listen_timer;  /* re-arms the listener after a pause */
 
     evutil_socket_t  bind_socket;
+    struct event     listen_event;
+
+    /* accepted connections and times the accept queue overflowed or
+     * we ran out of fds, since start */
+    int              n_accepted;
+    int              n_accept_overflows;
 
     GList           *conn_list;
 };
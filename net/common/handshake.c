@@ -36,6 +36,10 @@
              ---------------------------->
    DONE                                      DONE 
 
+   The version field of the two id packets carries the highest protocol
+   version the sender speaks. Both sides use the smaller of the two, so a
+   peer that only speaks version 1 never receives a v2 header.
+
  */
 
 enum {
@@ -54,7 +58,7 @@ send_handshake_message (CcnetHandshake *handshake)
     char buf[256];
     ccnet_packet *packet = (ccnet_packet *)buf;
 
-    packet->header.version = 1;
+    packet->header.version = CCNET_PROTO_VERSION;
     packet->header.type = CCNET_MSG_HANDSHAKE;
     memcpy (packet->data, id, 40);
     packet->header.length = 40;
@@ -86,13 +90,14 @@ send_ack (CcnetHandshake *handshake)
 }
 
 static void
-read_peer_id (CcnetHandshake *handshake, ccnet_packet *packet)
+read_peer_id (CcnetHandshake *handshake, ccnet_packet *packet, uint32_t len)
 {
-    uint16_t len;
     char *id;
 
+    if (packet->header.version >= CCNET_PROTO_VERSION_2)
+        handshake->io->proto_version = CCNET_PROTO_VERSION_2;
+
     /* get id */
-    len = packet->header.length;
     id = g_malloc (len + 1);
     memcpy (id, packet->data, len);
     id[len] = '\0';
@@ -135,17 +140,17 @@ read_ok (CcnetHandshake *handshake, ccnet_packet *packet)
 
 
 static void
-canRead (ccnet_packet *packet, void *arg)
+canRead (ccnet_packet *packet, uint32_t len, void *arg)
 {
     CcnetHandshake *handshake = (CcnetHandshake *)arg;
     ccnet_debug("current state is %d\n", handshake->state);
 
     switch (handshake->state) {
     case INIT:
-        read_peer_id (handshake, packet);
+        read_peer_id (handshake, packet, len);
         break;
     case ID_SENT:
-        read_peer_id (handshake, packet);
+        read_peer_id (handshake, packet, len);
         break;
     case ID_RECEIVED:
         read_ok (handshake, packet);
@@ -15,7 +15,9 @@
 
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <event2/event.h>
+#include <event2/buffer.h>
 #include <event2/bufferevent.h>
+#include <event2/bufferevent_compat.h>
 #include <event2/bufferevent_struct.h>
 #else
 #include <event.h>
@@ -35,10 +37,16 @@
 
 /* The watermark of the underlying evbuffer. When there are more data than
  * this value is remained in evbuffer, the read event will be removed.
- * So, it must be greater than the max length of a single ccnet packet.
+ * So, it must be greater than the max length of a single v1 ccnet packet.
+ * It is raised temporarily while a larger v2 packet is being received.
  */
 #define CCNET_RDBUF 100000
 
+/* Largest encrypted packet we accept: a full v2 packet plus room for
+ * the cipher padding. */
+#define CCNET_MAX_ENCPACKET_LEN \
+    (CCNET_PACKET_MAX_PAYLOAD_LEN_V2 + CCNET_PACKET_LENGTH_HEADER_V2 + 64)
+
 static void
 didWriteWrapper (struct bufferevent *e, void *user_data)
 {
@@ -47,14 +55,58 @@ didWriteWrapper (struct bufferevent *e, void *user_data)
         c->didWrite (e, c->user_data);
 }
 
+void bufferevent_setwatermark(struct bufferevent *, short, size_t, size_t);
+
+/*
+ * Convert the frame at @frame from network to host byte order and return
+ * the packet view of it. For a v2 frame, the v1-shaped header is rebuilt
+ * in the 8 bytes just before the payload, so that packet->data always
+ * points to the payload. The payload length is returned in @len.
+ */
+ccnet_packet *
+ccnet_packet_from_frame (char *frame, uint32_t *len)
+{
+    ccnet_packet *packet;
+    ccnet_header_v2 v2;
+
+    packet = (ccnet_packet *)frame;
+    if (!CCNET_HEADER_IS_V2 (&packet->header)) {
+        if (packet->header.type == CCNET_MSG_ENCPACKET)
+            *len = ntohl (packet->header.id);
+        else
+            *len = ntohs (packet->header.length);
+        packet->header.length = *len;
+        packet->header.id = ntohl (packet->header.id);
+        return packet;
+    }
+
+    memcpy (&v2, frame, sizeof(v2));
+    *len = ntohl (v2.length);
+
+    packet = (ccnet_packet *)(frame + CCNET_PACKET_LENGTH_HEADER_V2
+                              - CCNET_PACKET_LENGTH_HEADER);
+    packet->header.version = v2.version;
+    packet->header.type = v2.type;
+    packet->header.length = 0;
+    packet->header.id = ntohl (v2.id);
+    return packet;
+}
+
 static void
 canReadWrapper (struct bufferevent *e, void *user_data)
 {
     CcnetPacketIO *c = user_data;
+    union {
+        ccnet_header    v1;
+        ccnet_header_v2 v2;
+    } header;
     ccnet_packet *packet;
-    uint32_t len;
+    char *frame;
+    uint32_t len, hlen;
+    size_t avail;
 
     g_return_if_fail (sizeof(ccnet_header) == CCNET_PACKET_LENGTH_HEADER);
+    g_return_if_fail (sizeof(ccnet_header_v2) == CCNET_PACKET_LENGTH_HEADER_V2);
 
     c->handling = 1;
 
@@ -67,20 +119,51 @@ canReadWrapper (struct bufferevent *e, void *user_data)
     }
     
     while (1) {
-        packet = (ccnet_packet *) EVBUFFER_DATA (e->input);
-
-        if (packet->header.type == CCNET_MSG_ENCPACKET)
-            len = ntohl (packet->header.id);
-        else
-            len = ntohs (packet->header.length);
+        avail = EVBUFFER_LENGTH (e->input);
+
+        /* Only peek at the header here. EVBUFFER_DATA() would linearize
+         * the whole input buffer on every iteration, which is quadratic
+         * when many small packets are queued.
+         */
+        evbuffer_copyout (e->input, &header, CCNET_PACKET_LENGTH_HEADER);
+
+        if (CCNET_HEADER_IS_V2 (&header.v1)) {
+            if (avail < CCNET_PACKET_LENGTH_HEADER_V2)
+                break;         /* wait for more data */
+            evbuffer_copyout (e->input, &header, CCNET_PACKET_LENGTH_HEADER_V2);
+            hlen = CCNET_PACKET_LENGTH_HEADER_V2;
+            len = ntohl (header.v2.length);
+            if (len > CCNET_PACKET_MAX_PAYLOAD_LEN_V2)
+                goto bad_packet;
+        } else if (header.v1.type == CCNET_MSG_ENCPACKET) {
+            hlen = CCNET_PACKET_LENGTH_HEADER;
+            len = ntohl (header.v1.id);
+            if (len > CCNET_MAX_ENCPACKET_LEN)
+                goto bad_packet;
+        } else {
+            hlen = CCNET_PACKET_LENGTH_HEADER;
+            len = ntohs (header.v1.length);
+        }
 
-        if (EVBUFFER_LENGTH (e->input) - CCNET_PACKET_LENGTH_HEADER < len)
+        if (avail - hlen < len) {
+            /* The read watermark stops reading at CCNET_RDBUF bytes, raise
+             * it until a packet larger than that is complete. */
+            if (hlen + len > CCNET_RDBUF) {
+                bufferevent_setwatermark (e, EV_READ, CCNET_PACKET_LENGTH_HEADER,
+                                          hlen + len);
+                c->watermark_raised = 1;
+            }
             break;                 /* wait for more data */
+        }
+
+        /* make only the current frame contiguous */
+        frame = (char *) evbuffer_pullup (e->input, hlen + len);
+        if (frame == NULL)
+            break;
 
         /* byte order, from network to host */
-        packet->header.length = len;
-        packet->header.id = ntohl (packet->header.id);
-        c->canRead (packet, c->user_data);
+        packet = ccnet_packet_from_frame (frame, &len);
+        c->canRead (packet, len, c->user_data);
 
         /* PacketIO may be scheduled to free in the previous call */
         if (c->schedule_free) {
@@ -90,7 +173,13 @@ canReadWrapper (struct bufferevent *e, void *user_data)
             return;
         }
 
-        evbuffer_drain (e->input, len + CCNET_PACKET_LENGTH_HEADER);
+        evbuffer_drain (e->input, len + hlen);
+
+        if (c->watermark_raised) {
+            bufferevent_setwatermark (e, EV_READ, CCNET_PACKET_LENGTH_HEADER,
+                                      CCNET_RDBUF);
+            c->watermark_raised = 0;
+        }
 
         if(EVBUFFER_LENGTH(e->input) >= CCNET_PACKET_LENGTH_HEADER)
             continue;
@@ -99,6 +188,18 @@ canReadWrapper (struct bufferevent *e, void *user_data)
     }
 
     c->handling = 0;
+    return;
+
+bad_packet:
+    ccnet_warning ("Received a too large packet (%u bytes), "
+                   "close the connection\n", len);
+    if (c->gotError)
+        c->gotError (e, EVBUFFER_READ | EVBUFFER_ERROR, c->user_data);
+    c->handling = 0;
+    if (c->schedule_free) {
+        c->schedule_free = 0;
+        ccnet_packet_io_free (c);
+    }
 }
 
 static void
@@ -109,9 +210,6 @@ gotErrorWrapper (struct bufferevent *e, short what, void *user_data)
         c->gotError (e, what, c->user_data);
 }
 
-
-void bufferevent_setwatermark(struct bufferevent *, short, size_t, size_t);
-
 static CcnetPacketIO*
 ccnet_packet_io_new (struct CcnetSession     *session,
                      const struct sockaddr_storage *addr,
@@ -125,6 +223,7 @@ ccnet_packet_io_new (struct CcnetSession     *session,
     io->session = session;
     io->socket = socket;
     io->is_incoming = is_incoming;
+    io->proto_version = CCNET_PROTO_VERSION_1;
     if (addr) {
         io->addr = g_malloc(sizeof(struct sockaddr_storage));
         memcpy (io->addr, addr, sizeof(struct sockaddr_storage));
@@ -21,7 +21,9 @@ struct bufferevent;
 struct CcnetSession;
 struct ccnet_packet;
 
-typedef void (*ccnet_can_read_cb)(struct ccnet_packet *, void* user_data);
+/* @len is the payload length; it can exceed 65535 for v2 packets */
+typedef void (*ccnet_can_read_cb)(struct ccnet_packet *, uint32_t len,
+                                  void* user_data);
 typedef void (*ccnet_did_write_cb)(struct bufferevent *, void *);
 typedef void (*ccnet_net_error_cb)(struct bufferevent *, short what, void *);
 
@@ -32,9 +34,13 @@ struct CcnetPacketIO
     unsigned int          is_incoming : 1;
     unsigned int          handling : 1;      /* handling event from this IO */
     unsigned int          schedule_free : 1;
+    unsigned int          watermark_raised : 1;
  
     int                   timeout;
 
+    /* negotiated protocol version, see packet.h */
+    int                   proto_version;
+
     struct sockaddr      *addr;
     evutil_socket_t       socket;
 
@@ -75,6 +81,8 @@ void  ccnet_packet_io_set_timeout_secs (CcnetPacketIO *io, int secs);
 
 void  ccnet_packet_io_write_packet (CcnetPacketIO *io, ccnet_packet *packet);
 
+ccnet_packet *ccnet_packet_from_frame (char *frame, uint32_t *len);
+
 void  ccnet_packet_io_set_iofuncs (CcnetPacketIO *io,
                                    ccnet_can_read_cb  readcb,
                                    ccnet_did_write_cb writecb,
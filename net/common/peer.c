@@ -4,6 +4,7 @@
 
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <event2/event.h>
+#include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/bufferevent_compat.h>
 #include <event2/bufferevent_struct.h>
@@ -36,6 +37,7 @@
 #include "perm-mgr.h"
 #include "processor.h"
 #include "proc-factory.h"
+#include "service-table.h"
 #include "processors/service-proxy-proc.h"
 #include "connect-mgr.h"
 
@@ -44,6 +46,10 @@
 #define DEBUG_FLAG  CCNET_DEBUG_PEER
 #include "log.h"
 
+/* request lines longer than this are split in a heap copy */
+#define REQUEST_LINE_MAX  1024
+#define MAX_REQUEST_ARGS  10
+
 
 enum {
     DOWN_SIG,                   /* connection down */
@@ -83,6 +89,10 @@ ccnet_peer_finalize (GObject *object)
     g_free (peer->service_url);
     g_hash_table_unref (peer->processors);
     g_free (peer->session_key);
+    ccnet_cipher_free (peer->cipher);
+    g_free (peer->dec_buf);
+    g_free (peer->ticket);
+    g_free (peer->ticket_secret);
     evbuffer_free (peer->packet);
 
     if (peer->pubkey)
@@ -350,7 +360,8 @@ void ccnet_peer_set_pubkey (CcnetPeer *peer, char *str)
 }
 
 int
-ccnet_peer_prepare_channel_encryption (CcnetPeer *peer)
+ccnet_peer_prepare_channel_encryption (CcnetPeer *peer, int suite,
+                                       gboolean initiator)
 {
     if (!peer->session_key)
         return -1;
@@ -359,10 +370,53 @@ ccnet_peer_prepare_channel_encryption (CcnetPeer *peer)
                                peer->key, peer->iv) < 0)
         return -1;
 
+    ccnet_cipher_free (peer->cipher);
+    peer->cipher = ccnet_cipher_new (suite, peer->key, peer->iv, initiator);
+    if (!peer->cipher)
+        return -1;
+
     peer->encrypt_channel = 1;
     return 0;
 }
 
+void
+ccnet_peer_set_ticket (CcnetPeer *peer, const unsigned char *ticket,
+                       int ticket_len, int lifetime)
+{
+    g_return_if_fail (peer->session_key != NULL);
+
+    ccnet_peer_clear_ticket (peer);
+    peer->ticket = g_memdup (ticket, ticket_len);
+    peer->ticket_len = ticket_len;
+    peer->ticket_secret = g_strdup (peer->session_key);
+    peer->ticket_expire = time(NULL) + lifetime;
+}
+
+gboolean
+ccnet_peer_has_valid_ticket (CcnetPeer *peer)
+{
+    if (!peer->ticket)
+        return FALSE;
+
+    if (peer->ticket_expire <= time(NULL)) {
+        ccnet_peer_clear_ticket (peer);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+ccnet_peer_clear_ticket (CcnetPeer *peer)
+{
+    g_free (peer->ticket);
+    peer->ticket = NULL;
+    peer->ticket_len = 0;
+    g_free (peer->ticket_secret);
+    peer->ticket_secret = NULL;
+    peer->ticket_expire = 0;
+}
+
 /* -------- role management -------- */
 
 void
@@ -371,6 +425,7 @@ ccnet_peer_add_role (CcnetPeer *peer, const char *role)
     if (!ccnet_peer_has_role(peer, role)) {
         peer->role_list = string_list_append_sorted (
             peer->role_list, role);
+        peer->perm_epoch = 0;
     }
 }
 
@@ -383,6 +438,7 @@ ccnet_peer_remove_role (CcnetPeer *peer, const char *role)
         return;
 
     peer->role_list = string_list_remove (peer->role_list, role);
+    peer->perm_epoch = 0;
 }
 
 gboolean
@@ -403,6 +459,7 @@ ccnet_peer_set_roles (CcnetPeer *peer, const char *roles)
     GList *role_list = string_list_parse_sorted (roles, ",");
     string_list_free (peer->role_list);
     peer->role_list = role_list;
+    peer->perm_epoch = 0;
 }
 
 void
@@ -458,6 +515,14 @@ _peer_shutdown (CcnetPeer *peer)
     peer->encrypt_channel = 0;
     g_free (peer->session_key);
     peer->session_key = NULL;
+    ccnet_cipher_free (peer->cipher);
+    peer->cipher = NULL;
+    g_free (peer->dec_buf);
+    peer->dec_buf = NULL;
+    peer->dec_buf_size = 0;
+    peer->resuming = 0;
+    peer->skey_deferred = 0;
+    peer->x25519_kx = 0;
 
     ccnet_debug ("Shutdown all processors for peer %s\n", peer->name);
     shutdown_processors (peer);
@@ -522,25 +587,24 @@ create_remote_processor (CcnetPeer *peer, CcnetPeer *remote_peer,
 }
 
 static void
-create_local_processor (CcnetPeer *peer, int req_id, int argc, char **argv)
+create_local_processor (CcnetPeer *peer, int req_id, int argc, char **argv,
+                        CcnetServiceDesc *desc)
 {
-    CcnetProcessor *processor;
+    CcnetProcessor *processor = NULL;
     CcnetProcFactory *factory = peer->manager->session->proc_factory;
 
-    processor = ccnet_proc_factory_create_slave_processor (
-        factory, argv[0], peer, req_id);
+    if (desc)
+        processor = ccnet_proc_factory_create_service_processor (
+            factory, desc, peer, req_id);
 
     if (processor) {
         ccnet_processor_start (processor, argc-1, argv+1);
     } else {
-        CcnetService *service;
-
-        service = ccnet_session_get_service (peer->manager->session, argv[0]);
-        if (service != NULL) {
+        if (desc && desc->provider) {
             processor = ccnet_proc_factory_create_slave_processor (
                 factory, "service-proxy", peer, req_id);
             ccnet_processor_start (processor, 0, NULL);
-            ccnet_service_proxy_invoke_local (processor, service->provider,
+            ccnet_service_proxy_invoke_local (processor, desc->provider,
                                               argc, argv);
         } else {
             ccnet_peer_send_response (peer, req_id, SC_UNKNOWN_SERVICE,
@@ -553,7 +617,7 @@ create_local_processor (CcnetPeer *peer, int req_id, int argc, char **argv)
 }
 
 static void create_processor (CcnetPeer *peer, int req_id,
-                             int argc, char **argv)
+                             int argc, char **argv, CcnetServiceDesc *desc)
 {
     CcnetSession *session = peer->manager->session;
 
@@ -579,7 +643,9 @@ static void create_processor (CcnetPeer *peer, int req_id,
          * local host. Translate this call into a local one.
          */
         if (session->myself == remote_peer) {
-            create_local_processor (peer, req_id, argc-2, argv+2);
+            desc = argc > 2 ? ccnet_service_table_lookup (
+                session->service_table, argv[2]) : NULL;
+            create_local_processor (peer, req_id, argc-2, argv+2, desc);
             g_object_unref (remote_peer);
             return;
         }
@@ -589,36 +655,59 @@ static void create_processor (CcnetPeer *peer, int req_id,
         return;
     }
 
-    create_local_processor (peer, req_id, argc, argv);
+    create_local_processor (peer, req_id, argc, argv, desc);
+}
+
+/* Split a request line in place like g_strsplit_set (line, " \t", 10),
+ * the last argument keeps the rest of the line. */
+static int
+split_request (char *line, char **argv)
+{
+    char *p;
+    int argc = 0;
+
+    argv[argc++] = line;
+    for (p = line; *p && argc < MAX_REQUEST_ARGS; ++p) {
+        if (*p == ' ' || *p == '\t') {
+            *p = '\0';
+            argv[argc++] = p + 1;
+        }
+    }
+    argv[argc] = NULL;
+
+    return argc;
 }
 
 static void
 handle_request (CcnetPeer *peer, int req_id, char *data, int len)
 {
+    CcnetSession *session = peer->manager->session;
+    CcnetServiceDesc *desc;
+    char buf[REQUEST_LINE_MAX];
     char *msg;
-    gchar **commands;
-    gchar **pcmd;
+    char *commands[MAX_REQUEST_ARGS + 1];
     int  i, perm;
 
-    /* TODO: remove string copy */
     if (len < 1)
         return;
-    msg = g_malloc (len+1);
+
+    /* The line is not nul terminated and the packet buffer has no room
+     * for it, so it is split in a copy, on the stack for usual sizes. */
+    msg = len < sizeof(buf) ? buf : g_malloc (len+1);
     memcpy (msg, data, len);
     msg[len] = '\0';
 
-    commands = g_strsplit_set (msg, " \t", 10);
-    for (i=0, pcmd = commands; *pcmd; pcmd++)
-        i++;
-    if (i <= 0) return;
-    g_free (msg);
+    i = split_request (msg, commands);
+
+    /* the only service name lookup of this request */
+    desc = ccnet_service_table_lookup (session->service_table, commands[0]);
 
     /* permission checking */
     if (!peer->is_local) {
-        perm = ccnet_perm_manager_check_permission(peer->manager->session->perm_mgr,
-                                                   peer, commands[0],
-                                                   req_id,
-                                                   i, commands);
+        perm = ccnet_perm_manager_check_service_permission(session->perm_mgr,
+                                                           peer, desc,
+                                                           req_id,
+                                                           i, commands);
         if (perm == PERM_CHECK_ERROR) {
             ccnet_peer_send_response (peer, req_id, SC_PERM_ERR, SS_PERM_ERR,
                                       NULL, 0);
@@ -642,10 +731,11 @@ handle_request (CcnetPeer *peer, int req_id, char *data, int len)
         goto ret;
     }
 
-    create_processor (peer, req_id, i, commands);
+    create_processor (peer, req_id, i, commands, desc);
 
 ret:
-    g_strfreev (commands);
+    if (msg != buf)
+        g_free (msg);
 }
 
 static void
@@ -786,20 +876,17 @@ error:
 
 
 static void
-handle_packet (ccnet_packet *packet, CcnetPeer *peer)
+handle_packet (ccnet_packet *packet, uint32_t len, CcnetPeer *peer)
 {
     switch (packet->header.type) {
     case CCNET_MSG_REQUEST:
-        handle_request (peer, packet->header.id, 
-                       packet->data, packet->header.length);
+        handle_request (peer, packet->header.id, packet->data, len);
         break;
     case CCNET_MSG_RESPONSE:
-        handle_response (peer, packet->header.id, 
-                        packet->data, packet->header.length);
+        handle_response (peer, packet->header.id, packet->data, len);
         break;
     case CCNET_MSG_UPDATE:
-        handle_update (peer, packet->header.id, 
-                      packet->data, packet->header.length);
+        handle_update (peer, packet->header.id, packet->data, len);
         break;
     default: 
         ccnet_warning ("Unknown header type %d\n", packet->header.type);
@@ -807,7 +894,7 @@ handle_packet (ccnet_packet *packet, CcnetPeer *peer)
 }
 
 static void
-canRead (ccnet_packet *packet, void *vpeer)
+canRead (ccnet_packet *packet, uint32_t len, void *vpeer)
 {
     CcnetPeer *peer = vpeer;
     g_object_ref (peer);
@@ -816,36 +903,64 @@ canRead (ccnet_packet *packet, void *vpeer)
     /*     ccnet_debug ("[RECV] Recieve packat from %s type is %d, id is %d\n", */
     /*                  peer->id, packet->header.type, packet->header.id); */
 
+    if (packet->header.type == CCNET_MSG_HANDSHAKE) {
+        /* Local clients do not go through handshake.c, they announce the
+         * protocol version they speak with a hello packet instead. */
+        if (peer->is_local && packet->header.version >= CCNET_PROTO_VERSION_2)
+            peer->io->proto_version = CCNET_PROTO_VERSION_2;
+        goto out;
+    }
+
     if (packet->header.id == 0)
-        return;
+        goto out;
 
     if (packet->header.type != CCNET_MSG_ENCPACKET) {
-        handle_packet (packet, peer);
+        handle_packet (packet, len, peer);
     } else {
         /* ccnet_debug ("receive an encrypt packet\n"); */
 
-        if (!peer->session_key) {
+        if (!peer->cipher) {
             ccnet_debug("Receive a encrypted packet from %s(%.8s) while "
                         "not having session key \n", peer->name, peer->id);
             goto out;
         }
 
         char *data;
-        int len;
+        int dlen;
+        uint32_t hlen, plen;
         int ret;
-        ret = ccnet_decrypt_with_key (&data, &len, packet->data, packet->header.id,
-                                      peer->key, peer->iv);
-        if (ret < 0)
+
+        /* decrypt into the per-peer scratch buffer */
+        if (peer->dec_buf_size < packet->header.id) {
+            g_free (peer->dec_buf);
+            peer->dec_buf = g_malloc (packet->header.id);
+            peer->dec_buf_size = packet->header.id;
+        }
+        data = peer->dec_buf;
+        ret = ccnet_cipher_decrypt (peer->cipher, data, &dlen,
+                                    packet->data, packet->header.id);
+        if (ret < 0) {
             ccnet_warning ("[SEND] decryption error for peer %s(%.8s) \n",
                            peer->name, peer->id);
-        else {
-            ccnet_packet *new_pac = (ccnet_packet *)data;
-            /* byte order, from network to host */
-            new_pac->header.length = ntohs(new_pac->header.length);
-            new_pac->header.id = ntohl (new_pac->header.id);
+            goto out;
+        }
+
+        ccnet_packet *new_pac = (ccnet_packet *)data;
+        hlen = CCNET_PACKET_LENGTH_HEADER;
+        if (dlen >= hlen && CCNET_HEADER_IS_V2 (&new_pac->header))
+            hlen = CCNET_PACKET_LENGTH_HEADER_V2;
 
-            handle_packet (new_pac, peer);
-            g_free (data);
+        if (dlen < hlen) {
+            ccnet_warning ("Bad encrypted packet from %s(%.8s)\n",
+                           peer->name, peer->id);
+        } else {
+            /* byte order, from network to host */
+            new_pac = ccnet_packet_from_frame (data, &plen);
+            if (hlen + plen > dlen)
+                ccnet_warning ("Bad encrypted packet from %s(%.8s)\n",
+                               peer->name, peer->id);
+            else
+                handle_packet (new_pac, plen, peer);
         }
     }
 
@@ -980,6 +1095,14 @@ ccnet_peer_get_request_id (CcnetPeer *peer)
     return (++peer->reqID);
 }
 
+int
+ccnet_peer_get_max_payload_len (const CcnetPeer *peer)
+{
+    if (peer->io && peer->io->proto_version >= CCNET_PROTO_VERSION_2)
+        return CCNET_PACKET_MAX_PAYLOAD_LEN_V2;
+    return CCNET_PACKET_MAX_PAYLOAD_LEN;
+}
+
 
 #undef DEBUG_FLAG
 /* #define DEBUG_FLAG  CCNET_DEBUG_NETIO */
@@ -1010,9 +1133,29 @@ void
 ccnet_peer_packet_finish (const CcnetPeer *peer)
 {
     ccnet_header *header;
-    header = (ccnet_header *) EVBUFFER_DATA(peer->packet);
-    header->length = htons (EVBUFFER_LENGTH(peer->packet)
-                          - CCNET_PACKET_LENGTH_HEADER);
+    ccnet_header_v2 header_v2;
+    uint32_t len;
+
+    len = EVBUFFER_LENGTH(peer->packet) - CCNET_PACKET_LENGTH_HEADER;
+    header = (ccnet_header *) evbuffer_pullup (peer->packet,
+                                               CCNET_PACKET_LENGTH_HEADER);
+
+    if (len <= CCNET_PACKET_MAX_PAYLOAD_LEN || !peer->io ||
+        peer->io->proto_version < CCNET_PROTO_VERSION_2) {
+        header->length = htons (len);
+        return;
+    }
+
+    /* replace the v1 header with a v2 one */
+    header_v2.version = CCNET_PROTO_VERSION_2;
+    header_v2.type = header->type;
+    header_v2.flags = 0;
+    header_v2.reserved = 0;
+    header_v2.id = header->id;  /* already in network byte order */
+    header_v2.length = htonl (len);
+
+    evbuffer_drain (peer->packet, CCNET_PACKET_LENGTH_HEADER);
+    evbuffer_prepend (peer->packet, &header_v2, sizeof(header_v2));
 }
 
 void
@@ -1029,15 +1172,31 @@ ccnet_peer_packet_send (const CcnetPeer *peer)
             ret = bufferevent_write_buffer (peer->io->bufev, peer->packet);
         } else {
             ccnet_header enc_header;
+            struct evbuffer *output = bufferevent_get_output (peer->io->bufev);
+            struct evbuffer_iovec vec;
             char *data = (char *)EVBUFFER_DATA(peer->packet);
             uint32_t len = EVBUFFER_LENGTH(peer->packet);
-            char *enc_data;
             int enc_len;
-            ret = ccnet_encrypt_with_key (&enc_data, &enc_len, data, len,
-                                          peer->key, peer->iv);
+
+            /* Encrypt straight into the output buffer, behind the
+             * header, instead of going through a temporary buffer. */
+            enc_len = ccnet_cipher_encrypted_len (peer->cipher, len);
+            if (evbuffer_reserve_space (output,
+                                        sizeof(ccnet_header) + enc_len,
+                                        &vec, 1) < 1) {
+                ccnet_warning ("[SEND] failed to reserve output buffer "
+                               "for peer %s(%.8s) \n", peer->name, peer->id);
+                evbuffer_drain (peer->packet, EVBUFFER_LENGTH(peer->packet));
+                return;
+            }
+
+            ret = ccnet_cipher_encrypt (peer->cipher,
+                                        (char *)vec.iov_base + sizeof(ccnet_header),
+                                        &enc_len, data, len);
             if (ret < 0) {
                 ccnet_warning ("[SEND] encryption error for sending packet "
                                "to peer %s(%.8s) \n", peer->name, peer->id);
+                /* the reserved space is simply not committed */
                 evbuffer_drain (peer->packet, EVBUFFER_LENGTH(peer->packet));
                 return;
             }
@@ -1046,9 +1205,9 @@ ccnet_peer_packet_send (const CcnetPeer *peer)
             enc_header.type = CCNET_MSG_ENCPACKET;
             enc_header.length = 0;
             enc_header.id = htonl(enc_len);
-            bufferevent_write (peer->io->bufev, &enc_header, sizeof (enc_header));
-            bufferevent_write (peer->io->bufev, enc_data, enc_len);
-            g_free (enc_data);
+            memcpy (vec.iov_base, &enc_header, sizeof(enc_header));
+            vec.iov_len = sizeof(ccnet_header) + enc_len;
+            ret = evbuffer_commit_space (output, &vec, 1);
             evbuffer_drain (peer->packet, EVBUFFER_LENGTH(peer->packet));
         }
         if (ret < 0)
@@ -1089,7 +1248,7 @@ ccnet_peer_send_response (const CcnetPeer *peer, int req_id,
         return;
     }
 
-    g_return_if_fail (clen < 65536);
+    g_return_if_fail (clen <= ccnet_peer_get_max_payload_len (peer));
 
     ccnet_peer_packet_prepare (peer, CCNET_MSG_RESPONSE, req_id);
 
@@ -46,6 +46,15 @@ struct _CcnetPeer
     char         *session_key;
     unsigned char key[32];
     unsigned char iv[32];
+    struct CcnetCipher *cipher; /* created from key/iv for the channel */
+    char         *dec_buf;      /* scratch space for decrypted packets */
+    int           dec_buf_size;
+
+    /* resumption ticket issued by this peer, kept across reconnects */
+    unsigned char *ticket;
+    int           ticket_len;
+    char         *ticket_secret;
+    time_t        ticket_expire;
 
     char         *name;         /* hostname */
     char         *public_addr;
@@ -66,6 +75,11 @@ struct _CcnetPeer
     GList        *role_list;
     GList        *myrole_list;  /* my role on this peer */
 
+    /* permitted service groups, computed by the perm manager from
+     * role_list; stale when perm_epoch isn't the manager's epoch */
+    guint64       perm_mask;
+    guint         perm_epoch;
+
     char         *intend_role;  /* used in peer resolving */
 
     unsigned int  is_self : 1;
@@ -97,6 +111,10 @@ struct _CcnetPeer
 
     unsigned int  encrypt_channel : 1;
 
+    unsigned int  resuming : 1;       /* a resume request is in progress */
+    unsigned int  skey_deferred : 1;  /* send session key if it fails */
+    unsigned int  x25519_kx : 1;      /* peer has receive-skey3 */
+
     struct CcnetPacketIO  *io;
 
 
@@ -142,6 +160,10 @@ void        ccnet_peer_shutdown_no_delay (CcnetPeer *peer);
 
 int         ccnet_peer_get_request_id (CcnetPeer *peer);
 
+/* Max payload of a single packet to this peer, depends on whether the
+ * peer speaks protocol version 2. */
+int         ccnet_peer_get_max_payload_len (const CcnetPeer *peer);
+
 void        ccnet_peer_add_processor (CcnetPeer *peer, 
                                       CcnetProcessor *processor);
 void        ccnet_peer_remove_processor (CcnetPeer *peer, 
@@ -157,7 +179,18 @@ void        ccnet_peer_update_address (CcnetPeer *peer,
 
 void        ccnet_peer_set_pubkey (CcnetPeer *peer, char *str);
 
-int         ccnet_peer_prepare_channel_encryption (CcnetPeer *peer);
+/* @suite is one of CCNET_CIPHER_*, @initiator is TRUE on the side that
+ * sent the session key. */
+int         ccnet_peer_prepare_channel_encryption (CcnetPeer *peer, int suite,
+                                                   gboolean initiator);
+
+/* Remember a resumption ticket issued by @peer for the current session
+ * key. The ticket is dropped once it expires or a resume fails. */
+void        ccnet_peer_set_ticket (CcnetPeer *peer,
+                                   const unsigned char *ticket,
+                                   int ticket_len, int lifetime);
+gboolean    ccnet_peer_has_valid_ticket (CcnetPeer *peer);
+void        ccnet_peer_clear_ticket (CcnetPeer *peer);
 
 /* role management */
 void
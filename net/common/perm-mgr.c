@@ -6,20 +6,36 @@
 #include "session.h"
 #include "peer-mgr.h"
 #include "perm-mgr.h"
+#include "service-table.h"
 
 #define DEBUG_FLAG CCNET_DEBUG_OTHER
 #include "log.h"
 
-/* Give an user and a service, for each role of this user:
-      1. find the service group,
-      2. use hash table 'role2groups' to find the permitted groups to this role,
-      3. check whether the given group in the list of groups.
-*/
+/* Service groups and roles are interned to small ids. Each role maps
+ * to a bitmask of the groups it is permitted, and each peer caches the
+ * union of the masks of its roles in peer->perm_mask, so checking a
+ * request is a single AND.
+ *
+ * The peer mask is tagged with the epoch it was computed in. Changing
+ * the roles of a peer resets its epoch and changing the role table
+ * bumps the manager epoch; either makes the next check recompute it.
+ */
+
+#define MAX_PERM_GROUPS 64
+
+/* reserved group ids, checked before the role masks */
+enum {
+    GROUP_NONE = 0,
+    GROUP_BASIC,
+    GROUP_INNER,
+    GROUP_SELF,
+};
 
 struct _CcnetPermManagerPriv {
-    GHashTable   *serv2group;       /* service to group map */
-    GHashTable   *role2groups;      /* role -> list of groups */
-    GList        *anonymous_groups; /* permitted groups to anonymous user. */
+    GHashTable   *group_ids;        /* group -> id */
+    int           n_groups;
+    GHashTable   *role_masks;       /* role -> guint64 mask of groups */
+    guint         epoch;            /* bumped when role_masks changes */
 };
 
 struct ServiceGroup {
@@ -35,6 +51,9 @@ struct ServiceGroup service_groups[] = {
     { "keepalive2",                     "basic" },
     { "receive-session-key",            "basic" },
     { "receive-skey2",                  "basic" },
+    { "receive-skey3",                  "basic" },
+    { "receive-ticket",                 "basic" },
+    { "receive-resume",                 "basic" },
     { "receive-msg",                    "basic" },
     { "echo",                           "basic" },
     { "ccnet-rpcserver",                "rpc-inner" },
@@ -51,10 +70,6 @@ struct RolePerm {
     const char *group;
 };
 
-typedef struct RolePermList {
-    GList *list;
-} RolePermList;
-
 struct RolePerm role_perms[] = {
     { "MyClient", "seafserv" },
     { "MyClient", "relay-service" },
@@ -64,14 +79,52 @@ struct RolePerm role_perms[] = {
     { NULL, NULL },
 };
 
+static int
+intern_group (CcnetPermManager *mgr, const char *group)
+{
+    CcnetPermManagerPriv *priv = mgr->priv;
+    int id;
+
+    id = GPOINTER_TO_INT (g_hash_table_lookup (priv->group_ids, group));
+    if (id)
+        return id;
+
+    if (priv->n_groups >= MAX_PERM_GROUPS) {
+        ccnet_warning ("[perm-mgr] too many service groups, %s is "
+                       "only open to local peers\n", group);
+        return GROUP_NONE;
+    }
+
+    id = priv->n_groups++;
+    g_hash_table_insert (priv->group_ids, g_strdup(group),
+                         GINT_TO_POINTER(id));
+    return id;
+}
+
+static inline guint64
+group_bit (int id)
+{
+    return (guint64)1 << id;
+}
+
 CcnetPermManager *
 ccnet_perm_manager_new (CcnetSession *session)
 {
     CcnetPermManager *mgr = g_new0 (CcnetPermManager, 1);
     mgr->priv = g_new0 (CcnetPermManagerPriv, 1);
     mgr->session = session;
-    mgr->priv->serv2group = g_hash_table_new (g_str_hash, g_str_equal);
-    mgr->priv->role2groups = g_hash_table_new (g_str_hash, g_str_equal);
+    mgr->priv->group_ids = g_hash_table_new (g_str_hash, g_str_equal);
+    mgr->priv->role_masks = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, g_free);
+    /* a zeroed peer has epoch 0, which is never current */
+    mgr->priv->epoch = 1;
+
+    /* id 0 is GROUP_NONE */
+    mgr->priv->n_groups = 1;
+    intern_group (mgr, "basic");
+    intern_group (mgr, "inner");
+    intern_group (mgr, "self");
+
     return mgr;
 }
 
@@ -87,45 +140,64 @@ ccnet_perm_manager_prepare (CcnetPermManager *mgr)
 static void
 populate_default_items (CcnetPermManager *mgr)
 {
+    CcnetServiceTable *table = mgr->session->service_table;
     struct ServiceGroup *sg;
     for (sg = service_groups; sg->service; sg++) {
-        g_hash_table_insert (mgr->priv->serv2group, g_strdup(sg->service),
-                             g_strdup(sg->group));
+        CcnetServiceDesc *desc = ccnet_service_table_intern (table,
+                                                             sg->service);
+        if (!desc->perm_group)
+            desc->perm_group = intern_group (mgr, sg->group);
     }
 
     struct RolePerm *rp;
     for (rp = role_perms; rp->role; rp++) {
-        RolePermList *list;
-        list = g_hash_table_lookup (mgr->priv->role2groups, rp->role);
-        if (!list) {
-            list = g_new0(RolePermList, 1);
-            g_hash_table_insert (mgr->priv->role2groups, g_strdup(rp->role),
-                                 list);
+        guint64 *mask;
+        int id;
+
+        id = intern_group (mgr, rp->group);
+        if (id == GROUP_NONE)
+            continue;
+
+        mask = g_hash_table_lookup (mgr->priv->role_masks, rp->role);
+        if (!mask) {
+            mask = g_new0 (guint64, 1);
+            g_hash_table_insert (mgr->priv->role_masks, g_strdup(rp->role),
+                                 mask);
         }
-        list->list = g_list_prepend (list->list, g_strdup(rp->group));
+        *mask |= group_bit (id);
     }
+    mgr->priv->epoch++;
 }
 
-static inline const char *
-get_service_group(CcnetPermManager *mgr, const char *service)
+static guint64
+role_mask (CcnetPermManager *mgr, const char *role)
+{
+    guint64 *mask = g_hash_table_lookup (mgr->priv->role_masks, role);
+    return mask ? *mask : 0;
+}
+
+static void
+update_peer_mask (CcnetPermManager *mgr, CcnetPeer *peer)
 {
-    return g_hash_table_lookup (mgr->priv->serv2group, service);
+    GList *ptr;
+
+    peer->perm_mask = 0;
+    for (ptr = peer->role_list; ptr; ptr = ptr->next)
+        peer->perm_mask |= role_mask (mgr, ptr->data);
+    peer->perm_epoch = mgr->priv->epoch;
 }
 
 int
 check_role_permission(CcnetPermManager *mgr, const char *role, const char *group)
 {
-    RolePermList *rplist;
-    GList *ptr;
+    int id;
 
-    rplist = g_hash_table_lookup (mgr->priv->role2groups, role);
-    if (!rplist)
+    id = GPOINTER_TO_INT (g_hash_table_lookup (mgr->priv->group_ids, group));
+    if (id == GROUP_NONE)
         return PERM_CHECK_ERROR;
 
-    for (ptr = rplist->list; ptr; ptr = ptr->next) {
-        if (strcmp(ptr->data, group) == 0)
-            return PERM_CHECK_OK;
-    }
+    if (role_mask (mgr, role) & group_bit (id))
+        return PERM_CHECK_OK;
     return PERM_CHECK_ERROR;
 }
 
@@ -144,20 +216,36 @@ ccnet_perm_manager_check_permission (CcnetPermManager *mgr,
                                      int req_id,
                                      int argc, char **argv)
 {
-    const char *group = get_service_group (mgr, req);
-    if (!group)
-        return PERM_CHECK_NOSERVICE;
+    CcnetServiceDesc *desc;
+
+    desc = ccnet_service_table_lookup (mgr->session->service_table, req);
+    return ccnet_perm_manager_check_service_permission (mgr, peer, desc,
+                                                        req_id, argc, argv);
+}
+
+int
+ccnet_perm_manager_check_service_permission (CcnetPermManager *mgr,
+                                             CcnetPeer *peer,
+                                             CcnetServiceDesc *desc,
+                                             int req_id,
+                                             int argc, char **argv)
+{
+    int group = desc ? desc->perm_group : GROUP_NONE;
 
-    if (g_strcmp0(group, "basic") == 0)
+    switch (group) {
+    case GROUP_NONE:
+        return PERM_CHECK_NOSERVICE;
+    case GROUP_BASIC:
         return PERM_CHECK_OK;
+    }
 
     if (peer->is_local)
         return PERM_CHECK_OK;
 
-    if (g_strcmp0(group, "inner") == 0)
+    if (group == GROUP_INNER)
         return PERM_CHECK_ERROR;
 
-    if (g_strcmp0 (group, "self") == 0) {
+    if (group == GROUP_SELF) {
         if (g_strcmp0 (peer->id, mgr->session->base.id) == 0)
             /* myself user */
             return PERM_CHECK_OK;
@@ -165,12 +253,11 @@ ccnet_perm_manager_check_permission (CcnetPermManager *mgr,
             return PERM_CHECK_ERROR;
     }
 
-    GList *ptr;
-    for (ptr = peer->role_list; ptr; ptr = ptr->next) {
-        if (check_role_permission(mgr, ptr->data, group) == PERM_CHECK_OK)
-            return PERM_CHECK_OK;
-    }
+    if (peer->perm_epoch != mgr->priv->epoch)
+        update_peer_mask (mgr, peer);
 
+    if (peer->perm_mask & group_bit (group))
+        return PERM_CHECK_OK;
     return PERM_CHECK_ERROR;
 }
 
@@ -180,11 +267,19 @@ ccnet_perm_manager_register_service (CcnetPermManager *mgr,
                                      const char *group,
                                      CcnetPeer *peer)
 {
-    if (g_hash_table_lookup (mgr->priv->serv2group, service))
+    CcnetServiceDesc *desc;
+
+    int id;
+
+    desc = ccnet_service_table_intern (mgr->session->service_table, service);
+    if (desc->perm_group)
+        return -1;
+
+    id = intern_group (mgr, group);
+    if (id == GROUP_NONE)
         return -1;
 
     ccnet_debug ("[perm-mgr] register service %s %s\n", service, group);
-    g_hash_table_insert (mgr->priv->serv2group, g_strdup(service),
-                         g_strdup(group));
+    desc->perm_group = id;
     return 0;
 }
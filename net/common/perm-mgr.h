@@ -13,6 +13,8 @@ enum {
     PERM_CHECK_NOSERVICE = 2,
 };
 
+struct CcnetServiceDesc;
+
 typedef struct _CcnetPermManager CcnetPermManager;
 typedef struct _CcnetPermManagerPriv CcnetPermManagerPriv;
 
@@ -35,6 +37,14 @@ ccnet_perm_manager_check_permission (CcnetPermManager *mgr,
                                      int req_id,
                                      int argc, char **argv);
 
+/* Same as above, for a service already looked up, @desc may be NULL. */
+int
+ccnet_perm_manager_check_service_permission (CcnetPermManager *mgr,
+                                             CcnetPeer *peer,
+                                             struct CcnetServiceDesc *desc,
+                                             int req_id,
+                                             int argc, char **argv);
+
 int
 ccnet_perm_manager_check_role_permission(CcnetPermManager *mgr,
                                          const char *role,
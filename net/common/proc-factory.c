@@ -8,6 +8,7 @@
 #include "session.h"
 
 #include "processor.h"
+#include "service-table.h"
 #include "proc-factory.h"
 #include "peer-mgr.h"
 #include "timer.h"
@@ -19,6 +20,12 @@
 #include "processors/recvsessionkey-proc.h"
 #include "processors/sendsessionkey-v2-proc.h"
 #include "processors/recvsessionkey-v2-proc.h"
+#include "processors/sendsessionkey-v3-proc.h"
+#include "processors/recvsessionkey-v3-proc.h"
+#include "processors/sendticket-proc.h"
+#include "processors/recvticket-proc.h"
+#include "processors/sendresume-proc.h"
+#include "processors/recvresume-proc.h"
 
 
 #define DEBUG_FLAG  CCNET_DEBUG_PROCESSOR
@@ -40,8 +47,13 @@
 #define CONNECTION_TIMEOUT           182
 #define MAX_PROCS_KEEPALIVE          5    /* we check 5 proc for each peer at most */
 
+/* done processors kept for reuse, per type */
+#define PROC_POOL_MAX                128
+
+/* Processor types are kept in the service descriptors of the session
+ * service table. */
 typedef struct {
-    GHashTable *proc_type_table;
+    GHashTable *proc_pool;      /* GType -> GQueue of processors */
 } CcnetProcFactoryPriv;
 
 #define GET_PRIV(o)  \
@@ -60,8 +72,7 @@ ccnet_proc_factory_init (CcnetProcFactory *factory)
 {
     CcnetProcFactoryPriv *priv = GET_PRIV (factory);
 
-    priv->proc_type_table = g_hash_table_new_full (
-        g_str_hash, g_str_equal, g_free, NULL);
+    priv->proc_pool = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 void
@@ -69,14 +80,15 @@ ccnet_proc_factory_register_processor (CcnetProcFactory *factory,
                                        const char *serv_name,
                                        GType type)
 {
-    CcnetProcFactoryPriv *priv = GET_PRIV (factory);
+    CcnetServiceDesc *desc;
 
     CcnetProcessorClass *proc_class = 
         (CcnetProcessorClass *)g_type_class_ref(type);
     g_type_class_unref (proc_class);
 
-    g_hash_table_insert (priv->proc_type_table, g_strdup (serv_name), 
-                         (gpointer) type);
+    desc = ccnet_service_table_intern (factory->session->service_table,
+                                       serv_name);
+    desc->proc_type = type;
 }
 
 
@@ -142,6 +154,19 @@ ccnet_proc_factory_new (CcnetSession *session)
                                            ccnet_sendskey2_proc_get_type());
     ccnet_proc_factory_register_processor (factory, "receive-skey2",
                                            ccnet_recvskey2_proc_get_type ());
+    ccnet_proc_factory_register_processor (factory, "send-skey3",
+                                           ccnet_sendskey3_proc_get_type());
+    ccnet_proc_factory_register_processor (factory, "receive-skey3",
+                                           ccnet_recvskey3_proc_get_type ());
+
+    ccnet_proc_factory_register_processor (factory, "send-ticket",
+                                           ccnet_sendticket_proc_get_type());
+    ccnet_proc_factory_register_processor (factory, "receive-ticket",
+                                           ccnet_recvticket_proc_get_type ());
+    ccnet_proc_factory_register_processor (factory, "send-resume",
+                                           ccnet_sendresume_proc_get_type());
+    ccnet_proc_factory_register_processor (factory, "receive-resume",
+                                           ccnet_recvresume_proc_get_type ());
 
     ccnet_proc_factory_register_processor (factory, "mq-server",
                                            ccnet_mqserver_proc_get_type ());
@@ -183,27 +208,72 @@ ccnet_proc_factory_start (CcnetProcFactory *factory)
 static GType
 ccnet_proc_factory_get_proc_type (CcnetProcFactory *factory,
                                   const char *serv_name)
+{
+    CcnetServiceDesc *desc;
+
+    desc = ccnet_service_table_lookup (factory->session->service_table,
+                                       serv_name);
+    return desc ? desc->proc_type : 0;
+}
+
+static CcnetProcessor *
+new_processor (CcnetProcFactory *factory, GType type)
 {
     CcnetProcFactoryPriv *priv = GET_PRIV (factory);
+    GQueue *pool;
 
-    return (GType) g_hash_table_lookup (priv->proc_type_table, serv_name);
+    pool = g_hash_table_lookup (priv->proc_pool, (gpointer) type);
+    if (pool && !g_queue_is_empty (pool)) {
+        factory->pool_hits++;
+        factory->procs_pooled--;
+        return g_queue_pop_head (pool);
+    }
+
+    if (CCNET_PROCESSOR_CLASS (g_type_class_peek (type))->reset)
+        factory->pool_misses++;
+    return g_object_new (type, NULL);
+}
+
+/* Keep a released processor for reuse, returns FALSE if it can't be. */
+static gboolean
+pool_processor (CcnetProcFactory *factory, CcnetProcessor *processor)
+{
+    CcnetProcFactoryPriv *priv = GET_PRIV (factory);
+    GType type = G_OBJECT_TYPE (processor);
+    GQueue *pool;
+
+    /* still referenced somewhere else */
+    if (!CCNET_PROCESSOR_GET_CLASS (processor)->reset ||
+        G_OBJECT (processor)->ref_count != 1)
+        return FALSE;
+
+    pool = g_hash_table_lookup (priv->proc_pool, (gpointer) type);
+    if (!pool) {
+        pool = g_queue_new ();
+        g_hash_table_insert (priv->proc_pool, (gpointer) type, pool);
+    }
+    if (g_queue_get_length (pool) >= PROC_POOL_MAX)
+        return FALSE;
+
+    /* like dispose, the "done" handlers belong to this use only */
+    g_signal_handlers_destroy (processor);
+    ccnet_processor_reset (processor);
+
+    g_queue_push_head (pool, processor);
+    factory->procs_pooled++;
+    return TRUE;
 }
 
 static inline CcnetProcessor *
-create_processor_common (CcnetProcFactory *factory,
-                         const char *serv_name,
-                         CcnetPeer *peer,
-                         int req_id)
+create_processor_of_type (CcnetProcFactory *factory,
+                          GType type,
+                          const char *serv_name,
+                          CcnetPeer *peer,
+                          int req_id)
 {
-    GType type;
     CcnetProcessor *processor;
 
-    type = ccnet_proc_factory_get_proc_type (factory, serv_name);
-    if (type == 0) {
-        return NULL;
-    }
-
-    processor = g_object_new (type, NULL);
+    processor = new_processor (factory, type);
     processor->peer = peer;
     g_object_ref (peer);
     processor->session = factory->session;
@@ -223,6 +293,35 @@ create_processor_common (CcnetProcFactory *factory,
     return processor;
 }
 
+static inline CcnetProcessor *
+create_processor_common (CcnetProcFactory *factory,
+                         const char *serv_name,
+                         CcnetPeer *peer,
+                         int req_id)
+{
+    GType type;
+
+    type = ccnet_proc_factory_get_proc_type (factory, serv_name);
+    if (type == 0) {
+        return NULL;
+    }
+
+    return create_processor_of_type (factory, type, serv_name, peer, req_id);
+}
+
+CcnetProcessor *
+ccnet_proc_factory_create_service_processor (CcnetProcFactory *factory,
+                                             CcnetServiceDesc *desc,
+                                             CcnetPeer *peer,
+                                             int req_id)
+{
+    if (desc->proc_type == 0)
+        return NULL;
+
+    return create_processor_of_type (factory, desc->proc_type, desc->name,
+                                     peer, SLAVE_ID (req_id));
+}
+
 CcnetProcessor *
 ccnet_proc_factory_create_slave_processor (CcnetProcFactory *factory,
                                            const char *serv_name,
@@ -262,8 +361,8 @@ recycle (CcnetProcFactory *factory, CcnetProcessor *processor)
     }
 #endif
 
-    /* TODO: implement processor pool */
-    g_object_unref (processor);
+    if (!pool_processor (factory, processor))
+        g_object_unref (processor);
 }
 
 void
@@ -14,6 +14,8 @@
 #define CCNET_IS_PROC_FACTORY_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_PROC_FACTORY))
 #define CCNET_PROC_FACTORY_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_PROC_FACTORY, CcnetProcFactoryClass))
 
+struct CcnetServiceDesc;
+
 typedef struct _CcnetProcFactory CcnetProcFactory;
 typedef struct _CcnetProcFactoryClass CcnetProcFactoryClass;
 
@@ -26,6 +28,12 @@ struct _CcnetProcFactory
 
     int                   procs_alive_cnt; /*number of processors alive*/
 
+    /* processors reused from the pool, or created although their type
+     * is poolable, and kept in the pool */
+    int                   pool_hits;
+    int                   pool_misses;
+    int                   procs_pooled;
+
     GList                *procs;   /* TODO: need to recyle the space
                                     * when it grows verylarge  */
 
@@ -62,6 +70,12 @@ CcnetProcessor *ccnet_proc_factory_create_slave_processor (
     CcnetProcFactory *factory, const char *serv_name,
     CcnetPeer *peer, int req_id);
 
+/* Slave processor for an already resolved service, NULL if the service
+ * has no processor type. */
+CcnetProcessor *ccnet_proc_factory_create_service_processor (
+    CcnetProcFactory *factory, struct CcnetServiceDesc *desc,
+    CcnetPeer *peer, int req_id);
+
 void ccnet_proc_factory_set_keepalive_timeout (CcnetProcFactory *factory,
                                                int timeout);
 
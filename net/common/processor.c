@@ -141,6 +141,15 @@ ccnet_processor_release_resource(CcnetProcessor *processor)
     CCNET_PROCESSOR_GET_CLASS (processor)->release_resource(processor);
 }
 
+void
+ccnet_processor_reset (CcnetProcessor *processor)
+{
+    memset ((char *)processor + sizeof(GObject), 0,
+            sizeof(CcnetProcessor) - sizeof(GObject));
+
+    CCNET_PROCESSOR_GET_CLASS (processor)->reset (processor);
+}
+
 /*
  * processor->detached is set in two places:
  * 1. ccnet_peer_remove_process(), which is called when one processor is done;
@@ -404,6 +413,17 @@ ccnet_processor_send_response (CcnetProcessor *processor,
                               code, code_msg, content, clen);
 }
 
+int
+ccnet_processor_get_max_response_len (CcnetProcessor *processor)
+{
+    /* Responses to remote peers may be relayed to a v1 local client by a
+     * service proxy on the other side, so only local clients get large
+     * packets. */
+    if (!processor->peer->is_local)
+        return CCNET_PACKET_MAX_PAYLOAD_LEN;
+    return ccnet_peer_get_max_payload_len (processor->peer);
+}
+
 void ccnet_processor_keep_alive (CcnetProcessor *processor)
 {
     if (IS_SLAVE (processor))
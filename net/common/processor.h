@@ -125,6 +125,11 @@ struct _CcnetProcessorClass {
 
     void      (*release_resource) (CcnetProcessor *processor);
 
+    /* Clear the private data after release_resource(), so that the
+     * factory can hand the object out again. Types without it are
+     * not pooled. */
+    void      (*reset)           (CcnetProcessor *processor);
+
 };
 
 GType ccnet_processor_get_type ();
@@ -137,6 +142,9 @@ int ccnet_processor_startl
 
 void ccnet_processor_done (CcnetProcessor *processor, gboolean success);
 
+/* Make a released processor look like a new one, only for pooling. */
+void ccnet_processor_reset (CcnetProcessor *processor);
+
 void ccnet_processor_handle_update (CcnetProcessor *processor, 
                                     char *code, char *code_msg,
                                     char *content, int clen);
@@ -173,6 +181,12 @@ void ccnet_processor_send_response(CcnetProcessor *processor,
                                    const char *code_msg,
                                    const char *content, int clen);
 
+/*
+ * Max payload of a single response packet sent by @processor. It is larger
+ * than CCNET_PACKET_MAX_PAYLOAD_LEN for local clients speaking protocol v2.
+ */
+int ccnet_processor_get_max_response_len (CcnetProcessor *processor);
+
 void ccnet_processor_keep_alive (CcnetProcessor *processor);
 
 /*
@@ -39,6 +39,12 @@ static void echo_shutdown (CcnetProcessor *processor)
     /* Do not chain up here. */
 }
 
+static void
+reset (CcnetProcessor *processor)
+{
+    /* no private data */
+}
+
 static void
 ccnet_echo_proc_class_init (CcnetEchoProcClass *klass)
 {
@@ -49,6 +55,7 @@ ccnet_echo_proc_class_init (CcnetEchoProcClass *klass)
     proc_class->handle_response = handle_response;
     proc_class->shutdown = echo_shutdown;
     proc_class->release_resource = release_resource;
+    proc_class->reset = reset;
 }
 
 static void
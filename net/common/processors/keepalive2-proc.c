@@ -33,6 +33,7 @@ enum {
     INIT,
     WAIT_PUBKEY,
     WAIT_CHALLENGE,
+    WAIT_RESUME,
     WAIT_KEEPALIVE,
     FULL
 };
@@ -55,6 +56,9 @@ enum {
  WAIT_CHALLENGE ----------------->
                <-----------------
 
+   WAIT_RESUME    instead of the challenge when we hold a valid
+   (optional)     ticket from the peer, see send-resume
+
   
                   300  <msg>
  WAIT_KEEPALIVE -----------------> 
@@ -81,10 +85,19 @@ enum {
 #define SC_DECRYPT_ERROR "412"
 #define SS_DECRYPT_ERROR "Decrypt error"
 
+/* key agreement the slave supports, in the content of its OK reply */
+#define KX_X25519 "x25519"
+
 
 typedef struct  {
     unsigned char random_buf[40];
     int count;
+
+    /* the challenge is decrypted in the crypto thread pool */
+    unsigned char *challenge;
+    int challenge_len;
+    unsigned char *answer;
+    int answer_len;
 } CcnetKeepalive2ProcPriv;
 
 extern CcnetSession *session;
@@ -126,7 +139,11 @@ static void proc_shutdown (CcnetProcessor *processor)
 static void
 release_resource(CcnetProcessor *processor)
 {
+    USE_PRIV;
+
     processor->peer->keepalive_sending = 0;
+    g_free (priv->answer);
+    priv->answer = NULL;
     
     /* should always chain up */
     CCNET_PROCESSOR_CLASS(ccnet_keepalive2_proc_parent_class)->release_resource (processor);
@@ -222,8 +239,14 @@ static int keepalive2_start (CcnetProcessor *processor,
     CcnetKeepalive2ProcPriv *priv = GET_PRIV (processor);
 
     if (IS_SLAVE(processor)) {
+#ifdef CCNET_HAVE_X25519
+        /* tell the peer it can use receive-skey3 */
+        ccnet_processor_send_response (processor, SC_OK, SS_OK,
+                                       KX_X25519, sizeof(KX_X25519));
+#else
         ccnet_processor_send_response (processor, 
                                        SC_OK, SS_OK, NULL, 0);
+#endif
         return 0;
     }
 
@@ -331,6 +354,54 @@ static void get_pubkey(CcnetProcessor *processor)
     reset_timeout(processor);
 }
 
+static void on_resume_done (CcnetProcessor *resume_proc,
+                            gboolean success, void *data)
+{
+    CcnetProcessor *processor = data;
+    CcnetPeer *peer = resume_proc->peer;
+
+    if (peer->in_shutdown || processor->state != WAIT_RESUME)
+        return;
+
+    if (success) {
+        ccnet_debug ("[Keepalive] Session with %.8s resumed\n", peer->id);
+        get_peer_pubinfo (peer);
+        send_keepalive (processor);
+        reset_timeout (processor);
+        return;
+    }
+
+    /* the ticket is no good any more, do the full handshake */
+    ccnet_peer_clear_ticket (peer);
+    if (peer->pubkey)
+        send_challenge (processor);
+    else
+        get_pubkey (processor);
+}
+
+static gboolean try_resume(CcnetProcessor *processor)
+{
+    CcnetPeer *peer = processor->peer;
+    CcnetProcFactory *factory = processor->session->proc_factory;
+    CcnetProcessor *p;
+
+    if (peer->session_key || !ccnet_peer_has_valid_ticket (peer))
+        return FALSE;
+
+    p = ccnet_proc_factory_create_master_processor (factory,
+                                                    "send-resume", peer);
+    if (!p)
+        return FALSE;
+
+    processor->state = WAIT_RESUME;
+    reset_timeout (processor);
+    g_signal_connect (p, "done", G_CALLBACK(on_resume_done), processor);
+    /* a failed start ends up in on_resume_done too */
+    ccnet_processor_startl (p, NULL);
+
+    return TRUE;
+}
+
 static void recv_ok(CcnetProcessor *processor, 
                     char *code, char *code_msg,
                     char *content, int clen)
@@ -339,6 +410,15 @@ static void recv_ok(CcnetProcessor *processor,
         close_processor(processor);
         return;
     }
+
+    /* old peers send no content */
+    processor->peer->x25519_kx = (clen > 0 && content[clen-1] == '\0' &&
+                                  strcmp (content, KX_X25519) == 0);
+
+    if (try_resume (processor)) {
+        ccnet_debug ("[Keepalive] Receive ok, resume session\n");
+        return;
+    }
     
     if (processor->peer->pubkey) {
         ccnet_debug ("[Keepalive] Receive ok, send challenge\n");
@@ -414,16 +494,11 @@ static void on_send_skey_done (CcnetProcessor *processor,
 }
 
 static void
-send_session_key (CcnetPeer *peer)
+start_send_skey2 (CcnetPeer *peer)
 {
     CcnetProcessor *processor;
     CcnetProcFactory *factory = peer->manager->session->proc_factory;
 
-    if (peer->session_key) {
-        ccnet_warning ("peer %s already has session key\n", peer->id); 
-        return;
-    }
-
     processor = ccnet_proc_factory_create_master_processor (
         factory, "send-skey2", peer);    
     if (!processor) {
@@ -440,6 +515,48 @@ send_session_key (CcnetPeer *peer)
     }
 }
 
+#ifdef CCNET_HAVE_X25519
+static void on_send_skey3_done (CcnetProcessor *processor,
+                                gboolean success, void *data)
+{
+    CcnetPeer *peer = processor->peer;
+
+    if (!success && !peer->in_shutdown && !peer->session_key) {
+        /* fall back to RSA key transport */
+        start_send_skey2 (peer);
+    }
+}
+#endif
+
+void
+ccnet_keepalive2_send_session_key (CcnetPeer *peer)
+{
+    if (peer->session_key) {
+        ccnet_warning ("peer %s already has session key\n", peer->id); 
+        return;
+    }
+
+#ifdef CCNET_HAVE_X25519
+    /* X25519 costs the receiver no RSA private key operation */
+    if (peer->x25519_kx) {
+        CcnetProcessor *processor;
+        CcnetProcFactory *factory = peer->manager->session->proc_factory;
+
+        processor = ccnet_proc_factory_create_master_processor (
+            factory, "send-skey3", peer);
+        if (processor) {
+            g_signal_connect (processor, "done",
+                              G_CALLBACK(on_send_skey3_done), NULL);
+            ccnet_processor_startl (processor, NULL);
+            return;
+        }
+        ccnet_warning ("create send session key v3 processor failed\n");
+    }
+#endif
+
+    start_send_skey2 (peer);
+}
+
 static void verify_challenge(CcnetProcessor *processor, 
                              char *code, char *code_msg,
                              char *content, int clen)
@@ -458,8 +575,14 @@ static void verify_challenge(CcnetProcessor *processor,
     /* ccnet_peer_manager_notify_peer_role (processor->peer->manager,  */
     /*                                      processor->peer); */
 
-    if (strcmp(session->base.id, processor->peer->id) < 0)
-        send_session_key (processor->peer);
+    if (strcmp(session->base.id, processor->peer->id) < 0) {
+        /* let a pending resume set the key, receive-resume sends it
+         * if the resume fails */
+        if (processor->peer->resuming)
+            processor->peer->skey_deferred = 1;
+        else
+            ccnet_keepalive2_send_session_key (processor->peer);
+    }
         
     send_keepalive (processor);
     reset_timeout (processor);
@@ -570,12 +693,49 @@ static void send_pubkey(CcnetProcessor *processor,
 }
 
 
+static void send_challenge_answer (CcnetProcessor *processor)
+{
+    USE_PRIV;
+
+    if (priv->answer_len < 0) {
+        ccnet_processor_send_response (
+            processor, SC_DECRYPT_ERROR, SS_DECRYPT_ERROR, NULL, 0);
+        ccnet_processor_done(processor, FALSE);
+    } else
+        ccnet_processor_send_response (
+            processor, "311", "", (char *)priv->answer, priv->answer_len);
+    g_free(priv->answer);
+    priv->answer = NULL;
+}
+
+#ifdef CCNET_SERVER
+static void *
+decrypt_challenge_job (void *vprocessor)
+{
+    CcnetProcessor *processor = vprocessor;
+    USE_PRIV;
+
+    priv->answer = private_key_decrypt(processor->session->privkey,
+                                       priv->challenge, priv->challenge_len,
+                                       &priv->answer_len);
+    g_free (priv->challenge);
+    priv->challenge = NULL;
+
+    return vprocessor;
+}
+
+static void
+decrypt_challenge_done (void *vprocessor)
+{
+    send_challenge_answer (vprocessor);
+}
+#endif
+
 static void response_challenge(CcnetProcessor *processor, 
                                char *code, char *code_msg,
                                char *content, int clen)
 {
-    unsigned char *buf;
-    int decrypt_len;
+    USE_PRIV;
 
     if (clen == 0) {
         ccnet_warning("Peer %s(%.8s) send bad format challenge\n",
@@ -585,15 +745,27 @@ static void response_challenge(CcnetProcessor *processor,
         ccnet_processor_done(processor, FALSE);
         return;
     }
-        
-    buf = private_key_decrypt(processor->session->privkey,
-                   (unsigned char *)content, clen, &decrypt_len);
-    if (decrypt_len < 0) {
+
+#ifdef CCNET_SERVER
+    /* Keep the RSA work off the main loop, many peers reconnect at
+     * once after a restart. */
+    if (ccnet_session_crypto_queue_full (processor->session)) {
         ccnet_processor_send_response (
-            processor, SC_DECRYPT_ERROR, SS_DECRYPT_ERROR, NULL, 0);
+            processor, SC_SERVER_BUSY, SS_SERVER_BUSY, NULL, 0);
         ccnet_processor_done(processor, FALSE);
-    } else
-        ccnet_processor_send_response (
-            processor, code, "", (char *)buf, decrypt_len);
-    g_free(buf);
+        return;
+    }
+
+    priv->challenge = g_memdup (content, clen);
+    priv->challenge_len = clen;
+    ccnet_processor_thread_create (processor,
+                                   processor->session->crypto_job_mgr,
+                                   decrypt_challenge_job,
+                                   decrypt_challenge_done,
+                                   processor);
+#else
+    priv->answer = private_key_decrypt(processor->session->privkey,
+                   (unsigned char *)content, clen, &priv->answer_len);
+    send_challenge_answer (processor);
+#endif
 }
@@ -26,4 +26,8 @@ struct _CcnetKeepalive2ProcClass {
 
 GType ccnet_keepalive2_proc_get_type ();
 
+/* Start the session key exchange with @peer, used when it was held
+ * back for a session resume that did not succeed. */
+void ccnet_keepalive2_send_session_key (struct _CcnetPeer *peer);
+
 #endif
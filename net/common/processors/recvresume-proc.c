@@ -0,0 +1,200 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <openssl/rand.h>
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer.h"
+#include "peer-mgr.h"
+#include "log.h"
+#include "utils.h"
+
+#include "keepalive2-proc.h"
+#include "recvresume-proc.h"
+
+#define SC_RESUME "300"
+#define SS_RESUME "resume"
+#define SC_ALREADY_HAS_KEY "301"
+#define SS_ALREADY_HAS_KEY "already has your session key"
+#define SC_BAD_TICKET "400"
+#define SS_BAD_TICKET "bad ticket"
+#define SC_BAD_PROOF "401"
+#define SS_BAD_PROOF "bad proof"
+
+typedef struct  {
+    int suite;                  /* channel cipher suite, -1 for none */
+    char key[41];
+} CcnetRecvresumeProcPriv;
+
+#define GET_PRIV(o)  \
+   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CCNET_TYPE_RECVRESUME_PROC, CcnetRecvresumeProcPriv))
+
+#define USE_PRIV \
+    CcnetRecvresumeProcPriv *priv = GET_PRIV(processor);
+
+
+G_DEFINE_TYPE (CcnetRecvresumeProc, ccnet_recvresume_proc, CCNET_TYPE_PROCESSOR)
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+static void handle_update (CcnetProcessor *processor,
+                           char *code, char *code_msg,
+                           char *content, int clen);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    CcnetPeer *peer = processor->peer;
+
+    /* Resume failed, do the session key exchange we held back in
+     * keepalive2. */
+    if (peer->resuming) {
+        peer->resuming = 0;
+        if (peer->skey_deferred && !peer->session_key && !peer->in_shutdown) {
+            peer->skey_deferred = 0;
+            ccnet_keepalive2_send_session_key (peer);
+        }
+    }
+
+    CCNET_PROCESSOR_CLASS (ccnet_recvresume_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_recvresume_proc_class_init (CcnetRecvresumeProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "receive-resume";
+    proc_class->start = start;
+    proc_class->handle_update = handle_update;
+    proc_class->release_resource = release_resource;
+
+    g_type_class_add_private (klass, sizeof (CcnetRecvresumeProcPriv));
+}
+
+static void
+ccnet_recvresume_proc_init (CcnetRecvresumeProc *processor)
+{
+}
+
+
+static int
+choose_suite (CcnetProcessor *processor, const char *peer_suites)
+{
+    if (strcmp (peer_suites, "none") == 0 ||
+        !ccnet_session_should_encrypt_channel (processor->session))
+        return -1;
+
+    return ccnet_cipher_choose_suite (peer_suites);
+}
+
+/* receive-resume <ticket> <cnonce> <cipher suites>|none */
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    CcnetSession *session = processor->session;
+    unsigned char *ticket, nonce[20];
+    gsize ticket_len;
+    char *secret;
+    char snonce[41], proof[41];
+    GString *buf;
+
+    if (peer->session_key) {
+        ccnet_processor_send_response (processor,
+                                       SC_ALREADY_HAS_KEY, SS_ALREADY_HAS_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    if (argc != 3 || strlen(argv[1]) != 40) {
+        ccnet_processor_send_response (processor, SC_BAD_TICKET, SS_BAD_TICKET,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    session->resume_attempts++;
+
+    ticket = g_base64_decode (argv[0], &ticket_len);
+    secret = ccnet_session_open_ticket (session, peer->id,
+                                        ticket, (int)ticket_len);
+    g_free (ticket);
+    if (!secret || RAND_bytes (nonce, sizeof(nonce)) != 1) {
+        ccnet_debug ("[recv resume] reject ticket from peer %.10s\n", peer->id);
+        g_free (secret);
+        ccnet_processor_send_response (processor, SC_BAD_TICKET, SS_BAD_TICKET,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+    peer->resuming = 1;
+
+    rawdata_to_hex (nonce, snonce, 20);
+    ccnet_session_derive_resumed_key (secret, argv[1], snonce, priv->key);
+    g_free (secret);
+
+    priv->suite = choose_suite (processor, argv[2]);
+    ccnet_session_resume_proof (priv->key, "server finished", proof);
+
+    buf = g_string_new (NULL);
+    g_string_printf (buf, "%s\n%s\n%s", snonce,
+                     priv->suite < 0 ? "none" :
+                     ccnet_cipher_suite_name (priv->suite),
+                     proof);
+    ccnet_processor_send_response (processor, SC_RESUME, SS_RESUME,
+                                   buf->str, buf->len + 1);
+    g_string_free (buf, TRUE);
+
+    return 0;
+}
+
+static void
+handle_update (CcnetProcessor *processor,
+               char *code, char *code_msg,
+               char *content, int clen)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    char proof[41];
+
+    if (strcmp(code, SC_RESUME) != 0) {
+        ccnet_warning ("[recv resume] bad update %s:%s\n", code, code_msg);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    ccnet_session_resume_proof (priv->key, "client finished", proof);
+    if (clen != 41 || content[40] != '\0' || strcmp (proof, content) != 0) {
+        ccnet_warning ("bad resume proof from peer %.10s\n", peer->id);
+        ccnet_processor_send_response (processor, SC_BAD_PROOF, SS_BAD_PROOF,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    if (peer->session_key) {
+        ccnet_processor_send_response (processor,
+                                       SC_ALREADY_HAS_KEY, SS_ALREADY_HAS_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    peer->resuming = 0;
+    peer->skey_deferred = 0;
+    peer->session_key = g_strdup (priv->key);
+    processor->session->resume_hits++;
+
+    /* send the ok reply before switching on encryption */
+    ccnet_processor_send_response (processor, SC_OK, SS_OK, NULL, 0);
+    if (priv->suite >= 0 &&
+        ccnet_peer_prepare_channel_encryption (peer, priv->suite, FALSE) < 0)
+        ccnet_warning ("Error in prepare channel encryption\n");
+
+    ccnet_peer_manager_on_peer_session_key_received (peer->manager, peer);
+    ccnet_processor_done (processor, TRUE);
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_RECVRESUME_PROC_H
+#define CCNET_RECVRESUME_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_RECVRESUME_PROC                  (ccnet_recvresume_proc_get_type ())
+#define CCNET_RECVRESUME_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_RECVRESUME_PROC, CcnetRecvresumeProc))
+#define CCNET_IS_RECVRESUME_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_RECVRESUME_PROC))
+#define CCNET_RECVRESUME_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_RECVRESUME_PROC, CcnetRecvresumeProcClass))
+#define IS_CCNET_RECVRESUME_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_RECVRESUME_PROC))
+#define CCNET_RECVRESUME_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_RECVRESUME_PROC, CcnetRecvresumeProcClass))
+
+typedef struct _CcnetRecvresumeProc CcnetRecvresumeProc;
+typedef struct _CcnetRecvresumeProcClass CcnetRecvresumeProcClass;
+
+struct _CcnetRecvresumeProc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetRecvresumeProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_recvresume_proc_get_type ();
+
+#endif
+
@@ -19,6 +19,20 @@ extern CcnetSession *session;
 #define SC_BAD_KEY "302"
 #define SS_BAD_KEY "bad session key"
 
+typedef struct  {
+    /* RSA decryption runs in the crypto thread pool */
+    char *enc_key;
+    int   enc_len;
+    unsigned char *key_buf;
+    int   key_len;
+} CcnetRecvsessionkeyProcPriv;
+
+#define GET_PRIV(o)  \
+   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CCNET_TYPE_RECVSESSIONKEY_PROC, CcnetRecvsessionkeyProcPriv))
+
+#define USE_PRIV \
+    CcnetRecvsessionkeyProcPriv *priv = GET_PRIV(processor);
+
 G_DEFINE_TYPE (CcnetRecvsessionkeyProc, ccnet_recvsessionkey_proc, CCNET_TYPE_PROCESSOR)
 
 static int start (CcnetProcessor *processor, int argc, char **argv);
@@ -29,6 +43,11 @@ static void handle_update (CcnetProcessor *processor,
 static void
 release_resource(CcnetProcessor *processor)
 {
+    USE_PRIV;
+
+    g_free (priv->key_buf);
+    priv->key_buf = NULL;
+
     CCNET_PROCESSOR_CLASS (ccnet_recvsessionkey_proc_parent_class)->release_resource (processor);
 }
 
@@ -42,6 +61,8 @@ ccnet_recvsessionkey_proc_class_init (CcnetRecvsessionkeyProcClass *klass)
     proc_class->start = start;
     proc_class->handle_update = handle_update;
     proc_class->release_resource = release_resource;
+
+    g_type_class_add_private (klass, sizeof (CcnetRecvsessionkeyProcPriv));
 }
 
 static void
@@ -76,7 +97,7 @@ start (CcnetProcessor *processor, int argc, char **argv)
 }
 
 static unsigned char *
-decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
+decrypt_data (const char *content, int clen, int *len_p)
 {
     RSA *privkey = session->privkey;
     unsigned char *buf;
@@ -84,8 +105,6 @@ decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
     buf = private_key_decrypt(privkey, (unsigned char *)content,
                               clen, len_p);
     if (*len_p <= 0) {
-        ccnet_warning ("failed to decrypt session key from peer %.10s",
-                       peer->id);
         g_free (buf);
         buf = NULL;
     }
@@ -95,34 +114,82 @@ decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
 
 static gboolean
 update_peer_session_key (CcnetPeer *peer,
-                         const char *content,
-                         int clen)
+                         const unsigned char *buf,
+                         int key_len)
 {
-    char *buf;
-    int key_len = 0;
-
     if (peer->session_key) {
         ccnet_warning ("[recv session key] peer %.10s already has a session key",
                        peer->id);
         return FALSE;
     }
 
-    buf = (char *)decrypt_data (peer, content, clen, &key_len);
     if (buf) {
-        peer->session_key = g_strndup(buf, key_len);
-        g_free (buf);
+        peer->session_key = g_strndup((const char *)buf, key_len);
         return TRUE;
     } else {
-        ccnet_warning ("faied to decrypt session key"); 
+        ccnet_warning ("failed to decrypt session key from peer %.10s\n",
+                       peer->id);
         return FALSE;
     }
 }
 
+static void
+on_key_decrypted (CcnetProcessor *processor)
+{
+    USE_PRIV;
+    gboolean ok;
+
+    ok = update_peer_session_key (processor->peer, priv->key_buf,
+                                  priv->key_len);
+    g_free (priv->key_buf);
+    priv->key_buf = NULL;
+
+    if (ok) {
+        ccnet_processor_send_response (processor,
+                                       SC_OK, SS_OK,
+                                       NULL, 0);
+
+        ccnet_peer_manager_on_peer_session_key_received (processor->peer->manager,
+                                                         processor->peer);
+
+        ccnet_processor_done (processor, TRUE);
+    } else {
+        ccnet_processor_send_response (processor,
+                                       SC_BAD_KEY, SS_BAD_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+    }
+}
+
+#ifdef CCNET_SERVER
+static void *
+decrypt_key_job (void *vprocessor)
+{
+    CcnetProcessor *processor = vprocessor;
+    USE_PRIV;
+
+    priv->key_buf = decrypt_data (priv->enc_key, priv->enc_len,
+                                  &priv->key_len);
+    g_free (priv->enc_key);
+    priv->enc_key = NULL;
+
+    return vprocessor;
+}
+
+static void
+decrypt_key_done (void *vprocessor)
+{
+    on_key_decrypted (vprocessor);
+}
+#endif
+
 static void
 handle_update (CcnetProcessor *processor,
                char *code, char *code_msg,
                char *content, int clen)
 {
+    USE_PRIV;
+
     if (strcmp(code, SC_SESSION_KEY) == 0) {
         if (processor->peer->session_key) {
             ccnet_processor_send_response (processor,
@@ -130,23 +197,29 @@ handle_update (CcnetProcessor *processor,
                                            SS_ALREADY_HAS_KEY,
                                            NULL, 0);
             ccnet_processor_done (processor, TRUE);
-            
-        } else if (update_peer_session_key (processor->peer, content, clen)) {
-            ccnet_processor_send_response (processor,
-                                           SC_OK, SS_OK,
-                                           NULL, 0);
-
-            ccnet_peer_manager_on_peer_session_key_received (processor->peer->manager,
-                                                             processor->peer);
+            return;
+        }
 
-            ccnet_processor_done (processor, TRUE);
-        } else {
+#ifdef CCNET_SERVER
+        if (ccnet_session_crypto_queue_full (processor->session)) {
             ccnet_processor_send_response (processor,
-                                           SC_BAD_KEY, SS_BAD_KEY,
+                                           SC_SERVER_BUSY, SS_SERVER_BUSY,
                                            NULL, 0);
             ccnet_processor_done (processor, FALSE);
+            return;
         }
-        
+
+        priv->enc_key = g_memdup (content, clen);
+        priv->enc_len = clen;
+        ccnet_processor_thread_create (processor,
+                                       processor->session->crypto_job_mgr,
+                                       decrypt_key_job,
+                                       decrypt_key_done,
+                                       processor);
+#else
+        priv->key_buf = decrypt_data (content, clen, &priv->key_len);
+        on_key_decrypted (processor);
+#endif
     } else {
         ccnet_warning ("[recv session key] bad update %s:%s\n",
                        code, code_msg);
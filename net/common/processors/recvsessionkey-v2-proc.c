@@ -7,6 +7,7 @@
 #include  "peer-mgr.h"
 #include "log.h"
 #include "rsa.h"
+#include "utils.h"
 
 #include "recvsessionkey-v2-proc.h"
 
@@ -24,6 +25,13 @@ extern CcnetSession *session;
 
 typedef struct  {
     int encrypt_channel;
+    int suite;                  /* channel cipher suite */
+
+    /* RSA decryption runs in the crypto thread pool */
+    char *enc_key;
+    int   enc_len;
+    unsigned char *key_buf;
+    int   key_len;
 } CcnetRecvskey2ProcPriv;
 
 #define GET_PRIV(o)  \
@@ -45,6 +53,11 @@ static void handle_update (CcnetProcessor *processor,
 static void
 release_resource(CcnetProcessor *processor)
 {
+    USE_PRIV;
+
+    g_free (priv->key_buf);
+    priv->key_buf = NULL;
+
     CCNET_PROCESSOR_CLASS (ccnet_recvskey2_proc_parent_class)->release_resource (processor);
 }
 
@@ -87,15 +100,18 @@ start (CcnetProcessor *processor, int argc, char **argv)
     else
         priv->encrypt_channel = 0;
 
+    /* advertise our cipher suites, old senders ignore them */
+    char *suites = ccnet_cipher_supported_suites ();
     ccnet_processor_send_response (processor,
                                    SC_SESSION_KEY, SS_SESSION_KEY,
-                                   NULL, 0);
+                                   suites, strlen(suites) + 1);
+    g_free (suites);
 
     return 0;
 }
 
 static unsigned char *
-decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
+decrypt_data (const char *content, int clen, int *len_p)
 {
     RSA *privkey = session->privkey;
     unsigned char *buf;
@@ -103,8 +119,6 @@ decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
     buf = private_key_decrypt(privkey, (unsigned char *)content,
                               clen, len_p);
     if (*len_p <= 0) {
-        ccnet_warning ("failed to decrypt session key from peer %.10s",
-                       peer->id);
         g_free (buf);
         buf = NULL;
     }
@@ -114,23 +128,113 @@ decrypt_data (CcnetPeer *peer, const char *content, int clen, int *len_p)
 
 static gboolean
 update_peer_session_key (CcnetPeer *peer,
-                         const char *content,
-                         int clen)
+                         const unsigned char *key_buf,
+                         int key_len,
+                         int *suite)
 {
-    char *buf;
-    int key_len = 0;
+    const char *buf = (const char *)key_buf;
+    const char *sep;
 
-    buf = (char *)decrypt_data (peer, content, clen, &key_len);
-    if (buf) {
-        peer->session_key = g_strndup(buf, key_len);
-        g_free (buf);
-        return TRUE;
-    } else {
-        ccnet_warning ("faied to decrypt session key"); 
+    if (!buf) {
+        ccnet_warning ("failed to decrypt session key from peer %.10s\n",
+                       peer->id);
         return FALSE;
     }
+
+    /* <key>[\n<suite>] */
+    *suite = CCNET_CIPHER_AES_256_CBC;
+    sep = memchr (buf, '\n', key_len);
+    if (sep) {
+        char *name = g_strndup (sep + 1, key_len - (sep + 1 - buf));
+        *suite = ccnet_cipher_suite_from_name (name);
+        g_free (name);
+        if (*suite < 0) {
+            ccnet_warning ("unknown cipher suite from peer %.10s\n", peer->id);
+            return FALSE;
+        }
+        key_len = sep - buf;
+    }
+
+    peer->session_key = g_strndup(buf, key_len);
+    return TRUE;
 }
 
+static void
+on_key_decrypted (CcnetProcessor *processor)
+{
+    USE_PRIV;
+    gboolean ok;
+
+    /* another processor may have set the key in the meantime */
+    if (processor->peer->session_key) {
+        ccnet_processor_send_response (processor,
+                                       SC_ALREADY_HAS_KEY,
+                                       SS_ALREADY_HAS_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, TRUE);
+        return;
+    }
+
+    ok = update_peer_session_key (processor->peer, priv->key_buf,
+                                  priv->key_len, &priv->suite);
+    g_free (priv->key_buf);
+    priv->key_buf = NULL;
+    if (!ok) {
+        ccnet_processor_send_response (processor,
+                                       SC_BAD_KEY, SS_BAD_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    if (priv->encrypt_channel) {
+        /* peer ask to encrypt channel, check whether we want it too */
+        if (ccnet_session_should_encrypt_channel(processor->session)) {
+            /* send the ok reply first */
+            const char *suite = ccnet_cipher_suite_name (priv->suite);
+            ccnet_processor_send_response (processor,
+                                           SC_OK, SS_OK,
+                                           suite, strlen(suite) + 1);
+            /* now setup encryption */
+            if (ccnet_peer_prepare_channel_encryption (processor->peer,
+                                                       priv->suite,
+                                                       FALSE) < 0)
+                /* this is very rare, we just print a warning */
+                ccnet_warning ("Error in prepare channel encryption\n");
+        } else
+            ccnet_processor_send_response (
+                processor, SC_NO_ENCRYPT, SS_NO_ENCRYPT, NULL, 0);
+    } else
+        ccnet_processor_send_response (
+            processor, SC_OK, SS_OK, NULL, 0);
+
+    ccnet_peer_manager_on_peer_session_key_received (processor->peer->manager,
+                                                     processor->peer);
+    ccnet_processor_done (processor, TRUE);
+}
+
+#ifdef CCNET_SERVER
+static void *
+decrypt_key_job (void *vprocessor)
+{
+    CcnetProcessor *processor = vprocessor;
+    USE_PRIV;
+
+    priv->key_buf = decrypt_data (priv->enc_key, priv->enc_len,
+                                  &priv->key_len);
+    g_free (priv->enc_key);
+    priv->enc_key = NULL;
+
+    return vprocessor;
+}
+
+static void
+decrypt_key_done (void *vprocessor)
+{
+    on_key_decrypted (vprocessor);
+}
+#endif
+
 static void
 handle_update (CcnetProcessor *processor,
                char *code, char *code_msg,
@@ -148,35 +252,26 @@ handle_update (CcnetProcessor *processor,
             return;
         }
 
-        if (update_peer_session_key (processor->peer, content, clen) < 0) {
+#ifdef CCNET_SERVER
+        if (ccnet_session_crypto_queue_full (processor->session)) {
             ccnet_processor_send_response (processor,
-                                           SC_BAD_KEY, SS_BAD_KEY,
+                                           SC_SERVER_BUSY, SS_SERVER_BUSY,
                                            NULL, 0);
             ccnet_processor_done (processor, FALSE);
             return;
         }
 
-        if (priv->encrypt_channel) {
-            /* peer ask to encrypt channel, check whether we want it too */
-            if (ccnet_session_should_encrypt_channel(processor->session)) {
-                /* send the ok reply first */
-                ccnet_processor_send_response (processor,
-                                               SC_OK, SS_OK,
-                                               NULL, 0);
-                /* now setup encryption */
-                if (ccnet_peer_prepare_channel_encryption (processor->peer) < 0)
-                    /* this is very rare, we just print a warning */
-                    ccnet_warning ("Error in prepare channel encryption\n");
-            } else
-                ccnet_processor_send_response (
-                    processor, SC_NO_ENCRYPT, SS_NO_ENCRYPT, NULL, 0);
-        } else
-            ccnet_processor_send_response (
-                processor, SC_OK, SS_OK, NULL, 0);
-
-        ccnet_peer_manager_on_peer_session_key_received (processor->peer->manager,
-                                                         processor->peer);
-        ccnet_processor_done (processor, TRUE);
+        priv->enc_key = g_memdup (content, clen);
+        priv->enc_len = clen;
+        ccnet_processor_thread_create (processor,
+                                       processor->session->crypto_job_mgr,
+                                       decrypt_key_job,
+                                       decrypt_key_done,
+                                       processor);
+#else
+        priv->key_buf = decrypt_data (content, clen, &priv->key_len);
+        on_key_decrypted (processor);
+#endif
         return;
     }
      
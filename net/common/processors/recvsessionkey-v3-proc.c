@@ -0,0 +1,223 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer.h"
+#include  "peer-mgr.h"
+#include "log.h"
+#include "rsa.h"
+#include "utils.h"
+
+#include "recvsessionkey-v3-proc.h"
+
+#define SC_SESSION_KEY "300"
+#define SS_SESSION_KEY "session key"
+#define SC_ALREADY_HAS_KEY "301"
+#define SS_ALREADY_HAS_KEY "already has your session key"
+#define SC_NO_ENCRYPT "303"
+#define SS_NO_ENCRYPT "Donot encrypt channel"
+#define SC_BAD_KEY "400"
+#define SS_BAD_KEY "bad session key"
+#define SC_KX_FAILED "501"
+#define SS_KX_FAILED "key agreement not available"
+
+
+typedef struct  {
+    int encrypt_channel;
+
+    /* the share we sent, the session copy may be rotated meanwhile */
+    unsigned char kx_priv[X25519_KEY_LEN];
+    unsigned char kx_pub[X25519_KEY_LEN];
+} CcnetRecvskey3ProcPriv;
+
+#define GET_PRIV(o)  \
+   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CCNET_TYPE_RECVSKEY3_PROC, CcnetRecvskey3ProcPriv))
+
+#define USE_PRIV \
+    CcnetRecvskey3ProcPriv *priv = GET_PRIV(processor);
+
+
+G_DEFINE_TYPE (CcnetRecvskey3Proc, ccnet_recvskey3_proc, CCNET_TYPE_PROCESSOR)
+
+
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+static void handle_update (CcnetProcessor *processor,
+                           char *code, char *code_msg,
+                           char *content, int clen);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    USE_PRIV;
+
+    memset (priv->kx_priv, 0, sizeof(priv->kx_priv));
+
+    CCNET_PROCESSOR_CLASS (ccnet_recvskey3_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_recvskey3_proc_class_init (CcnetRecvskey3ProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "receive-skey3";
+    proc_class->start = start;
+    proc_class->handle_update = handle_update;
+    proc_class->release_resource = release_resource;
+
+    g_type_class_add_private (klass, sizeof (CcnetRecvskey3ProcPriv));
+}
+
+static void
+ccnet_recvskey3_proc_init (CcnetRecvskey3Proc *processor)
+{
+}
+
+
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    USE_PRIV;
+    const unsigned char *kx_priv, *kx_pub, *sig;
+    int sig_len;
+    char pub_hex[2 * X25519_KEY_LEN + 1];
+    char *sig_b64, *suites;
+    GString *buf;
+
+    if (processor->peer->session_key) {
+        ccnet_processor_send_response (processor,
+                                       SC_ALREADY_HAS_KEY,
+                                       SS_ALREADY_HAS_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    if (argc == 1 && g_strcmp0(argv[0], "--enc-channel") == 0)
+        priv->encrypt_channel = 1;
+    else
+        priv->encrypt_channel = 0;
+
+    if (ccnet_session_get_kx_share (processor->session, &kx_priv, &kx_pub,
+                                    &sig, &sig_len) < 0) {
+        ccnet_processor_send_response (processor, SC_KX_FAILED, SS_KX_FAILED,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+    memcpy (priv->kx_priv, kx_priv, X25519_KEY_LEN);
+    memcpy (priv->kx_pub, kx_pub, X25519_KEY_LEN);
+
+    rawdata_to_hex (kx_pub, pub_hex, X25519_KEY_LEN);
+    sig_b64 = g_base64_encode (sig, sig_len);
+    suites = ccnet_cipher_supported_suites ();
+
+    buf = g_string_new (NULL);
+    g_string_printf (buf, "%s\n%s\n%s", pub_hex, sig_b64, suites);
+    ccnet_processor_send_response (processor,
+                                   SC_SESSION_KEY, SS_SESSION_KEY,
+                                   buf->str, buf->len + 1);
+    g_string_free (buf, TRUE);
+    g_free (sig_b64);
+    g_free (suites);
+
+    return 0;
+}
+
+/* <share hex>[\n<suite>] */
+static gboolean
+update_peer_session_key (CcnetProcessor *processor,
+                         char *content, int clen, int *suite)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    unsigned char peer_pub[X25519_KEY_LEN], secret[X25519_KEY_LEN];
+    char key[41];
+
+    if (clen <= 0 || content[clen-1] != '\0' ||
+        strlen(content) < 2 * X25519_KEY_LEN ||
+        hex_to_rawdata (content, peer_pub, X25519_KEY_LEN) < 0)
+        return FALSE;
+
+    *suite = CCNET_CIPHER_AES_256_CBC;
+    if (content[2 * X25519_KEY_LEN] == '\n') {
+        *suite = ccnet_cipher_suite_from_name (content + 2 * X25519_KEY_LEN + 1);
+        if (*suite < 0) {
+            ccnet_warning ("unknown cipher suite from peer %.10s\n", peer->id);
+            return FALSE;
+        }
+    } else if (content[2 * X25519_KEY_LEN] != '\0')
+        return FALSE;
+
+    if (x25519_derive (priv->kx_priv, peer_pub, secret) < 0) {
+        ccnet_warning ("key agreement with peer %.10s failed\n", peer->id);
+        return FALSE;
+    }
+
+    ccnet_session_derive_kx_key (secret, peer_pub, priv->kx_pub, key);
+    memset (secret, 0, sizeof(secret));
+
+    peer->session_key = g_strdup(key);
+    return TRUE;
+}
+
+static void
+handle_update (CcnetProcessor *processor,
+               char *code, char *code_msg,
+               char *content, int clen)
+{
+    USE_PRIV;
+    int suite;
+
+    if (strcmp(code, SC_SESSION_KEY) != 0) {
+        ccnet_warning ("[recv session key v3] bad update %s:%s\n",
+                       code, code_msg);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    /* another processor may have set the key in the meantime */
+    if (processor->peer->session_key) {
+        ccnet_processor_send_response (processor,
+                                       SC_ALREADY_HAS_KEY,
+                                       SS_ALREADY_HAS_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, TRUE);
+        return;
+    }
+
+    if (!update_peer_session_key (processor, content, clen, &suite)) {
+        ccnet_processor_send_response (processor,
+                                       SC_BAD_KEY, SS_BAD_KEY,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    if (priv->encrypt_channel) {
+        /* peer ask to encrypt channel, check whether we want it too */
+        if (ccnet_session_should_encrypt_channel(processor->session)) {
+            /* send the ok reply first */
+            const char *name = ccnet_cipher_suite_name (suite);
+            ccnet_processor_send_response (processor,
+                                           SC_OK, SS_OK,
+                                           name, strlen(name) + 1);
+            /* now setup encryption */
+            if (ccnet_peer_prepare_channel_encryption (processor->peer,
+                                                       suite, FALSE) < 0)
+                /* this is very rare, we just print a warning */
+                ccnet_warning ("Error in prepare channel encryption\n");
+        } else
+            ccnet_processor_send_response (
+                processor, SC_NO_ENCRYPT, SS_NO_ENCRYPT, NULL, 0);
+    } else
+        ccnet_processor_send_response (
+            processor, SC_OK, SS_OK, NULL, 0);
+
+    ccnet_peer_manager_on_peer_session_key_received (processor->peer->manager,
+                                                     processor->peer);
+    ccnet_processor_done (processor, TRUE);
+}
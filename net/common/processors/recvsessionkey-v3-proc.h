@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_RECVSKEY3_PROC_H
+#define CCNET_RECVSKEY3_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_RECVSKEY3_PROC                  (ccnet_recvskey3_proc_get_type ())
+#define CCNET_RECVSKEY3_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_RECVSKEY3_PROC, CcnetRecvskey3Proc))
+#define CCNET_IS_RECVSKEY3_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_RECVSKEY3_PROC))
+#define CCNET_RECVSKEY3_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_RECVSKEY3_PROC, CcnetRecvskey3ProcClass))
+#define IS_CCNET_RECVSKEY3_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_RECVSKEY3_PROC))
+#define CCNET_RECVSKEY3_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_RECVSKEY3_PROC, CcnetRecvskey3ProcClass))
+
+typedef struct _CcnetRecvskey3Proc CcnetRecvskey3Proc;
+typedef struct _CcnetRecvskey3ProcClass CcnetRecvskey3ProcClass;
+
+struct _CcnetRecvskey3Proc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetRecvskey3ProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_recvskey3_proc_get_type ();
+
+#endif
+
@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer.h"
+#include "log.h"
+
+#include "recvticket-proc.h"
+
+#define SC_BAD_TICKET "400"
+#define SS_BAD_TICKET "bad ticket"
+
+G_DEFINE_TYPE (CcnetRecvticketProc, ccnet_recvticket_proc, CCNET_TYPE_PROCESSOR)
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    CCNET_PROCESSOR_CLASS (ccnet_recvticket_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_recvticket_proc_class_init (CcnetRecvticketProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "receive-ticket";
+    proc_class->start = start;
+    proc_class->release_resource = release_resource;
+}
+
+static void
+ccnet_recvticket_proc_init (CcnetRecvticketProc *processor)
+{
+}
+
+
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    CcnetPeer *peer = processor->peer;
+    unsigned char *ticket;
+    gsize ticket_len;
+    int lifetime;
+
+    if (argc != 2 || !peer->session_key) {
+        ccnet_processor_send_response (processor, SC_BAD_TICKET, SS_BAD_TICKET,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    lifetime = atoi (argv[0]);
+    ticket = g_base64_decode (argv[1], &ticket_len);
+    if (lifetime <= 0 || ticket_len == 0) {
+        g_free (ticket);
+        ccnet_processor_send_response (processor, SC_BAD_TICKET, SS_BAD_TICKET,
+                                       NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    /* the ticket is opaque to us, it is only valid with this session key */
+    ccnet_peer_set_ticket (peer, ticket, (int)ticket_len, lifetime);
+    g_free (ticket);
+
+    ccnet_processor_send_response (processor, SC_OK, SS_OK, NULL, 0);
+    ccnet_processor_done (processor, TRUE);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_RECVTICKET_PROC_H
+#define CCNET_RECVTICKET_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_RECVTICKET_PROC                  (ccnet_recvticket_proc_get_type ())
+#define CCNET_RECVTICKET_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_RECVTICKET_PROC, CcnetRecvticketProc))
+#define CCNET_IS_RECVTICKET_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_RECVTICKET_PROC))
+#define CCNET_RECVTICKET_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_RECVTICKET_PROC, CcnetRecvticketProcClass))
+#define IS_CCNET_RECVTICKET_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_RECVTICKET_PROC))
+#define CCNET_RECVTICKET_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_RECVTICKET_PROC, CcnetRecvticketProcClass))
+
+typedef struct _CcnetRecvticketProc CcnetRecvticketProc;
+typedef struct _CcnetRecvticketProcClass CcnetRecvticketProcClass;
+
+struct _CcnetRecvticketProc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetRecvticketProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_recvticket_proc_get_type ();
+
+#endif
+
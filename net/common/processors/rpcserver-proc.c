@@ -13,6 +13,7 @@ typedef struct {
     char *buf;
     int   len;
     int   off;
+    int   seg_len;              /* max length of a segment */
     /* struct timeval start; */
 } CcnetRpcserverProcPriv;
 
@@ -41,6 +42,12 @@ release_resource(CcnetProcessor *processor)
 }
 
 
+static void
+reset (CcnetProcessor *processor)
+{
+    memset (GET_PRIV (processor), 0, sizeof(CcnetRpcserverProcPriv));
+}
+
 static void
 ccnet_rpcserver_proc_class_init (CcnetRpcserverProcClass *klass)
 {
@@ -49,6 +56,7 @@ ccnet_rpcserver_proc_class_init (CcnetRpcserverProcClass *klass)
     proc_class->start = start;
     proc_class->handle_update = handle_update;
     proc_class->release_resource = release_resource;
+    proc_class->reset = reset;
     proc_class->name = "rpcserver-proc";
 
     g_type_class_add_private (klass, sizeof(CcnetRpcserverProcPriv));
@@ -83,7 +91,9 @@ handle_update (CcnetProcessor *processor,
         char *svc_name = processor->name;
         char *ret = searpc_server_call_function (svc_name, content, clen, &ret_len);
 
-        if (ret_len < MAX_TRANSFER_LENGTH) {
+        priv->seg_len = ccnet_processor_get_max_response_len (processor)
+            - MESSAGE_HEADER;
+        if (ret_len < priv->seg_len) {
             ccnet_processor_send_response (
                 processor, SC_SERVER_RET, SS_SERVER_RET, ret, ret_len);
             g_free (ret);
@@ -96,22 +106,22 @@ handle_update (CcnetProcessor *processor,
         priv->len = ret_len;
         priv->off = 0;
         
-        /* fprintf (stderr, "Send %d\n", MAX_TRANSFER_LENGTH); */
+        /* fprintf (stderr, "Send %d\n", priv->seg_len); */
         ccnet_processor_send_response (processor, SC_SERVER_MORE,
                                        SS_SERVER_MORE, priv->buf,
-                                       MAX_TRANSFER_LENGTH);
-        priv->off = MAX_TRANSFER_LENGTH;
+                                       priv->seg_len);
+        priv->off = priv->seg_len;
 
         return;
     }
 
     if (memcmp (code, SC_CLIENT_MORE, 3) == 0) {
-        if (priv->off + MAX_TRANSFER_LENGTH < priv->len) {
-            /* fprintf (stderr, "Send %d\n", MAX_TRANSFER_LENGTH); */
+        if (priv->off + priv->seg_len < priv->len) {
+            /* fprintf (stderr, "Send %d\n", priv->seg_len); */
             ccnet_processor_send_response (
                 processor, SC_SERVER_MORE, SS_SERVER_MORE,
-                priv->buf + priv->off, MAX_TRANSFER_LENGTH);
-            priv->off += MAX_TRANSFER_LENGTH;
+                priv->buf + priv->off, priv->seg_len);
+            priv->off += priv->seg_len;
         } else {
             /* fprintf (stderr, "Send %d\n", priv->len - priv->off); */
             ccnet_processor_send_response (
@@ -0,0 +1,205 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+
+  Resume a session with a ticket from send-ticket instead of doing the
+  RSA challenge and session key exchange again.
+
+            receive-resume <ticket> <cnonce> <cipher suites>|none
+  A     ------------------------------------------->    B
+
+             SC_RESUME <snonce>\n<suite>|none\n<server proof>
+        <-------------------------------
+
+             SC_RESUME <client proof>
+        ---------------------------->
+
+             SC_OK
+        <------------------------------------------
+
+  Both sides derive the new session key K = HMAC(secret, cnonce+snonce)
+  from the secret in the ticket, and prove they know it with
+  HMAC(K, "server finished") and HMAC(K, "client finished").
+  Any error response means A must fall back to the full handshake.
+*/
+
+#include <openssl/rand.h>
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer-mgr.h"
+#include "peer.h"
+#include "log.h"
+#include "utils.h"
+
+#include "sendresume-proc.h"
+
+#define SC_RESUME "300"
+#define SS_RESUME "resume"
+
+enum {
+    INIT = 0,
+    REQUEST_SENT,
+    PROOF_SENT,
+};
+
+typedef struct  {
+    int state;
+    int suite;                  /* channel cipher suite, -1 for none */
+    char cnonce[41];
+    char key[41];
+} CcnetSendresumeProcPriv;
+
+#define GET_PRIV(o)  \
+   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CCNET_TYPE_SENDRESUME_PROC, CcnetSendresumeProcPriv))
+
+#define USE_PRIV \
+    CcnetSendresumeProcPriv *priv = GET_PRIV(processor);
+
+
+G_DEFINE_TYPE (CcnetSendresumeProc, ccnet_sendresume_proc, CCNET_TYPE_PROCESSOR)
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+static void handle_response (CcnetProcessor *processor,
+                             char *code, char *code_msg,
+                             char *content, int clen);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    CCNET_PROCESSOR_CLASS (ccnet_sendresume_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_sendresume_proc_class_init (CcnetSendresumeProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "send-resume";
+    proc_class->start = start;
+    proc_class->handle_response = handle_response;
+    proc_class->release_resource = release_resource;
+
+    g_type_class_add_private (klass, sizeof (CcnetSendresumeProcPriv));
+}
+
+static void
+ccnet_sendresume_proc_init (CcnetSendresumeProc *processor)
+{
+}
+
+
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    unsigned char nonce[20];
+    char *b64, *suites, *req;
+
+    if (argc != 0 || !ccnet_peer_has_valid_ticket (peer)) {
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    if (RAND_bytes (nonce, sizeof(nonce)) != 1) {
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+    rawdata_to_hex (nonce, priv->cnonce, 20);
+
+    if (ccnet_session_should_encrypt_channel (processor->session))
+        suites = ccnet_cipher_supported_suites ();
+    else
+        suites = g_strdup ("none");
+
+    b64 = g_base64_encode (peer->ticket, peer->ticket_len);
+    req = g_strdup_printf ("receive-resume %s %s %s",
+                           b64, priv->cnonce, suites);
+    ccnet_processor_send_request (processor, req);
+    priv->state = REQUEST_SENT;
+
+    g_free (req);
+    g_free (b64);
+    g_free (suites);
+    return 0;
+}
+
+/* <snonce>\n<suite>|none\n<server proof> */
+static int
+handle_server_proof (CcnetProcessor *processor, char *content, int clen)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    char **fields;
+    char proof[41];
+    int ret = -1;
+
+    if (clen <= 0 || content[clen-1] != '\0')
+        return -1;
+
+    fields = g_strsplit (content, "\n", 3);
+    if (g_strv_length (fields) != 3 || strlen(fields[0]) != 40)
+        goto out;
+
+    if (g_strcmp0 (fields[1], "none") == 0)
+        priv->suite = -1;
+    else if ((priv->suite = ccnet_cipher_suite_from_name (fields[1])) < 0)
+        goto out;
+
+    ccnet_session_derive_resumed_key (peer->ticket_secret, priv->cnonce,
+                                      fields[0], priv->key);
+    ccnet_session_resume_proof (priv->key, "server finished", proof);
+    if (strcmp (proof, fields[2]) != 0) {
+        ccnet_warning ("bad resume proof from peer %.10s\n", peer->id);
+        goto out;
+    }
+
+    ccnet_session_resume_proof (priv->key, "client finished", proof);
+    ccnet_processor_send_update (processor, SC_RESUME, SS_RESUME,
+                                 proof, strlen(proof) + 1);
+    ret = 0;
+
+out:
+    g_strfreev (fields);
+    return ret;
+}
+
+static void
+handle_response (CcnetProcessor *processor,
+                 char *code, char *code_msg,
+                 char *content, int clen)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+
+    if (strcmp(code, SC_RESUME) == 0 && priv->state == REQUEST_SENT) {
+        if (!peer->ticket_secret ||
+            handle_server_proof (processor, content, clen) < 0) {
+            ccnet_processor_done (processor, FALSE);
+            return;
+        }
+        priv->state = PROOF_SENT;
+
+    } else if (strcmp(code, SC_OK) == 0 && priv->state == PROOF_SENT) {
+        if (peer->session_key) {
+            /* a full handshake won the race, keep its key */
+            ccnet_processor_done (processor, FALSE);
+            return;
+        }
+
+        peer->session_key = g_strdup (priv->key);
+        if (priv->suite >= 0)
+            ccnet_peer_prepare_channel_encryption (peer, priv->suite, TRUE);
+
+        ccnet_peer_manager_on_peer_session_key_sent (peer->manager, peer);
+        ccnet_processor_done (processor, TRUE);
+
+    } else {
+        ccnet_debug ("[send resume] peer %.10s: %s:%s\n",
+                     peer->id, code, code_msg);
+        ccnet_processor_done (processor, FALSE);
+    }
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_SENDRESUME_PROC_H
+#define CCNET_SENDRESUME_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_SENDRESUME_PROC                  (ccnet_sendresume_proc_get_type ())
+#define CCNET_SENDRESUME_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_SENDRESUME_PROC, CcnetSendresumeProc))
+#define CCNET_IS_SENDRESUME_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_SENDRESUME_PROC))
+#define CCNET_SENDRESUME_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_SENDRESUME_PROC, CcnetSendresumeProcClass))
+#define IS_CCNET_SENDRESUME_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_SENDRESUME_PROC))
+#define CCNET_SENDRESUME_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_SENDRESUME_PROC, CcnetSendresumeProcClass))
+
+typedef struct _CcnetSendresumeProc CcnetSendresumeProc;
+typedef struct _CcnetSendresumeProcClass CcnetSendresumeProcClass;
+
+struct _CcnetSendresumeProc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetSendresumeProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_sendresume_proc_get_type ();
+
+#endif
+
@@ -8,14 +8,17 @@
             receive-skey-v2 [--enc-channel]
   A     ------------------------------------------->    B
 
-             SC_SESSION_KEY
+             SC_SESSION_KEY [<cipher suites>]
         <-------------------------------
 
-             SC_SESSION_KEY <key> (encrypted with B's pubkey)
+             SC_SESSION_KEY <key>[\n<suite>] (encrypted with B's pubkey)
         ---------------------------->
 
-             SC_OK_ENCRYPT Or SC_NO_ENCRYPT
+             SC_OK [<suite>] Or SC_NO_ENCRYPT
         <------------------------------------------
+
+  B lists the channel cipher suites it supports, A picks one and sends
+  it along with the key. Old peers send no list, they get AES-256-CBC.
 */
 
 #include <openssl/sha.h>
@@ -28,6 +31,7 @@
 #include "peer.h"
 #include "log.h"
 #include "rsa.h"
+#include "utils.h"
 
 #include "sendsessionkey-v2-proc.h"
 
@@ -50,6 +54,7 @@ enum {
 typedef struct  {
     char key[40];
     int state;
+    int suite;                  /* channel cipher suite */
 } CcnetSendskey2ProcPriv;
 
 #define GET_PRIV(o)  \
@@ -124,6 +129,7 @@ generate_session_key (CcnetProcessor *processor, int *len_p)
     unsigned char *enc_out = NULL; 
     unsigned char random_buf[40];
     SHA_CTX s;
+    GString *plain;
 
     RAND_pseudo_bytes (random_buf, sizeof(random_buf));
     
@@ -133,8 +139,14 @@ generate_session_key (CcnetProcessor *processor, int *len_p)
 
     rawdata_to_hex (sha1, priv->key, 20);
 
-    enc_out = public_key_encrypt (peer->pubkey, (unsigned char *)priv->key,
-                                  40, len_p);
+    plain = g_string_new_len (priv->key, 40);
+    if (priv->suite != CCNET_CIPHER_AES_256_CBC)
+        g_string_append_printf (plain, "\n%s",
+                                ccnet_cipher_suite_name (priv->suite));
+
+    enc_out = public_key_encrypt (peer->pubkey, (unsigned char *)plain->str,
+                                  plain->len, len_p);
+    g_string_free (plain, TRUE);
 
     if (*len_p <= 0) {
         g_free (enc_out);
@@ -154,6 +166,11 @@ handle_response (CcnetProcessor *processor,
         unsigned char *enc_out = NULL;
         int len = 0;
 
+        priv->suite = CCNET_CIPHER_AES_256_CBC;
+        if (ccnet_session_should_encrypt_channel (processor->session) &&
+            clen > 0 && content[clen-1] == '\0')
+            priv->suite = ccnet_cipher_choose_suite (content);
+
         enc_out = generate_session_key(processor, &len);
         if (enc_out) {
             ccnet_processor_send_update (processor,
@@ -173,7 +190,8 @@ handle_response (CcnetProcessor *processor,
         processor->peer->session_key = g_strndup(priv->key, 40);
 
         if (ccnet_session_should_encrypt_channel (processor->session))
-            ccnet_peer_prepare_channel_encryption (processor->peer);
+            ccnet_peer_prepare_channel_encryption (processor->peer,
+                                                   priv->suite, TRUE);
 
         ccnet_peer_manager_on_peer_session_key_sent (processor->peer->manager,
                                                      processor->peer);
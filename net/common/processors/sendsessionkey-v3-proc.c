@@ -0,0 +1,233 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+
+  Like send-skey2, but the session key comes from an X25519 key
+  agreement instead of being RSA-encrypted to B. B signs its share
+  with its RSA identity key, so A knows it talks to B, and B does no
+  RSA private key operation per connection.
+
+            receive-skey3 [--enc-channel]
+  A     ------------------------------------------->    B
+
+             SC_SESSION_KEY <B share hex>\n<signature base64>\n<cipher suites>
+        <-------------------------------
+
+             SC_SESSION_KEY <A share hex>[\n<suite>]
+        ---------------------------->
+
+             SC_OK [<suite>] Or SC_NO_ENCRYPT
+        <------------------------------------------
+
+  The key is HMAC-SHA256(shared secret, A share + B share). Only used
+  with peers that advertise "x25519" in their keepalive2 reply.
+*/
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer-mgr.h"
+#include "peer.h"
+#include "log.h"
+#include "rsa.h"
+#include "utils.h"
+
+#include "sendsessionkey-v3-proc.h"
+
+#define SC_SESSION_KEY "300"
+#define SS_SESSION_KEY "session key"
+#define SC_ALREADY_HAS_KEY "301"
+#define SS_ALREADY_HAS_KEY "already has your session key"
+#define SC_NO_ENCRYPT "303"
+#define SS_NO_ENCRYPT "Donot encrypt channel"
+
+
+enum {
+    INIT = 0,
+    REQUEST_SENT,
+    SESSION_KEY_SENT,
+};
+
+typedef struct  {
+    char key[41];
+    int state;
+    int suite;                  /* channel cipher suite */
+} CcnetSendskey3ProcPriv;
+
+#define GET_PRIV(o)  \
+   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CCNET_TYPE_SENDSKEY3_PROC, CcnetSendskey3ProcPriv))
+
+#define USE_PRIV \
+    CcnetSendskey3ProcPriv *priv = GET_PRIV(processor);
+
+
+G_DEFINE_TYPE (CcnetSendskey3Proc, ccnet_sendskey3_proc, CCNET_TYPE_PROCESSOR)
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+static void handle_response (CcnetProcessor *processor,
+                             char *code, char *code_msg,
+                             char *content, int clen);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    CCNET_PROCESSOR_CLASS (ccnet_sendskey3_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_sendskey3_proc_class_init (CcnetSendskey3ProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "send-skey3";
+    proc_class->start = start;
+    proc_class->handle_response = handle_response;
+    proc_class->release_resource = release_resource;
+
+    g_type_class_add_private (klass, sizeof (CcnetSendskey3ProcPriv));
+}
+
+static void
+ccnet_sendskey3_proc_init (CcnetSendskey3Proc *processor)
+{
+}
+
+
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    USE_PRIV;
+    if (argc != 0 || !processor->peer->pubkey) {
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    if (ccnet_session_should_encrypt_channel (processor->session))
+        ccnet_processor_send_request (processor, "receive-skey3 --enc-channel");
+    else
+        ccnet_processor_send_request (processor, "receive-skey3");
+
+    priv->state = REQUEST_SENT;
+
+    return 0;
+}
+
+/* Check B's signed share and agree on the key, returns our share
+ * as hex or NULL. */
+static char *
+agree_session_key (CcnetProcessor *processor, char *content, int clen,
+                   const char **suites)
+{
+    USE_PRIV;
+    CcnetPeer *peer = processor->peer;
+    unsigned char peer_pub[X25519_KEY_LEN], priv_key[X25519_KEY_LEN];
+    unsigned char pub[X25519_KEY_LEN], secret[X25519_KEY_LEN];
+    unsigned char data[sizeof(CCNET_KX_SIGN_LABEL) + X25519_KEY_LEN];
+    int label_len = sizeof(CCNET_KX_SIGN_LABEL) - 1;
+    unsigned char *sig = NULL;
+    gsize sig_len;
+    char *sep, *sig_b64, *ret = NULL;
+
+    if (clen <= 0 || content[clen-1] != '\0')
+        return NULL;
+
+    /* <share hex>\n<signature base64>\n<suites> */
+    if (strlen(content) < 2 * X25519_KEY_LEN + 1 ||
+        content[2 * X25519_KEY_LEN] != '\n' ||
+        hex_to_rawdata (content, peer_pub, X25519_KEY_LEN) < 0)
+        return NULL;
+
+    sig_b64 = content + 2 * X25519_KEY_LEN + 1;
+    sep = strchr (sig_b64, '\n');
+    if (!sep)
+        return NULL;
+    *sep = '\0';
+    *suites = sep + 1;
+
+    sig = g_base64_decode (sig_b64, &sig_len);
+    memcpy (data, CCNET_KX_SIGN_LABEL, label_len);
+    memcpy (data + label_len, peer_pub, X25519_KEY_LEN);
+    if (!public_key_verify (peer->pubkey, data, label_len + X25519_KEY_LEN,
+                            sig, (int)sig_len)) {
+        ccnet_warning ("bad key share signature from peer %.10s\n", peer->id);
+        goto out;
+    }
+
+    if (x25519_generate_key (priv_key, pub) < 0 ||
+        x25519_derive (priv_key, peer_pub, secret) < 0) {
+        ccnet_warning ("key agreement with peer %.10s failed\n", peer->id);
+        goto out;
+    }
+
+    ccnet_session_derive_kx_key (secret, pub, peer_pub, priv->key);
+
+    ret = g_malloc (2 * X25519_KEY_LEN + 1);
+    rawdata_to_hex (pub, ret, X25519_KEY_LEN);
+
+out:
+    memset (priv_key, 0, sizeof(priv_key));
+    memset (secret, 0, sizeof(secret));
+    g_free (sig);
+    return ret;
+}
+
+static void
+handle_response (CcnetProcessor *processor,
+                 char *code, char *code_msg,
+                 char *content, int clen)
+{
+    USE_PRIV;
+    if (strcmp(code, SC_SESSION_KEY) == 0 && priv->state == REQUEST_SENT) {
+        const char *suites = NULL;
+        char *pub_hex;
+        GString *buf;
+
+        pub_hex = agree_session_key (processor, content, clen, &suites);
+        if (!pub_hex) {
+            ccnet_processor_done (processor, FALSE);
+            return;
+        }
+
+        priv->suite = CCNET_CIPHER_AES_256_CBC;
+        if (ccnet_session_should_encrypt_channel (processor->session))
+            priv->suite = ccnet_cipher_choose_suite (suites);
+
+        buf = g_string_new (pub_hex);
+        g_string_append_printf (buf, "\n%s",
+                                ccnet_cipher_suite_name (priv->suite));
+        ccnet_processor_send_update (processor,
+                                     SC_SESSION_KEY, SS_SESSION_KEY,
+                                     buf->str, buf->len + 1);
+        g_string_free (buf, TRUE);
+        g_free (pub_hex);
+        priv->state = SESSION_KEY_SENT;
+
+    } else if (strcmp(code, SC_OK) == 0 && priv->state == SESSION_KEY_SENT) {
+        processor->peer->session_key = g_strdup(priv->key);
+
+        if (ccnet_session_should_encrypt_channel (processor->session))
+            ccnet_peer_prepare_channel_encryption (processor->peer,
+                                                   priv->suite, TRUE);
+
+        ccnet_peer_manager_on_peer_session_key_sent (processor->peer->manager,
+                                                     processor->peer);
+
+        ccnet_processor_done (processor, TRUE);
+
+    } else if (strcmp(code, SC_ALREADY_HAS_KEY) == 0) {
+        /* already has session key, skip */
+        ccnet_processor_done (processor, TRUE);
+
+    } else if (strcmp(code, SC_NO_ENCRYPT) == 0 &&
+               priv->state == SESSION_KEY_SENT) {
+        processor->peer->session_key = g_strdup(priv->key);
+        ccnet_peer_manager_on_peer_session_key_sent (processor->peer->manager,
+                                                     processor->peer);
+        ccnet_processor_done (processor, TRUE);
+    } else {
+        ccnet_warning ("[send session key v3] bad response %s:%s\n",
+                       code, code_msg);
+        ccnet_processor_done (processor, FALSE);
+    }
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_SENDSKEY3_PROC_H
+#define CCNET_SENDSKEY3_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_SENDSKEY3_PROC                  (ccnet_sendskey3_proc_get_type ())
+#define CCNET_SENDSKEY3_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_SENDSKEY3_PROC, CcnetSendskey3Proc))
+#define CCNET_IS_SENDSKEY3_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_SENDSKEY3_PROC))
+#define CCNET_SENDSKEY3_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_SENDSKEY3_PROC, CcnetSendskey3ProcClass))
+#define IS_CCNET_SENDSKEY3_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_SENDSKEY3_PROC))
+#define CCNET_SENDSKEY3_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_SENDSKEY3_PROC, CcnetSendskey3ProcClass))
+
+typedef struct _CcnetSendskey3Proc CcnetSendskey3Proc;
+typedef struct _CcnetSendskey3ProcClass CcnetSendskey3ProcClass;
+
+struct _CcnetSendskey3Proc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetSendskey3ProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_sendskey3_proc_get_type ();
+
+#endif
+
@@ -0,0 +1,101 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+
+  After a full key exchange on an incoming connection, the server hands
+  the client a resumption ticket bound to the session key.
+
+            receive-ticket <lifetime> <ticket in base64>
+  B     ------------------------------------------->    A
+
+             SC_OK
+        <-------------------------------
+
+  See send-resume for how the ticket is used.
+*/
+
+#include "session.h"
+#include "common.h"
+#include "processor.h"
+#include "peer.h"
+#include "log.h"
+
+#include "sendticket-proc.h"
+
+G_DEFINE_TYPE (CcnetSendticketProc, ccnet_sendticket_proc, CCNET_TYPE_PROCESSOR)
+
+static int start (CcnetProcessor *processor, int argc, char **argv);
+static void handle_response (CcnetProcessor *processor,
+                             char *code, char *code_msg,
+                             char *content, int clen);
+
+static void
+release_resource(CcnetProcessor *processor)
+{
+    CCNET_PROCESSOR_CLASS (ccnet_sendticket_proc_parent_class)->release_resource (processor);
+}
+
+
+static void
+ccnet_sendticket_proc_class_init (CcnetSendticketProcClass *klass)
+{
+    CcnetProcessorClass *proc_class = CCNET_PROCESSOR_CLASS (klass);
+
+    proc_class->name = "send-ticket";
+    proc_class->start = start;
+    proc_class->handle_response = handle_response;
+    proc_class->release_resource = release_resource;
+}
+
+static void
+ccnet_sendticket_proc_init (CcnetSendticketProc *processor)
+{
+}
+
+
+static int
+start (CcnetProcessor *processor, int argc, char **argv)
+{
+    CcnetPeer *peer = processor->peer;
+    unsigned char *ticket;
+    int ticket_len;
+    char *b64, *req;
+
+    if (argc != 0 || !peer->session_key) {
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    ticket = ccnet_session_seal_ticket (processor->session, peer->id,
+                                        peer->session_key, &ticket_len);
+    if (!ticket) {
+        ccnet_warning ("failed to create ticket for peer %.10s\n", peer->id);
+        ccnet_processor_done (processor, FALSE);
+        return -1;
+    }
+
+    b64 = g_base64_encode (ticket, ticket_len);
+    req = g_strdup_printf ("receive-ticket %d %s",
+                           CCNET_TICKET_LIFETIME, b64);
+    ccnet_processor_send_request (processor, req);
+
+    g_free (req);
+    g_free (b64);
+    g_free (ticket);
+    return 0;
+}
+
+static void
+handle_response (CcnetProcessor *processor,
+                 char *code, char *code_msg,
+                 char *content, int clen)
+{
+    if (strcmp(code, SC_OK) == 0) {
+        ccnet_processor_done (processor, TRUE);
+    } else {
+        /* old peers don't know tickets, that's fine */
+        ccnet_debug ("[send ticket] peer %.10s: %s:%s\n",
+                     processor->peer->id, code, code_msg);
+        ccnet_processor_done (processor, FALSE);
+    }
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CCNET_SENDTICKET_PROC_H
+#define CCNET_SENDTICKET_PROC_H
+
+#include <glib-object.h>
+
+
+#define CCNET_TYPE_SENDTICKET_PROC                  (ccnet_sendticket_proc_get_type ())
+#define CCNET_SENDTICKET_PROC(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CCNET_TYPE_SENDTICKET_PROC, CcnetSendticketProc))
+#define CCNET_IS_SENDTICKET_PROC(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CCNET_TYPE_SENDTICKET_PROC))
+#define CCNET_SENDTICKET_PROC_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass), CCNET_TYPE_SENDTICKET_PROC, CcnetSendticketProcClass))
+#define IS_CCNET_SENDTICKET_PROC_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass), CCNET_TYPE_SENDTICKET_PROC))
+#define CCNET_SENDTICKET_PROC_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj), CCNET_TYPE_SENDTICKET_PROC, CcnetSendticketProcClass))
+
+typedef struct _CcnetSendticketProc CcnetSendticketProc;
+typedef struct _CcnetSendticketProcClass CcnetSendticketProcClass;
+
+struct _CcnetSendticketProc {
+    CcnetProcessor parent_instance;
+};
+
+struct _CcnetSendticketProcClass {
+    CcnetProcessorClass parent_class;
+};
+
+GType ccnet_sendticket_proc_get_type ();
+
+#endif
+
@@ -3,10 +3,15 @@
 #include "include.h"
 
 #include "server-session.h"
+#include "processor.h"
 #include "threaded-rpcserver-proc.h"
 #include "searpc-server.h"
 #include "rpc-common.h"
 #include "job-mgr.h"
+#include "rpc-cache.h"
+#include "ccnet-db.h"
+
+#include <pthread.h>
 
 typedef struct {
     char *call_buf;
@@ -14,7 +19,17 @@ typedef struct {
     char *buf;
     gsize len;
     int   off;
+    int   seg_len;              /* max length of a segment */
     char *error_message;
+    gboolean stream;            /* client asked for streamed segments */
+    int   credits;              /* segments we may push ahead */
+    char *fname;                /* of the running call */
+    guint64 cache_gen;          /* rpc cache generation at the call */
+
+    char *batch_buf;            /* the calls of a batch */
+    struct BatchCall *calls;
+    int   n_calls;
+    int   n_running;            /* jobs of a parallel batch */
 } CcnetThreadedRpcserverProcPriv;
 
 #define GET_PRIV(o) \
@@ -27,17 +42,29 @@ static void handle_update (CcnetProcessor *processor,
                            char *code, char *code_msg,
                            char *content, int clen);
 
+static void finish_call (CcnetProcessor *processor);
+static void finish_batch (CcnetProcessor *processor);
+
 static void
 release_resource(CcnetProcessor *processor)
 {
     CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
 
+    /* a call that returned after the processor was done */
+    finish_call (processor);
+    finish_batch (processor);
     g_free (priv->buf);
 
     CCNET_PROCESSOR_CLASS (ccnet_threaded_rpcserver_proc_parent_class)->release_resource (processor);
 }
 
 
+static void
+reset (CcnetProcessor *processor)
+{
+    memset (GET_PRIV (processor), 0, sizeof(CcnetThreadedRpcserverProcPriv));
+}
+
 static void
 ccnet_threaded_rpcserver_proc_class_init (CcnetThreadedRpcserverProcClass *klass)
 {
@@ -46,6 +73,7 @@ ccnet_threaded_rpcserver_proc_class_init (CcnetThreadedRpcserverProcClass *klass
     proc_class->start = start;
     proc_class->handle_update = handle_update;
     proc_class->release_resource = release_resource;
+    proc_class->reset = reset;
     proc_class->name = "threaded-rpcserver-proc";
 
     g_type_class_add_private (klass, sizeof(CcnetThreadedRpcserverProcPriv));
@@ -60,11 +88,96 @@ ccnet_threaded_rpcserver_proc_init (CcnetThreadedRpcserverProc *processor)
 static int
 start (CcnetProcessor *processor, int argc, char **argv)
 {
-    ccnet_processor_send_response (processor, SC_OK, SS_OK, NULL, 0);
+    char cap[32];
+    int len;
+
+    len = snprintf (cap, sizeof(cap), "%s=%d",
+                    RPC_STREAM_CAP, RPC_STREAM_WINDOW);
+    ccnet_processor_send_response (processor, SC_OK, SS_OK, cap, len + 1);
 
     return 0;
 }
 
+/* Database queries per function, a call running one query per item of
+ * a list shows up as a high max. */
+
+#define QUERY_WARN_THRESHOLD 50
+
+typedef struct QueryStat {
+    gint64 calls;
+    gint64 queries;
+    gint64 max;                 /* of a single call */
+} QueryStat;
+
+static pthread_mutex_t query_stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable *query_stats; /* fname -> QueryStat */
+
+static void
+record_queries (const char *fname, gint64 n_queries)
+{
+    QueryStat *stat;
+    gboolean warn = FALSE;
+
+    if (!fname)
+        return;
+
+    pthread_mutex_lock (&query_stat_lock);
+    if (!query_stats)
+        query_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, g_free);
+    stat = g_hash_table_lookup (query_stats, fname);
+    if (!stat) {
+        stat = g_new0 (QueryStat, 1);
+        g_hash_table_insert (query_stats, g_strdup(fname), stat);
+    }
+    stat->calls++;
+    stat->queries += n_queries;
+    if (n_queries > stat->max) {
+        stat->max = n_queries;
+        warn = (n_queries >= QUERY_WARN_THRESHOLD);
+    }
+    pthread_mutex_unlock (&query_stat_lock);
+
+    /* only for a new max, so it doesn't flood the log */
+    if (warn)
+        g_warning ("[rpc-server] %s ran %" G_GINT64_FORMAT
+                   " database queries in one call.\n", fname, n_queries);
+}
+
+gint64
+ccnet_threaded_rpcserver_get_query_stat (const char *fname, const char *name)
+{
+    QueryStat *stat = NULL;
+    gint64 val = -1;
+
+    pthread_mutex_lock (&query_stat_lock);
+    if (query_stats)
+        stat = g_hash_table_lookup (query_stats, fname);
+    if (g_strcmp0 (name, "calls") == 0)
+        val = stat ? stat->calls : 0;
+    else if (g_strcmp0 (name, "queries") == 0)
+        val = stat ? stat->queries : 0;
+    else if (g_strcmp0 (name, "max") == 0)
+        val = stat ? stat->max : 0;
+    pthread_mutex_unlock (&query_stat_lock);
+
+    return val;
+}
+
+/* Run a call in this thread and count its queries. */
+static char *
+call_function (const char *svc_name, const char *fname,
+               char *call, gsize call_len, gsize *len)
+{
+    gint64 before = ccnet_db_get_thread_query_count ();
+    char *ret;
+
+    ret = searpc_server_call_function (svc_name, call, call_len, len);
+    record_queries (fname, ccnet_db_get_thread_query_count () - before);
+
+    return ret;
+}
+
 static void *
 call_function_job (void *vprocessor)
 {
@@ -72,21 +185,80 @@ call_function_job (void *vprocessor)
     CcnetThreadedRpcserverProcPriv *priv = GET_PRIV(processor);
     char *svc_name = processor->name;
 
-    priv->buf = searpc_server_call_function (svc_name, priv->call_buf, priv->call_len,
-                                             &priv->len);
-    g_free (priv->call_buf);
+    priv->buf = call_function (svc_name, priv->fname,
+                               priv->call_buf, priv->call_len, &priv->len);
 
     return vprocessor;
 }
 
+static CcnetRpcCache *
+get_rpc_cache (CcnetProcessor *processor)
+{
+    return ((CcnetServerSession *)processor->session)->rpc_cache;
+}
+
+/* Let the cache store the result or invalidate entries. Nothing to do
+ * for a cache hit, the call didn't run. */
+static void
+finish_call (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    if (priv->call_buf)
+        ccnet_rpc_cache_end_call (get_rpc_cache (processor), priv->fname,
+                                  priv->call_buf, priv->call_len,
+                                  priv->cache_gen, priv->buf, priv->len);
+    g_free (priv->call_buf);
+    priv->call_buf = NULL;
+    g_free (priv->fname);
+    priv->fname = NULL;
+}
+
+/* Send the next segment, or the last one as SERVER_RET. */
+static void
+send_next_segment (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    if (priv->off + priv->seg_len < priv->len) {
+        ccnet_processor_send_response (
+            processor, SC_SERVER_MORE, SS_SERVER_MORE,
+            priv->buf + priv->off, priv->seg_len);
+        priv->off += priv->seg_len;
+    } else {
+        ccnet_processor_send_response (
+            processor, SC_SERVER_RET, SS_SERVER_RET,
+            priv->buf + priv->off, priv->len - priv->off);
+        g_free (priv->buf);
+        priv->buf = NULL;
+        /* ccnet_processor_done (processor, TRUE); */
+    }
+}
+
+static void
+push_segments (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    while (priv->buf && priv->credits > 0) {
+        send_next_segment (processor);
+        --priv->credits;
+    }
+}
+
 static void
 call_function_done (void *vprocessor)
 {
     CcnetProcessor *processor = vprocessor;
     CcnetThreadedRpcserverProcPriv *priv = GET_PRIV(processor);
 
+    finish_call (processor);
+
     if (priv->buf) {
-        if (priv->len < MAX_TRANSFER_LENGTH) {
+        /* v2 local clients get up to 16MB in one packet */
+        priv->seg_len = ccnet_processor_get_max_response_len (processor)
+            - MESSAGE_HEADER;
+        if (priv->len < priv->seg_len) {
             ccnet_processor_send_response (processor, SC_SERVER_RET, SS_SERVER_RET,
                                            priv->buf, priv->len);
             g_free (priv->buf);
@@ -96,10 +268,12 @@ call_function_done (void *vprocessor)
         }
 
         /* we need to split data into multiple segments */
-        ccnet_processor_send_response (processor, SC_SERVER_MORE,
-                                       SS_SERVER_MORE, priv->buf,
-                                       MAX_TRANSFER_LENGTH);
-        priv->off = MAX_TRANSFER_LENGTH;
+        priv->off = 0;
+        if (priv->stream) {
+            push_segments (processor);
+            return;
+        }
+        send_next_segment (processor);
     } else {
         char *message = priv->error_message ? priv->error_message : "";
         ccnet_processor_send_response (processor, SC_SERVER_ERR, 
@@ -110,6 +284,285 @@ call_function_done (void *vprocessor)
     }
 }
 
+/* The function name is the first string of the call, ["name", ...]. */
+static char *
+get_call_fname (const char *buf, gsize len)
+{
+    const char *p = buf, *end = buf + len, *start;
+
+    while (p < end && (*p == '[' || g_ascii_isspace (*p)))
+        ++p;
+    if (p >= end || *p != '"')
+        return NULL;
+    start = ++p;
+    while (p < end && *p != '"' && *p != '\\')
+        ++p;
+    if (p >= end || *p != '"')
+        return NULL;
+
+    return g_strndup (start, p - start);
+}
+
+static void
+reject_busy (CcnetProcessor *processor, const char *fname)
+{
+    static time_t last_warning = 0;
+    time_t now = time(NULL);
+
+    if (now - last_warning >= 10) {
+        g_warning ("[rpc-server] Thread pool of %s is full, "
+                   "rejecting calls.\n", fname ? fname : "(unknown)");
+        last_warning = now;
+    }
+    ccnet_processor_send_response (processor, SC_SERVER_ERR, SS_SERVER_BUSY,
+                                   NULL, 0);
+    ccnet_processor_done (processor, FALSE);
+}
+
+/* Batch calls, see SC_CLIENT_BATCH_CALL in rpc-common.h. */
+
+#define BATCH_MAX_CALLS 1000
+#define BATCH_MAX_JOBS  4       /* of a parallel batch */
+
+#define BATCH_CALL_ERROR "{\"err_code\": 500, \"err_msg\": \"Fail to invoke the function\"}"
+
+typedef struct BatchCall {
+    char       *fname;
+    const char *call;           /* points into batch_buf */
+    gsize       call_len;
+    char       *result;
+    gsize       len;
+    gboolean    ran;            /* not answered from the cache */
+} BatchCall;
+
+typedef struct BatchJob {
+    CcnetProcessor *processor;
+    int             first;
+    int             last;       /* exclusive */
+} BatchJob;
+
+/* Split "call\0call\0...", returns -1 if it isn't in this format. */
+static int
+parse_batch (CcnetProcessor *processor, char *content, int clen)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    char *p, *end = content + clen, *next;
+    int n = 0;
+
+    if (clen <= 0 || content[clen-1] != '\0')
+        return -1;
+    for (p = content; p < end; ++p)
+        if (*p == '\0')
+            ++n;
+    if (n > BATCH_MAX_CALLS)
+        return -1;
+
+    priv->batch_buf = g_memdup (content, clen);
+    priv->calls = g_new0 (BatchCall, n);
+    priv->n_calls = n;
+
+    for (n = 0, p = priv->batch_buf; n < priv->n_calls; ++n, p = next) {
+        next = p + strlen (p) + 1;
+        priv->calls[n].call = p;
+        priv->calls[n].call_len = next - p - 1;
+        priv->calls[n].fname = get_call_fname (p, next - p - 1);
+    }
+    return 0;
+}
+
+static void
+run_batch_calls (CcnetProcessor *processor, int first, int last)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    BatchCall *bc;
+    int i;
+
+    for (i = first; i < last; ++i) {
+        bc = &priv->calls[i];
+        if (!bc->ran)
+            continue;
+        bc->result = call_function (processor->name, bc->fname,
+                                    (char *)bc->call, bc->call_len, &bc->len);
+    }
+}
+
+/* Pass the results to the cache and free the batch. */
+static void
+finish_batch (CcnetProcessor *processor)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    CcnetRpcCache *cache = get_rpc_cache (processor);
+    BatchCall *bc;
+    int i;
+
+    for (i = 0; i < priv->n_calls; ++i) {
+        bc = &priv->calls[i];
+        if (bc->ran)
+            ccnet_rpc_cache_end_call (cache, bc->fname, bc->call, bc->call_len,
+                                      priv->cache_gen, bc->result, bc->len);
+        g_free (bc->fname);
+        g_free (bc->result);
+    }
+    g_free (priv->calls);
+    priv->calls = NULL;
+    priv->n_calls = 0;
+    g_free (priv->batch_buf);
+    priv->batch_buf = NULL;
+}
+
+/* Concatenate the results, each ends with '\0', and send them. */
+static void
+batch_done (void *vprocessor)
+{
+    CcnetProcessor *processor = vprocessor;
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    GString *buf = g_string_new (NULL);
+    BatchCall *bc;
+    int i;
+
+    for (i = 0; i < priv->n_calls; ++i) {
+        bc = &priv->calls[i];
+        if (bc->result)
+            g_string_append_len (buf, bc->result, bc->len);
+        else
+            g_string_append (buf, BATCH_CALL_ERROR);
+        g_string_append_c (buf, '\0');
+    }
+    finish_batch (processor);
+
+    priv->len = buf->len;
+    priv->buf = g_string_free (buf, FALSE);
+    call_function_done (processor);
+}
+
+static void *
+batch_job (void *vprocessor)
+{
+    CcnetProcessor *processor = vprocessor;
+
+    run_batch_calls (processor, 0, GET_PRIV (processor)->n_calls);
+    return vprocessor;
+}
+
+static void *
+batch_part_job (void *vjob)
+{
+    BatchJob *job = vjob;
+
+    run_batch_calls (job->processor, job->first, job->last);
+    return vjob;
+}
+
+/* Like processor_thread_done(), once the last part is done. */
+static void
+batch_part_done (void *vjob)
+{
+    BatchJob *job = vjob;
+    CcnetProcessor *processor = job->processor;
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+
+    g_free (job);
+    if (--priv->n_running > 0)
+        return;
+
+    processor->thread_running = FALSE;
+    if (processor->delay_shutdown)
+        ccnet_processor_done (processor, processor->was_success);
+    else
+        batch_done (processor);
+}
+
+/* Split the calls into up to BATCH_MAX_JOBS jobs of the pool. */
+static void
+schedule_batch_parts (CcnetProcessor *processor, CcnetJobManager *pool,
+                      int n_run)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    int n_jobs = MIN (n_run, BATCH_MAX_JOBS);
+    int per_job = (n_run + n_jobs - 1) / n_jobs;
+    int i, count = 0, first = 0;
+    BatchJob *job;
+
+    for (i = 0; i < priv->n_calls; ++i) {
+        if (priv->calls[i].ran)
+            ++count;
+        if (count == per_job || (count > 0 && i == priv->n_calls - 1)) {
+            job = g_new0 (BatchJob, 1);
+            job->processor = processor;
+            job->first = first;
+            job->last = i + 1;
+            ++priv->n_running;
+            ccnet_job_manager_schedule_job (pool, batch_part_job,
+                                            batch_part_done, job);
+            first = i + 1;
+            count = 0;
+        }
+    }
+    processor->thread_running = TRUE;
+}
+
+static void
+start_batch (CcnetProcessor *processor, gboolean parallel,
+             char *content, int clen)
+{
+    CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
+    CcnetRpcCache *cache = get_rpc_cache (processor);
+    CcnetJobManager *pool;
+    BatchCall *bc;
+    gboolean use_cache = TRUE;
+    int i, n_run = 0;
+
+    if (parse_batch (processor, content, clen) < 0) {
+        g_warning ("[rpc-server] Bad batch call.\n");
+        ccnet_processor_send_response (processor, SC_BAD_UPDATE_CODE,
+                                       SS_BAD_UPDATE_CODE, NULL, 0);
+        ccnet_processor_done (processor, FALSE);
+        return;
+    }
+
+    /* the whole batch runs in the pool of its first call */
+    pool = ccnet_session_get_rpc_pool (processor->session,
+                                       priv->n_calls ? priv->calls[0].fname
+                                       : NULL);
+    if (ccnet_job_manager_is_full (pool)) {
+        /* release_resource() frees the batch */
+        reject_busy (processor, priv->n_calls ? priv->calls[0].fname : NULL);
+        return;
+    }
+
+    priv->stream = FALSE;
+    priv->cache_gen = cache->generation;
+
+    /* the calls of a parallel batch run in any order, a cached result
+     * may be older than a write of the same batch */
+    if (parallel) {
+        for (i = 0; i < priv->n_calls; ++i)
+            if (ccnet_rpc_cache_is_writer (cache, priv->calls[i].fname))
+                use_cache = FALSE;
+    }
+
+    for (i = 0; i < priv->n_calls; ++i) {
+        bc = &priv->calls[i];
+        /* in a sequential batch, the calls after a write must see it */
+        if (ccnet_rpc_cache_is_writer (cache, bc->fname))
+            use_cache = FALSE;
+        if (!use_cache ||
+            !ccnet_rpc_cache_lookup (cache, bc->fname, bc->call, bc->call_len,
+                                     &bc->result, &bc->len)) {
+            bc->ran = TRUE;
+            ++n_run;
+        }
+    }
+
+    if (n_run == 0)
+        batch_done (processor);
+    else if (parallel && n_run > 1)
+        schedule_batch_parts (processor, pool, n_run);
+    else
+        ccnet_processor_thread_create (processor, pool,
+                                       batch_job, batch_done, processor);
+}
+
 static void
 handle_update (CcnetProcessor *processor,
                char *code, char *code_msg,
@@ -117,31 +570,62 @@ handle_update (CcnetProcessor *processor,
 {
     CcnetThreadedRpcserverProcPriv *priv = GET_PRIV (processor);
 
-    if (memcmp (code, SC_CLIENT_CALL, 3) == 0) {
+    if (memcmp (code, SC_CLIENT_CALL, 3) == 0 ||
+        memcmp (code, SC_CLIENT_STREAM_CALL, 3) == 0) {
+        char *fname = get_call_fname (content, clen);
+        CcnetRpcCache *cache = get_rpc_cache (processor);
+        CcnetJobManager *pool;
+
+        priv->stream = (memcmp (code, SC_CLIENT_STREAM_CALL, 3) == 0);
+        priv->credits = RPC_STREAM_WINDOW;
+
+        if (ccnet_rpc_cache_lookup (cache, fname, content, clen,
+                                    &priv->buf, &priv->len)) {
+            g_free (fname);
+            call_function_done (processor);
+            return;
+        }
+
+        pool = ccnet_session_get_rpc_pool (processor->session, fname);
+        if (ccnet_job_manager_is_full (pool)) {
+            reject_busy (processor, fname);
+            g_free (fname);
+            return;
+        }
+
+        priv->fname = fname;
+        priv->cache_gen = cache->generation;
         priv->call_buf = g_memdup (content, clen);
         priv->call_len = (gsize)clen;
         ccnet_processor_thread_create (processor,
-                                       NULL,
+                                       pool,
                                        call_function_job,
                                        call_function_done,
                                        processor);
         return;
     }
 
+    if (memcmp (code, SC_CLIENT_BATCH_CALL, 3) == 0 ||
+        memcmp (code, SC_CLIENT_PARALLEL_BATCH_CALL, 3) == 0) {
+        start_batch (processor,
+                     memcmp (code, SC_CLIENT_PARALLEL_BATCH_CALL, 3) == 0,
+                     content, clen);
+        return;
+    }
+
     if (memcmp (code, SC_CLIENT_MORE, 3) == 0) {
-        if (priv->off + MAX_TRANSFER_LENGTH < priv->len) {
-            ccnet_processor_send_response (
-                processor, SC_SERVER_MORE, SS_SERVER_MORE,
-                priv->buf + priv->off, MAX_TRANSFER_LENGTH);
-            priv->off += MAX_TRANSFER_LENGTH;
-        } else {
-            ccnet_processor_send_response (
-                processor, SC_SERVER_RET, SS_SERVER_RET,
-                priv->buf + priv->off, priv->len - priv->off);
-            g_free (priv->buf);
-            priv->buf = NULL;
-            /* ccnet_processor_done (processor, TRUE); */
-        }
+        if (priv->buf)
+            send_next_segment (processor);
+        return;
+    }
+
+    if (memcmp (code, SC_CLIENT_CREDIT, 3) == 0) {
+        /* A late credit for a finished stream is harmless. */
+        if (clen > 0 && content[clen-1] == '\0')
+            priv->credits += atoi (content);
+        if (priv->credits > RPC_STREAM_WINDOW)
+            priv->credits = RPC_STREAM_WINDOW;
+        push_segments (processor);
         return;
     }
 
@@ -26,5 +26,10 @@ struct _CcnetThreadedRpcserverProcClass {
 
 GType ccnet_threaded_rpcserver_proc_get_type ();
 
+/* Database queries of the calls to @fname: "calls", "queries" (total) or
+ * "max" (of one call). -1 for an unknown @name. */
+gint64
+ccnet_threaded_rpcserver_get_query_stat (const char *fname, const char *name);
+
 #endif
 
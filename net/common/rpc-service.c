@@ -9,6 +9,7 @@
 #include "peer.h"
 #include "session.h"
 #include "peer-mgr.h"
+#include "connect-mgr.h"
 
 #include "proc-factory.h"
 #include "rpc-service.h"
@@ -24,6 +25,7 @@
 
 #ifdef CCNET_SERVER
 #include "server-session.h"
+#include "rpc-cache.h"
 #endif
 
 #define DEBUG_FLAG CCNET_DEBUG_OTHER
@@ -40,9 +42,83 @@ extern CcnetSession *session;
 #include "searpc-signature.h"
 #include "searpc-marshal.h"
 
+#ifdef CCNET_SERVER
+/* Threaded rpcs that may be slow: password hashing and LDAP binds go to
+ * "auth", full listings and searches to "rpc-slow". */
+static const struct {
+    const char *fname;
+    const char *pool;
+} rpc_pools[] = {
+    { "add_emailuser",          "auth" },
+    { "validate_emailuser",     "auth" },
+    { "update_emailuser",       "auth" },
+    { "get_emailusers",         "rpc-slow" },
+    { "search_emailusers",      "rpc-slow" },
+    { "count_emailusers",       "rpc-slow" },
+    { "get_superusers",         "rpc-slow" },
+    { "get_all_groups",         "rpc-slow" },
+    { "get_all_orgs",           "rpc-slow" },
+    { "get_org_emailusers",     "rpc-slow" },
+};
+
+/* Read-mostly rpcs whose results may be cached, and the rpcs that
+ * change what they return. See rpc-cache.h. */
+static const struct {
+    const char *fname;
+    int domains;
+} cached_rpcs[] = {
+    { "get_emailuser",          RPC_CACHE_USER },
+    { "get_emailuser_by_id",    RPC_CACHE_USER },
+    { "get_superusers",         RPC_CACHE_USER },
+    { "filter_emailusers_by_emails", RPC_CACHE_USER },
+    { "get_groups",             RPC_CACHE_GROUP },
+    { "get_group",              RPC_CACHE_GROUP },
+    { "get_group_members",      RPC_CACHE_GROUP },
+    { "check_group_staff",      RPC_CACHE_GROUP },
+    { "is_group_user",          RPC_CACHE_GROUP },
+    { "get_org_by_url_prefix",  RPC_CACHE_ORG },
+    { "get_org_by_id",          RPC_CACHE_ORG },
+    { "get_orgs_by_user",       RPC_CACHE_ORG },
+    { "is_org_group",           RPC_CACHE_ORG },
+    { "get_org_id_by_group",    RPC_CACHE_ORG },
+    { "get_org_groups",         RPC_CACHE_ORG | RPC_CACHE_GROUP },
+    { "org_user_exists",        RPC_CACHE_ORG },
+    { "is_org_staff",           RPC_CACHE_ORG },
+}, mutating_rpcs[] = {
+    { "add_emailuser",          RPC_CACHE_USER },
+    { "remove_emailuser",       RPC_CACHE_USER | RPC_CACHE_GROUP | RPC_CACHE_ORG },
+    { "update_emailuser",       RPC_CACHE_USER },
+    { "update_role_emailuser",  RPC_CACHE_USER },
+    { "create_group",           RPC_CACHE_GROUP },
+    { "create_org_group",       RPC_CACHE_GROUP | RPC_CACHE_ORG },
+    { "remove_group",           RPC_CACHE_GROUP | RPC_CACHE_ORG },
+    { "group_add_member",       RPC_CACHE_GROUP },
+    { "group_add_members",      RPC_CACHE_GROUP },
+    { "group_remove_member",    RPC_CACHE_GROUP },
+    { "group_set_admin",        RPC_CACHE_GROUP },
+    { "group_unset_admin",      RPC_CACHE_GROUP },
+    { "set_group_name",         RPC_CACHE_GROUP },
+    { "quit_group",             RPC_CACHE_GROUP },
+    { "remove_group_user",      RPC_CACHE_GROUP },
+    { "set_group_creator",      RPC_CACHE_GROUP },
+    { "create_org",             RPC_CACHE_ORG },
+    { "remove_org",             RPC_CACHE_ORG | RPC_CACHE_GROUP },
+    { "add_org_user",           RPC_CACHE_ORG },
+    { "remove_org_user",        RPC_CACHE_ORG },
+    { "add_org_group",          RPC_CACHE_ORG | RPC_CACHE_GROUP },
+    { "remove_org_group",       RPC_CACHE_ORG | RPC_CACHE_GROUP },
+    { "set_org_staff",          RPC_CACHE_ORG },
+    { "unset_org_staff",        RPC_CACHE_ORG },
+};
+#endif
+
 void
 ccnet_start_rpc(CcnetSession *session)
 {
+#ifdef CCNET_SERVER
+    int i;
+#endif
+
     searpc_server_init (register_marshals);
 
     searpc_create_service ("ccnet-rpcserver");
@@ -131,6 +207,16 @@ ccnet_start_rpc(CcnetSession *session)
                                      "privkey_decrypt",
                                      searpc_signature_string__string());
 
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_accept_stat,
+                                     "get_accept_stat",
+                                     searpc_signature_int__string());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_proc_pool_stat,
+                                     "get_proc_pool_stat",
+                                     searpc_signature_int__string());
+
 #ifdef CCNET_SERVER
 
     searpc_server_register_function ("ccnet-rpcserver",
@@ -138,6 +224,36 @@ ccnet_start_rpc(CcnetSession *session)
                                      "list_peer_stat",
                                      searpc_signature_objlist__void());
 
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_crypto_queue_depth,
+                                     "get_crypto_queue_depth",
+                                     searpc_signature_int__void());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_resume_attempts,
+                                     "get_resume_attempts",
+                                     searpc_signature_int__void());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_resume_hits,
+                                     "get_resume_hits",
+                                     searpc_signature_int__void());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_rpc_cache_stat,
+                                     "get_rpc_cache_stat",
+                                     searpc_signature_int__string());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_db_stat,
+                                     "get_db_stat",
+                                     searpc_signature_int__string());
+
+    searpc_server_register_function ("ccnet-rpcserver",
+                                     ccnet_rpc_get_rpc_query_stat,
+                                     "get_rpc_query_stat",
+                                     searpc_signature_int__string_string());
+
 
     searpc_server_register_function ("ccnet-threaded-rpcserver",
                                      ccnet_rpc_add_emailuser,
@@ -171,6 +287,10 @@ ccnet_start_rpc(CcnetSession *session)
                                      ccnet_rpc_count_emailusers,
                                      "count_emailusers",
                                      searpc_signature_int64__void());
+    searpc_server_register_function ("ccnet-threaded-rpcserver",
+                                     ccnet_rpc_filter_emailusers_by_emails,
+                                     "filter_emailusers_by_emails",
+                                     searpc_signature_objlist__string());
     searpc_server_register_function ("ccnet-threaded-rpcserver",
                                      ccnet_rpc_update_emailuser,
                                      "update_emailuser",
@@ -212,6 +332,10 @@ ccnet_start_rpc(CcnetSession *session)
                                      ccnet_rpc_group_add_member,
                                      "group_add_member",
                                      searpc_signature_int__int_string_string());
+    searpc_server_register_function ("ccnet-threaded-rpcserver",
+                                     ccnet_rpc_group_add_members,
+                                     "group_add_members",
+                                     searpc_signature_int__int_string_string());
     searpc_server_register_function ("ccnet-threaded-rpcserver",
                                      ccnet_rpc_group_remove_member,
                                      "group_remove_member",
@@ -337,6 +461,19 @@ ccnet_start_rpc(CcnetSession *session)
                                      ccnet_rpc_unset_org_staff,
                                      "unset_org_staff",
                                      searpc_signature_int__int_string());
+
+    /* Everything else runs in "rpc-fast". */
+    for (i = 0; i < G_N_ELEMENTS(rpc_pools); ++i)
+        ccnet_session_set_rpc_pool (session, rpc_pools[i].fname,
+                                    rpc_pools[i].pool);
+
+    CcnetRpcCache *cache = ((CcnetServerSession *)session)->rpc_cache;
+    for (i = 0; i < G_N_ELEMENTS(cached_rpcs); ++i)
+        ccnet_rpc_cache_add_reader (cache, cached_rpcs[i].fname,
+                                    cached_rpcs[i].domains);
+    for (i = 0; i < G_N_ELEMENTS(mutating_rpcs); ++i)
+        ccnet_rpc_cache_add_writer (cache, mutating_rpcs[i].fname,
+                                    mutating_rpcs[i].domains);
     
 
 #endif  /* CCNET_SERVER */
@@ -584,6 +721,40 @@ ccnet_rpc_privkey_decrypt (const char *msg_base64, GError **error)
     return ret;
 }
 
+int
+ccnet_rpc_get_accept_stat (const char *name, GError **error)
+{
+    CcnetConnManager *conn_mgr = session->connMgr;
+
+    if (g_strcmp0 (name, "accepted") == 0)
+        return conn_mgr->n_accepted;
+    if (g_strcmp0 (name, "overflows") == 0)
+        return conn_mgr->n_accept_overflows;
+    if (g_strcmp0 (name, "local-accepted") == 0)
+        return session->local_accepted;
+    if (g_strcmp0 (name, "local-overflows") == 0)
+        return session->local_accept_overflows;
+
+    g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL, "Invalid argument");
+    return -1;
+}
+
+int
+ccnet_rpc_get_proc_pool_stat (const char *name, GError **error)
+{
+    CcnetProcFactory *factory = session->proc_factory;
+
+    if (g_strcmp0 (name, "hits") == 0)
+        return factory->pool_hits;
+    if (g_strcmp0 (name, "misses") == 0)
+        return factory->pool_misses;
+    if (g_strcmp0 (name, "pooled") == 0)
+        return factory->procs_pooled;
+
+    g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL, "Invalid argument");
+    return -1;
+}
+
 #ifdef CCNET_SERVER
 
 #include "user-mgr.h"
@@ -631,6 +802,102 @@ ccnet_rpc_list_peer_stat (GError **error)
     return g_list_reverse (res);
 }
 
+int
+ccnet_rpc_get_crypto_queue_depth (GError **error)
+{
+    return ccnet_session_get_crypto_queue_depth (session);
+}
+
+int
+ccnet_rpc_get_resume_attempts (GError **error)
+{
+    return session->resume_attempts;
+}
+
+int
+ccnet_rpc_get_resume_hits (GError **error)
+{
+    return session->resume_hits;
+}
+
+int
+ccnet_rpc_get_rpc_cache_stat (const char *name, GError **error)
+{
+    CcnetRpcCache *cache = ((CcnetServerSession *)session)->rpc_cache;
+    gint64 val = ccnet_rpc_cache_get_stat (cache, name);
+
+    if (val < 0) {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "Invalid argument");
+        return -1;
+    }
+    return (int)MIN (val, G_MAXINT);
+}
+
+int
+ccnet_rpc_get_db_stat (const char *name, GError **error)
+{
+    CcnetDBStat stat;
+    gint64 val;
+
+    ccnet_db_get_stat (&stat);
+    if (g_strcmp0 (name, "prepares") == 0)
+        val = stat.n_prepares;
+    else if (g_strcmp0 (name, "stmt_hits") == 0)
+        val = stat.n_stmt_hits;
+    else if (g_strcmp0 (name, "stmt_flushes") == 0)
+        val = stat.n_stmt_flushes;
+    else if (g_strcmp0 (name, "waits") == 0)
+        val = stat.n_waits;
+    else if (g_strcmp0 (name, "timeouts") == 0)
+        val = stat.n_timeouts;
+    else if (g_strcmp0 (name, "wait_msec") == 0)
+        val = stat.wait_usec / 1000;
+    else if (g_strcmp0 (name, "wait_1ms") == 0)
+        val = stat.wait_hist[0];
+    else if (g_strcmp0 (name, "wait_10ms") == 0)
+        val = stat.wait_hist[1];
+    else if (g_strcmp0 (name, "wait_100ms") == 0)
+        val = stat.wait_hist[2];
+    else if (g_strcmp0 (name, "wait_1s") == 0)
+        val = stat.wait_hist[3];
+    else if (g_strcmp0 (name, "wait_long") == 0)
+        val = stat.wait_hist[4];
+    else if (g_strcmp0 (name, "active") == 0)
+        val = stat.n_active;
+    else if (g_strcmp0 (name, "idle") == 0)
+        val = stat.n_idle;
+    else if (g_strcmp0 (name, "waiting") == 0)
+        val = stat.n_waiting;
+    else {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "Invalid argument");
+        return -1;
+    }
+    return (int)MIN (val, G_MAXINT);
+}
+
+int
+ccnet_rpc_get_rpc_query_stat (const char *fname, const char *name,
+                              GError **error)
+{
+    gint64 val;
+
+    if (!fname) {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "Invalid argument");
+        return -1;
+    }
+
+    val = ccnet_threaded_rpcserver_get_query_stat (fname, name);
+    if (val < 0) {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "Invalid argument");
+        return -1;
+    }
+    return (int)MIN (val, G_MAXINT);
+}
+
 
 int
 ccnet_rpc_add_emailuser (const char *email, const char *passwd,
@@ -744,7 +1011,6 @@ ccnet_rpc_count_emailusers (GError **error)
    return ccnet_user_manager_count_emailusers (user_mgr);
 }
 
-#if 0
 GList*
 ccnet_rpc_filter_emailusers_by_emails (const char *emails, GError **error)
 {
@@ -756,7 +1022,6 @@ ccnet_rpc_filter_emailusers_by_emails (const char *emails, GError **error)
 
    return ccnet_user_manager_filter_emailusers_by_emails (user_mgr, emails);
 }
-#endif
 
 int
 ccnet_rpc_update_emailuser (int id, const char* passwd, int is_staff, int is_active,
@@ -913,6 +1178,36 @@ ccnet_rpc_group_add_member (int group_id, const char *user_name,
     return ret;
 }
 
+int
+ccnet_rpc_group_add_members (int group_id, const char *user_name,
+                             const char *member_names, GError **error)
+{
+    CcnetGroupManager *group_mgr = 
+        ((CcnetServerSession *)session)->group_mgr;
+    GList *members = NULL;
+    char *copy, *name, *saveptr;
+    int ret;
+
+    if (group_id <= 0 || !user_name || !member_names) {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "Group id and user name and member names can not be NULL");
+        return -1;
+    }
+
+    copy = g_strdup (member_names);
+    for (name = strtok_r (copy, ", ", &saveptr); name;
+         name = strtok_r (NULL, ", ", &saveptr))
+        members = g_list_prepend (members, name);
+    members = g_list_reverse (members);
+
+    ret = ccnet_group_manager_add_members (group_mgr, group_id, user_name,
+                                           members, error);
+
+    g_list_free (members);
+    g_free (copy);
+    return ret;
+}
+
 int
 ccnet_rpc_group_remove_member (int group_id, const char *user_name,
                                const char *member_name, GError **error)
@@ -1008,30 +1303,11 @@ ccnet_rpc_quit_group (int group_id, const char *user_name, GError **error)
     return ret;
 }
 
-static GList *
-convert_group_list (CcnetGroupManager *mgr, GList *group_ids)
-{
-    GList *ret = NULL, *ptr;
-
-    for (ptr = group_ids; ptr; ptr = ptr->next) {
-        int group_id = (int)(long)ptr->data;
-        CcnetGroup *group = ccnet_group_manager_get_group (mgr, group_id,
-                                                           NULL);
-        if (group != NULL) {
-            ret = g_list_prepend (ret, group);
-        }
-    }
-    
-    return g_list_reverse (ret);
-}
-
 GList *
 ccnet_rpc_get_groups (const char *username, GError **error)
 {
     CcnetGroupManager *group_mgr = 
         ((CcnetServerSession *)session)->group_mgr;
-    GList *group_ids = NULL;
-    GList *ret = NULL;
 
     if (!username) {
         g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
@@ -1039,16 +1315,7 @@ ccnet_rpc_get_groups (const char *username, GError **error)
         return NULL;
     }
 
-    group_ids = ccnet_group_manager_get_groupids_by_user (group_mgr, username,
-                                                          error);
-    if (group_ids == NULL) {
-        return NULL;
-    }
-
-    ret = convert_group_list (group_mgr, group_ids);
-    g_list_free (group_ids);
-
-    return ret;
+    return ccnet_group_manager_get_groups_by_user (group_mgr, username, error);
 }
 
 GList *
@@ -1167,7 +1434,7 @@ ccnet_rpc_create_org (const char *org_name, const char *url_prefix,
 int
 ccnet_rpc_remove_org (int org_id, GError **error)
 {
-    GList *group_ids = NULL, *email_list=NULL, *ptr;
+    GList *group_ids = NULL, *email_list=NULL;
     const char *url_prefix = NULL;
     CcnetOrgManager *org_mgr = ((CcnetServerSession *)session)->org_mgr;
     CcnetUserManager *user_mgr = ((CcnetServerSession *)session)->user_mgr;
@@ -1182,20 +1449,11 @@ ccnet_rpc_remove_org (int org_id, GError **error)
                                                              error);
     email_list = ccnet_org_manager_get_org_emailusers (org_mgr, url_prefix,
                                                        0, INT_MAX);
-    ptr = email_list;
-    while (ptr) {
-        ccnet_user_manager_remove_emailuser (user_mgr, (gchar *)ptr->data);
-        ptr = ptr->next;
-    }
+    ccnet_user_manager_remove_emailusers (user_mgr, email_list);
     string_list_free (email_list);
 
     group_ids = ccnet_org_manager_get_org_groups (org_mgr, org_id, 0, INT_MAX);
-    ptr = group_ids;
-    while (ptr) {
-        ccnet_group_manager_remove_group (group_mgr, (int)(long)ptr->data, NULL,
-                                          error);
-        ptr = ptr->next;
-    }
+    ccnet_group_manager_remove_groups (group_mgr, group_ids, error);
     g_list_free (group_ids);
     
     return ccnet_org_manager_remove_org (org_mgr, org_id, error);
@@ -1400,7 +1658,8 @@ ccnet_rpc_get_org_groups (int org_id, int start, int limit, GError **error)
     if (group_ids == NULL)
         return NULL;
 
-    ret = convert_group_list (group_mgr, group_ids);
+    /* OrgGroup and Group may be in different databases, no join */
+    ret = ccnet_group_manager_get_groups_by_ids (group_mgr, group_ids, error);
     g_list_free (group_ids);
 
     return ret;
@@ -82,11 +82,51 @@ ccnet_rpc_pubkey_encrypt (const char *msg_base64,
 char *
 ccnet_rpc_privkey_decrypt (const char *msg_base64, GError **error);
 
+/* Counters of the peer and local client listeners: "accepted",
+ * "overflows", "local-accepted" or "local-overflows". */
+int
+ccnet_rpc_get_accept_stat (const char *name, GError **error);
+
+/* Processor pool counters: "hits", "misses" or "pooled". */
+int
+ccnet_rpc_get_proc_pool_stat (const char *name, GError **error);
+
 #ifdef CCNET_SERVER
 
 GList *
 ccnet_rpc_list_peer_stat (GError **error);
 
+/* Number of RSA jobs of the handshake processors queued or running. */
+int
+ccnet_rpc_get_crypto_queue_depth (GError **error);
+
+/* Session resumes tried by peers and those that skipped the RSA
+ * handshake, since start. */
+int
+ccnet_rpc_get_resume_attempts (GError **error);
+
+int
+ccnet_rpc_get_resume_hits (GError **error);
+
+/* Threaded rpc cache counters: "hits", "misses", "entries", "memory"
+ * (bytes), "invalidations" or "evictions". */
+int
+ccnet_rpc_get_rpc_cache_stat (const char *name, GError **error);
+
+/* Database counters: "prepares", "stmt_hits", "stmt_flushes";
+ * connection waits: "waits", "timeouts", "wait_msec" (total), and the
+ * histogram "wait_1ms", "wait_10ms", "wait_100ms", "wait_1s" (waits
+ * shorter than that) and "wait_long"; "active", "idle" and "waiting"
+ * connections and callers now. */
+int
+ccnet_rpc_get_db_stat (const char *name, GError **error);
+
+/* Database queries of the threaded rpc @fname: "calls", "queries"
+ * (total) or "max" (of one call). */
+int
+ccnet_rpc_get_rpc_query_stat (const char *fname, const char *name,
+                              GError **error);
+
 int
 ccnet_rpc_add_emailuser (const char *email, const char *passwd,
                          int is_staff, int is_active, GError **error);
@@ -174,6 +214,14 @@ ccnet_rpc_remove_group (int group_id, const char *user_name, GError **error);
 int
 ccnet_rpc_group_add_member (int group_id, const char *user_name,
                             const char *member_name, GError **error);
+
+/**
+ * @member_names: separated by ",", members already in the group are
+ * skipped.
+ */
+int
+ccnet_rpc_group_add_members (int group_id, const char *user_name,
+                             const char *member_names, GError **error);
 int
 ccnet_rpc_group_remove_member (int group_id, const char *user_name,
                                const char *member_name, GError **error);
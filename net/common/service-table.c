@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include "service-table.h"
+
+CcnetServiceTable *
+ccnet_service_table_new ()
+{
+    CcnetServiceTable *table = g_new0 (CcnetServiceTable, 1);
+
+    table->ids = g_hash_table_new (g_str_hash, g_str_equal);
+    table->descs = g_ptr_array_new ();
+
+    return table;
+}
+
+CcnetServiceDesc *
+ccnet_service_table_intern (CcnetServiceTable *table, const char *name)
+{
+    CcnetServiceDesc *desc;
+
+    desc = g_hash_table_lookup (table->ids, name);
+    if (desc)
+        return desc;
+
+    /* descriptors are never freed, ids stay valid */
+    desc = g_new0 (CcnetServiceDesc, 1);
+    desc->id = table->descs->len;
+    desc->name = g_strdup (name);
+    g_ptr_array_add (table->descs, desc);
+    g_hash_table_insert (table->ids, desc->name, desc);
+
+    return desc;
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/**
+ * Service names are interned to small integer ids. The descriptor of
+ * an id holds everything needed to dispatch a request for it: the
+ * processor type, the permission group and the local client providing
+ * the service, so a request costs one name lookup.
+ */
+
+#ifndef CCNET_SERVICE_TABLE_H
+#define CCNET_SERVICE_TABLE_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+struct _CcnetPeer;
+
+typedef struct CcnetServiceDesc {
+    int                  id;
+    char                *name;
+
+    GType                proc_type;     /* 0 if no processor is registered */
+    int                  perm_group;    /* group id from the perm manager,
+                                         * 0 if not open to network peers */
+    struct _CcnetPeer   *provider;      /* local client serving it, or NULL */
+} CcnetServiceDesc;
+
+typedef struct CcnetServiceTable {
+    GHashTable          *ids;           /* name -> descriptor */
+    GPtrArray           *descs;         /* id -> descriptor */
+} CcnetServiceTable;
+
+CcnetServiceTable *ccnet_service_table_new ();
+
+/* The descriptor of @name, created if @name is new. */
+CcnetServiceDesc *
+ccnet_service_table_intern (CcnetServiceTable *table, const char *name);
+
+/* NULL if @name was never interned. */
+static inline CcnetServiceDesc *
+ccnet_service_table_lookup (CcnetServiceTable *table, const char *name)
+{
+    return g_hash_table_lookup (table->ids, name);
+}
+
+static inline CcnetServiceDesc *
+ccnet_service_table_get (CcnetServiceTable *table, int id)
+{
+    if (id < 0 || id >= table->descs->len)
+        return NULL;
+    return g_ptr_array_index (table->descs, id);
+}
+
+#endif
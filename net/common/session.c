@@ -7,6 +7,9 @@
 #include <sys/stat.h>
 #include <time.h>
 
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
 #include "getgateway.h"
 #include "utils.h"
 #include "net.h"
@@ -23,13 +26,34 @@
 #include "message-manager.h"
 #include "algorithms.h"
 #include "proc-factory.h"
+#include "service-table.h"
 
 #define DEBUG_FLAG CCNET_DEBUG_OTHER
 #include "log.h"
 
 #define THREAD_POOL_SIZE 50
 
-static void ccnet_service_free (CcnetService *service);
+/* RSA operations get their own small pool, so that a reconnect storm
+ * neither blocks the main loop nor eats the general job threads. */
+#define CRYPTO_THREAD_POOL_SIZE 4
+#define CRYPTO_QUEUE_MAX 2048
+
+/* Named worker pools, so that slow work (LDAP binds, big listings, DNS)
+ * can't take all threads from cheap RPCs. Sizes can be changed in the
+ * [ThreadPools] section, e.g. RPC_SLOW_THREADS and RPC_SLOW_QUEUE. */
+static const struct {
+    const char *name;
+    int         max_threads;
+    int         max_queue;      /* 0 for no limit */
+} default_job_pools[] = {
+    { "default",  THREAD_POOL_SIZE,        0 },
+    { "crypto",   CRYPTO_THREAD_POOL_SIZE, CRYPTO_QUEUE_MAX },
+    { "rpc-fast", 16,                      1024 },
+    { "rpc-slow", 8,                       256 },
+    { "auth",     8,                       256 },
+    { "dns",      4,                       256 },
+};
+
 
 
 G_DEFINE_TYPE (CcnetSession, ccnet_session, CCNET_TYPE_SESSION_BASE);
@@ -43,19 +67,84 @@ ccnet_session_class_init (CcnetSessionClass *klass)
     /* GObjectClass *gobject_class = G_OBJECT_CLASS (klass); */
 }
 
+static int
+create_job_pools (CcnetSession *session)
+{
+    CcnetJobManager *mgr;
+    int i;
+
+    session->job_pools = g_hash_table_new (g_str_hash, g_str_equal);
+    session->rpc_pools = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(default_job_pools); ++i) {
+        mgr = ccnet_job_manager_new (default_job_pools[i].max_threads);
+        if (!mgr) {
+            ccnet_warning ("Failed to create job pool %s.\n",
+                           default_job_pools[i].name);
+            return -1;
+        }
+        ccnet_job_manager_set_limits (mgr, default_job_pools[i].max_threads,
+                                      default_job_pools[i].max_queue);
+        g_hash_table_insert (session->job_pools,
+                             (gpointer)default_job_pools[i].name, mgr);
+    }
+
+    session->job_mgr = g_hash_table_lookup (session->job_pools, "default");
+    session->crypto_job_mgr = g_hash_table_lookup (session->job_pools,
+                                                   "crypto");
+    return 0;
+}
+
+/* [ThreadPools] <NAME>_THREADS and <NAME>_QUEUE, NAME is the pool name
+ * in upper case with '-' replaced by '_'. */
+static void
+load_job_pool_config (CcnetSession *session, GKeyFile *key_file)
+{
+    CcnetJobManager *mgr;
+    char *prefix, *key, *p;
+    int i, threads, queue;
+
+    for (i = 0; i < G_N_ELEMENTS(default_job_pools); ++i) {
+        mgr = g_hash_table_lookup (session->job_pools,
+                                   default_job_pools[i].name);
+        prefix = g_ascii_strup (default_job_pools[i].name, -1);
+        for (p = prefix; *p; ++p)
+            if (*p == '-')
+                *p = '_';
+
+        key = g_strconcat (prefix, "_THREADS", NULL);
+        threads = g_key_file_get_integer (key_file, "ThreadPools", key, NULL);
+        g_free (key);
+
+        key = g_strconcat (prefix, "_QUEUE", NULL);
+        queue = mgr->max_queue;
+        if (g_key_file_has_key (key_file, "ThreadPools", key, NULL))
+            queue = MAX (g_key_file_get_integer (key_file, "ThreadPools",
+                                                 key, NULL), 0);
+        g_free (key);
+        g_free (prefix);
+
+        ccnet_job_manager_set_limits (mgr, threads > 0 ? threads :
+                                      mgr->max_threads, queue);
+    }
+}
+
 static void
 ccnet_session_init (CcnetSession *session)
 {
     /* note, the order is important. */
-    session->service_hash = g_hash_table_new_full (
-        g_str_hash, g_str_equal, 
-        g_free, (GDestroyNotify)ccnet_service_free);
+    session->service_table = ccnet_service_table_new ();
     session->proc_factory = ccnet_proc_factory_new (session);
     session->peer_mgr = ccnet_peer_manager_new (session);
     session->connMgr = ccnet_conn_manager_new (session);
     session->msg_mgr = ccnet_message_manager_new (session);
     session->perm_mgr = ccnet_perm_manager_new (session);
-    session->job_mgr = ccnet_job_manager_new (THREAD_POOL_SIZE);
+    ccnet_openssl_thread_setup ();
+
+    /* tickets don't survive a restart, peers fall back to a full
+     * key exchange then */
+    RAND_bytes (session->ticket_key, sizeof(session->ticket_key));
 }
 
 static int load_rsakey(CcnetSession *session)
@@ -97,7 +186,7 @@ ccnet_session_load_config (CcnetSession *session, const char *config_dir_r)
     int ret = 0;
     char *config_file, *config_dir;
     char *id = NULL, *name = NULL, *port_str = NULL,
-        *lport_str = NULL, *un_path = NULL,
+        *lport_str = NULL, *un_path = NULL, *backlog_str = NULL,
         *user_name = NULL;
 #ifdef CCNET_SERVER
     char *service_url;
@@ -132,6 +221,9 @@ ccnet_session_load_config (CcnetSession *session, const char *config_dir_r)
 #endif
     port_str = ccnet_key_file_get_string (key_file, "Network", "PORT");
 
+    backlog_str = ccnet_key_file_get_string (key_file, "Network",
+                                             "LISTEN_BACKLOG");
+
     lport_str = ccnet_key_file_get_string (key_file, "Client", "PORT");
     un_path = ccnet_key_file_get_string (key_file, "Client", "UNIX_SOCKET");
     
@@ -150,6 +242,17 @@ ccnet_session_load_config (CcnetSession *session, const char *config_dir_r)
     if (lport_str)
         local_port = atoi (lport_str);
 
+    session->listen_backlog = SOMAXCONN;
+    if (backlog_str && atoi (backlog_str) > 0)
+        session->listen_backlog = atoi (backlog_str);
+
+    /* here and not in init, creating them can fail */
+    if (create_job_pools (session) < 0) {
+        ret = -1;
+        goto onerror;
+    }
+    load_job_pool_config (session, key_file);
+
     memcpy (session->base.id, id, 40);
     session->base.id[40] = '\0';
     session->base.name = g_strdup(name);
@@ -174,6 +277,7 @@ onerror:
     g_free (user_name);
     g_free (port_str);
     g_free (lport_str);
+    g_free (backlog_str);
 #ifdef CCNET_SERVER
     g_free (service_url);
 #endif
@@ -362,6 +466,24 @@ static const char *net_status_string (int status)
     }
 }
 
+#define LOCAL_ACCEPT_BATCH      16
+#define LOCAL_ACCEPT_PAUSE_MSEC 100
+
+static int
+resume_local_listen (void *vsession)
+{
+    CcnetSession *session = vsession;
+
+#ifdef WIN32
+    event_add (&session->local_event, NULL);
+#else
+    event_add (&session->local_pipe_event, NULL);
+#endif
+    /* the timer frees itself */
+    session->local_listen_timer = NULL;
+    return FALSE;
+}
+
 static void accept_local_client (int fd, short event, void *vsession)
 {
     CcnetSession *session = vsession;
@@ -369,19 +491,42 @@ static void accept_local_client (int fd, short event, void *vsession)
     int connfd;
     CcnetPeer *peer;
     static int local_id = 0;
+    int i;
+
+    for (i = 0; i < LOCAL_ACCEPT_BATCH; ++i) {
+        connfd = accept (fd, NULL, 0);
+        if (connfd < 0) {
+            int err = EVUTIL_SOCKET_ERROR();
+
+            /* out of fds, back off instead of spinning on the listener */
+            if (ccnet_net_accept_resource_error (err)) {
+                session->local_accept_overflows++;
+                ccnet_warning ("Failed to accept local client: %s\n",
+                               evutil_socket_error_to_string (err));
+#ifdef WIN32
+                event_del (&session->local_event);
+#else
+                event_del (&session->local_pipe_event);
+#endif
+                ccnet_timer_free (&session->local_listen_timer);
+                session->local_listen_timer = ccnet_timer_new (
+                    resume_local_listen, session, LOCAL_ACCEPT_PAUSE_MSEC);
+            }
+            return;
+        }
 
-    connfd = accept (fd, NULL, 0);
-
-    ccnet_message ("Accepted a local client\n");
-
-    io = ccnet_packet_io_new_incoming (session, NULL, connfd);
-    peer = ccnet_peer_new (session->base.id);
-    peer->name = g_strdup_printf("local-%d", local_id++);
-    peer->is_local = TRUE;
-    ccnet_peer_set_io (peer, io);
-    ccnet_peer_set_net_state (peer, PEER_CONNECTED);
-    ccnet_peer_manager_add_local_peer (session->peer_mgr, peer);
-    g_object_unref (peer);
+        session->local_accepted++;
+        ccnet_message ("Accepted a local client\n");
+
+        io = ccnet_packet_io_new_incoming (session, NULL, connfd);
+        peer = ccnet_peer_new (session->base.id);
+        peer->name = g_strdup_printf("local-%d", local_id++);
+        peer->is_local = TRUE;
+        ccnet_peer_set_io (peer, io);
+        ccnet_peer_set_net_state (peer, PEER_CONNECTED);
+        ccnet_peer_manager_add_local_peer (session->peer_mgr, peer);
+        g_object_unref (peer);
+    }
 }
 
 static void listen_on_localhost (CcnetSession *session)
@@ -394,7 +539,8 @@ static void listen_on_localhost (CcnetSession *session)
     }
     ccnet_message ("Listen on 127.0.0.1 %d\n", session->local_port);
 
-    listen (sockfd, 5);
+    evutil_make_socket_nonblocking (sockfd);
+    listen (sockfd, session->listen_backlog);
     event_set (&session->local_event, sockfd, EV_READ | EV_PERSIST, 
                accept_local_client, session);
     event_add (&session->local_event, NULL);
@@ -443,7 +589,9 @@ static void listen_on_pipe (CcnetSession *session)
         goto failed;
     }
 
-    if (listen(pipe_fd, 3) < 0) {
+    /* accept_local_client takes several clients per wakeup */
+    evutil_make_socket_nonblocking (pipe_fd);
+    if (listen(pipe_fd, session->listen_backlog) < 0) {
         ccnet_warning ("failed to listen to unix socket: %s\n", strerror(errno));
         goto failed;
     }
@@ -522,23 +670,16 @@ ccnet_session_start (CcnetSession *session)
     ccnet_peer_manager_start (session->peer_mgr);
 }
 
-
-static void
-ccnet_service_free (CcnetService *service)
-{
-    g_free (service->svc_name);
-    g_free (service);
-}
-
 int
 ccnet_session_register_service (CcnetSession *session,
                                 const char *svc_name,
                                 const char *group,
                                 CcnetPeer *peer)
 {
-    CcnetService *service = g_new0 (CcnetService, 1);
+    CcnetServiceDesc *desc;
 
-    if (g_hash_table_lookup (session->service_hash, svc_name)) {
+    desc = ccnet_service_table_intern (session->service_table, svc_name);
+    if (desc->provider) {
         ccnet_debug ("[Service] Service %s has already been registered\n",
                      svc_name);
         return -1;
@@ -548,49 +689,64 @@ ccnet_session_register_service (CcnetSession *session,
     ccnet_perm_manager_register_service (session->perm_mgr, svc_name,
                                          group, peer);
 
-    service->svc_name = g_strdup(svc_name);
-    service->provider = peer;
-
-    g_hash_table_insert (session->service_hash, g_strdup(svc_name), service);
+    desc->provider = peer;
 
     return 0;
 }
 
-CcnetService*
+CcnetServiceDesc *
 ccnet_session_get_service (CcnetSession *session,
                            const char *svc_name)
 {
-    return g_hash_table_lookup (session->service_hash, svc_name);
-}
-
-gboolean remove_service_cmp (gpointer key,
-                             gpointer value,
-                             gpointer user_data)
-{
-    CcnetService *service = value;
+    CcnetServiceDesc *desc;
 
-    if (service->provider == user_data) {
-        ccnet_debug ("[Service] Service %s un-registered\n", (char *)key);
-        return TRUE;
-    }
-    return FALSE;
+    desc = ccnet_service_table_lookup (session->service_table, svc_name);
+    return (desc && desc->provider) ? desc : NULL;
 }
 
 void
 ccnet_session_unregister_service (CcnetSession *session,
                                   CcnetPeer *peer)
 {
-    g_hash_table_foreach_remove (session->service_hash, 
-                                 remove_service_cmp, peer);
+    GPtrArray *descs = session->service_table->descs;
+    CcnetServiceDesc *desc;
+    int i;
+
+    for (i = 0; i < descs->len; ++i) {
+        desc = g_ptr_array_index (descs, i);
+        if (desc->provider == peer) {
+            ccnet_debug ("[Service] Service %s un-registered\n", desc->name);
+            desc->provider = NULL;
+        }
+    }
 }
 
 
+static void
+issue_ticket (CcnetSession *session, CcnetPeer *peer)
+{
+    CcnetProcessor *processor;
+
+    processor = ccnet_proc_factory_create_master_processor (
+        session->proc_factory, "send-ticket", peer);
+    if (!processor) {
+        ccnet_warning ("create send ticket processor failed\n");
+        return;
+    }
+    ccnet_processor_startl (processor, NULL);
+}
+
 static void on_peer_auth_done (CcnetPeerManager *manager,
                                CcnetPeer *peer, gpointer user_data)
 {
     CcnetSession *session = (CcnetSession *)user_data;
     
     CCNET_SESSION_GET_CLASS (session)->on_peer_auth_done(session, peer);
+
+    /* hand a resumption ticket to peers connecting to us */
+    if (peer->io && ccnet_packet_io_is_incoming (peer->io) &&
+        peer->session_key)
+        issue_ticket (session, peer);
 }
 
 
@@ -599,3 +755,200 @@ ccnet_session_should_encrypt_channel (CcnetSession *session)
 {
     return session->encrypt_channel;
 }
+
+CcnetJobManager *
+ccnet_session_get_job_pool (CcnetSession *session, const char *name)
+{
+    CcnetJobManager *mgr = NULL;
+
+    if (name)
+        mgr = g_hash_table_lookup (session->job_pools, name);
+    return mgr ? mgr : session->job_mgr;
+}
+
+void
+ccnet_session_set_rpc_pool (CcnetSession *session,
+                            const char *fname, const char *pool)
+{
+    CcnetJobManager *mgr = g_hash_table_lookup (session->job_pools, pool);
+
+    if (!mgr) {
+        ccnet_warning ("Unknown thread pool %s for rpc %s\n", pool, fname);
+        return;
+    }
+    g_hash_table_replace (session->rpc_pools, g_strdup(fname), mgr);
+}
+
+CcnetJobManager *
+ccnet_session_get_rpc_pool (CcnetSession *session, const char *fname)
+{
+    CcnetJobManager *mgr = NULL;
+
+    if (fname)
+        mgr = g_hash_table_lookup (session->rpc_pools, fname);
+    return mgr ? mgr : ccnet_session_get_job_pool (session, "rpc-fast");
+}
+
+int
+ccnet_session_get_crypto_queue_depth (CcnetSession *session)
+{
+    return session->crypto_job_mgr->n_pending;
+}
+
+gboolean
+ccnet_session_crypto_queue_full (CcnetSession *session)
+{
+    static time_t last_warning = 0;
+    time_t now;
+
+    if (!ccnet_job_manager_is_full (session->crypto_job_mgr))
+        return FALSE;
+
+    now = time(NULL);
+    if (now - last_warning >= 10) {
+        ccnet_warning ("Crypto queue is full (%d jobs), rejecting peers.\n",
+                       session->crypto_job_mgr->n_pending);
+        last_warning = now;
+    }
+    return TRUE;
+}
+
+/* -------- session resumption -------- */
+
+unsigned char *
+ccnet_session_seal_ticket (CcnetSession *session,
+                           const char *peer_id,
+                           const char *secret,
+                           int *ticket_len)
+{
+    GString *plain;
+    uint8_t expire[8], *ptr = expire;
+    unsigned char *ticket;
+
+    /* <peer id (40)> <expire time (8)> <secret> */
+    put64bit (&ptr, (uint64_t)time(NULL) + CCNET_TICKET_LIFETIME);
+    plain = g_string_new_len (peer_id, 40);
+    g_string_append_len (plain, (char *)expire, 8);
+    g_string_append (plain, secret);
+
+    ticket = ccnet_aead_seal (session->ticket_key,
+                              (unsigned char *)plain->str, plain->len,
+                              ticket_len);
+    g_string_free (plain, TRUE);
+    return ticket;
+}
+
+char *
+ccnet_session_open_ticket (CcnetSession *session,
+                           const char *peer_id,
+                           const unsigned char *ticket,
+                           int ticket_len)
+{
+    unsigned char *plain;
+    uint64_t expire;
+    char *secret = NULL;
+    int len;
+
+    plain = ccnet_aead_open (session->ticket_key, ticket, ticket_len, &len);
+    if (!plain)
+        return NULL;
+    if (len <= 48 || memcmp (plain, peer_id, 40) != 0)
+        goto out;
+
+    memcpy (&expire, plain + 40, 8);
+    if (ntoh64 (expire) < (uint64_t)time(NULL))
+        goto out;
+
+    secret = g_strndup ((char *)plain + 48, len - 48);
+
+out:
+    g_free (plain);
+    return secret;
+}
+
+void
+ccnet_session_derive_resumed_key (const char *secret,
+                                  const char *cnonce,
+                                  const char *snonce,
+                                  char *key_out)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len;
+    char *data;
+
+    data = g_strconcat ("resume", cnonce, snonce, NULL);
+    HMAC (EVP_sha1(), secret, strlen(secret),
+          (unsigned char *)data, strlen(data), md, &md_len);
+    g_free (data);
+
+    rawdata_to_hex (md, key_out, 20);
+}
+
+void
+ccnet_session_resume_proof (const char *key, const char *label,
+                            char *proof_out)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len;
+
+    HMAC (EVP_sha1(), key, strlen(key),
+          (unsigned char *)label, strlen(label), md, &md_len);
+    rawdata_to_hex (md, proof_out, 20);
+}
+
+/* -------- X25519 key agreement -------- */
+
+int
+ccnet_session_get_kx_share (CcnetSession *session,
+                            const unsigned char **priv,
+                            const unsigned char **pub,
+                            const unsigned char **sig,
+                            int *sig_len)
+{
+    time_t now = time(NULL);
+
+    if (!session->kx_sig || session->kx_expire <= now) {
+        unsigned char data[sizeof(CCNET_KX_SIGN_LABEL) + X25519_KEY_LEN];
+        int len = sizeof(CCNET_KX_SIGN_LABEL) - 1;
+
+        g_free (session->kx_sig);
+        session->kx_sig = NULL;
+
+        if (x25519_generate_key (session->kx_priv, session->kx_pub) < 0)
+            return -1;
+
+        memcpy (data, CCNET_KX_SIGN_LABEL, len);
+        memcpy (data + len, session->kx_pub, X25519_KEY_LEN);
+        session->kx_sig = private_key_sign (session->privkey, data,
+                                            len + X25519_KEY_LEN,
+                                            &session->kx_sig_len);
+        if (!session->kx_sig)
+            return -1;
+        session->kx_expire = now + CCNET_KX_SHARE_LIFETIME;
+    }
+
+    *priv = session->kx_priv;
+    *pub = session->kx_pub;
+    *sig = session->kx_sig;
+    *sig_len = session->kx_sig_len;
+    return 0;
+}
+
+void
+ccnet_session_derive_kx_key (const unsigned char *secret,
+                             const unsigned char *sender_pub,
+                             const unsigned char *receiver_pub,
+                             char *key_out)
+{
+    unsigned char data[2 * X25519_KEY_LEN];
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len;
+
+    memcpy (data, sender_pub, X25519_KEY_LEN);
+    memcpy (data + X25519_KEY_LEN, receiver_pub, X25519_KEY_LEN);
+    HMAC (EVP_sha256(), secret, X25519_KEY_LEN,
+          data, sizeof(data), md, &md_len);
+
+    /* same form as the RSA transported keys */
+    rawdata_to_hex (md, key_out, 20);
+}
@@ -19,6 +19,7 @@
 #include "ccnet-db.h"
 
 #include "job-mgr.h"
+#include "timer.h"
 
 #include "ccnet-object.h"
 
@@ -40,11 +41,6 @@ typedef struct _CcnetSessionClass CcnetSessionClass;
 
 struct _CcnetPeer;
 
-typedef struct _CcnetService {
-    char  *svc_name;
-    struct _CcnetPeer *provider;
-} CcnetService;
-
 #include <openssl/rsa.h>
 
 
@@ -73,7 +69,25 @@ struct CcnetSession
 
     struct _CcnetJobManager    *job_mgr;
 
-    GHashTable                 *service_hash;
+    /* RSA private key operations of the handshake processors */
+    struct _CcnetJobManager    *crypto_job_mgr;
+
+    GHashTable                 *job_pools;  /* name -> job manager */
+    GHashTable                 *rpc_pools;  /* threaded rpc -> job manager */
+
+    /* session resumption, see ccnet_session_seal_ticket() */
+    unsigned char               ticket_key[32];
+    int                         resume_attempts;
+    int                         resume_hits;
+
+    /* signed X25519 share of receive-skey3, see ccnet_session_get_kx_share() */
+    unsigned char               kx_priv[32];
+    unsigned char               kx_pub[32];
+    unsigned char              *kx_sig;
+    int                         kx_sig_len;
+    time_t                      kx_expire;
+
+    struct CcnetServiceTable   *service_table;
 
     unsigned int                saving : 1;
     unsigned int                saving_pub : 1;
@@ -83,6 +97,11 @@ struct CcnetSession
     char                       *un_path;
     struct event                local_event;
     struct event                local_pipe_event;
+    CcnetTimer                 *local_listen_timer;
+
+    int                         listen_backlog; /* of all listening sockets */
+    int                         local_accepted;
+    int                         local_accept_overflows;
 
     int                         start_failure;  /* how many times failed 
                                                    to start the network */
@@ -122,12 +141,81 @@ int ccnet_session_register_service (CcnetSession *session,
                                     const char *group,
                                     struct _CcnetPeer *peer);
 
-CcnetService* ccnet_session_get_service (CcnetSession *session,
-                                         const char *service);
+/* The descriptor of a service provided by a local client, or NULL. */
+struct CcnetServiceDesc *
+ccnet_session_get_service (CcnetSession *session, const char *service);
 
 void ccnet_session_unregister_service (CcnetSession *session,
                                        struct _CcnetPeer *peer);
 
 gboolean ccnet_session_should_encrypt_channel (CcnetSession *session);
 
+/* Worker pools by name: "default" (job_mgr), "crypto" (crypto_job_mgr),
+ * "rpc-fast", "rpc-slow", "auth" and "dns". Unknown names get the
+ * default pool. */
+struct _CcnetJobManager *
+ccnet_session_get_job_pool (CcnetSession *session, const char *name);
+
+/* Run the threaded rpc @fname in pool @pool instead of "rpc-fast".
+ * Call it next to searpc_server_register_function(). */
+void ccnet_session_set_rpc_pool (CcnetSession *session,
+                                 const char *fname, const char *pool);
+
+struct _CcnetJobManager *
+ccnet_session_get_rpc_pool (CcnetSession *session, const char *fname);
+
+/* Number of RSA jobs queued or running in crypto_job_mgr. */
+int ccnet_session_get_crypto_queue_depth (CcnetSession *session);
+
+/* TRUE if no more RSA jobs should be queued, the peer should be told
+ * to come back later. */
+gboolean ccnet_session_crypto_queue_full (CcnetSession *session);
+
+/* Resumption tickets let a peer that completed a full key exchange
+ * reconnect without RSA. A ticket is the peer id, an expiry time and
+ * the session key, sealed with a key only this process knows. */
+#define CCNET_TICKET_LIFETIME  (12 * 3600)
+
+unsigned char *ccnet_session_seal_ticket (CcnetSession *session,
+                                          const char *peer_id,
+                                          const char *secret,
+                                          int *ticket_len);
+
+/* Returns the secret in the ticket, or NULL if the ticket is invalid,
+ * expired or not issued to @peer_id. */
+char *ccnet_session_open_ticket (CcnetSession *session,
+                                 const char *peer_id,
+                                 const unsigned char *ticket,
+                                 int ticket_len);
+
+/* Fresh session key of a resumed session, @key_out holds 41 bytes. */
+void ccnet_session_derive_resumed_key (const char *secret,
+                                       const char *cnonce,
+                                       const char *snonce,
+                                       char *key_out);
+
+/* Proof that the sender knows @key, @proof_out holds 41 bytes. */
+void ccnet_session_resume_proof (const char *key, const char *label,
+                                 char *proof_out);
+
+/* The X25519 share receive-skey3 sends is signed with our RSA key. A
+ * signature costs as much as an RSA decrypt, so the share is reused
+ * for a short while; every connection still gets a fresh key since the
+ * sender's share is new each time. */
+#define CCNET_KX_SHARE_LIFETIME  60
+#define CCNET_KX_SIGN_LABEL      "ccnet-skey3"
+
+int ccnet_session_get_kx_share (CcnetSession *session,
+                                const unsigned char **priv,
+                                const unsigned char **pub,
+                                const unsigned char **sig,
+                                int *sig_len);
+
+/* Session key from an X25519 shared secret and both shares,
+ * @key_out holds 41 bytes. */
+void ccnet_session_derive_kx_key (const unsigned char *secret,
+                                  const unsigned char *sender_pub,
+                                  const unsigned char *receiver_pub,
+                                  char *key_out);
+
 #endif
@@ -157,10 +157,17 @@ create_group_common (CcnetGroupManager *mgr,
                      GError **error)
 {
     CcnetDB *db = mgr->priv->db;
+    CcnetDBTrans *trans;
     gint64 now = get_current_time();
     char *sql;
     int group_id = -1;
 
+    trans = ccnet_db_begin_transaction (db);
+    if (!trans) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to create group");
+        return -1;
+    }
+
     char *user_name_l = g_ascii_strdown (user_name, -1);
     
     if (ccnet_db_type(db) == CCNET_DB_TYPE_PGSQL)
@@ -170,9 +177,9 @@ create_group_common (CcnetGroupManager *mgr,
         sql = "INSERT INTO `Group`(group_name, "
             "creator_name, timestamp) VALUES(?, ?, ?)";
 
-    if (ccnet_db_statement_query (db, sql, 3,
-                                  "string", group_name, "string", user_name_l,
-                                  "int64", now) < 0) {
+    if (ccnet_db_trans_query (trans, sql, 3,
+                              "string", group_name, "string", user_name_l,
+                              "int64", now) < 0) {
         g_set_error (error, CCNET_DOMAIN, 0, "Failed to create group");
         goto out;
     }
@@ -186,9 +193,9 @@ create_group_common (CcnetGroupManager *mgr,
             "group_name = ? AND creator_name = ? "
             "AND timestamp = ?";
 
-    group_id = ccnet_db_statement_get_int (db, sql, 3,
-                                           "string", group_name, "string", user_name_l,
-                                           "int64", now);
+    group_id = ccnet_db_trans_get_int (trans, sql, 3,
+                                       "string", group_name, "string", user_name_l,
+                                       "int64", now);
     if (group_id < 0) {
         g_set_error (error, CCNET_DOMAIN, 0, "Failed to create group");
         goto out;
@@ -196,20 +203,18 @@ create_group_common (CcnetGroupManager *mgr,
 
     sql = "INSERT INTO GroupUser VALUES (?, ?, ?)";
 
-    if (ccnet_db_statement_query (db, sql, 3,
-                                  "int", group_id, "string", user_name_l,
-                                  "int", 1) < 0) {
-        if (ccnet_db_type(db) == CCNET_DB_TYPE_PGSQL)
-            sql = "DELETE FROM \"Group\" WHERE group_id=?";
-        else
-            sql = "DELETE FROM `Group` WHERE group_id=?";
-        ccnet_db_statement_query (db, sql, 1, "int", group_id);
+    /* a failure here rolls back the group too */
+    if (ccnet_db_trans_query (trans, sql, 3,
+                              "int", group_id, "string", user_name_l,
+                              "int", 1) < 0 ||
+        ccnet_db_commit (trans) < 0) {
         g_set_error (error, CCNET_DOMAIN, 0, "Failed to create group");
         group_id = -1;
         goto out;
     }
 
 out:
+    ccnet_db_trans_close (trans);
     g_free (user_name_l);
     return group_id;
 }
@@ -269,31 +274,26 @@ duplicate_org_group_name (CcnetGroupManager *mgr,
                           int org_id,
                           const char *group_name)
 {
-    GList *org_groups = NULL, *ptr;
+    GList *org_groups = NULL, *groups, *ptr;
     CcnetOrgManager *org_mgr = ((CcnetServerSession *)(mgr->session))->org_mgr;
+    gboolean ret = FALSE;
     
     org_groups = ccnet_org_manager_get_org_groups (org_mgr, org_id, -1, -1);
     if (!org_groups)
         return FALSE;
 
-    for (ptr = org_groups; ptr; ptr = ptr->next) {
-        int group_id = (int)(long)ptr->data;
-        CcnetGroup *group = ccnet_group_manager_get_group (mgr, group_id,
-                                                           NULL);
-        if (!group)
-            continue;
-
-        if (g_strcmp0 (group_name, ccnet_group_get_group_name(group)) == 0) {
-            g_list_free (org_groups);
-            g_object_unref (group);
-            return TRUE;
-        } else {
-            g_object_unref (group);
+    groups = ccnet_group_manager_get_groups_by_ids (mgr, org_groups, NULL);
+    for (ptr = groups; ptr; ptr = ptr->next) {
+        if (g_strcmp0 (group_name,
+                       ccnet_group_get_group_name(ptr->data)) == 0) {
+            ret = TRUE;
+            break;
         }
     }
 
     g_list_free (org_groups);
-    return FALSE;
+    g_list_free_full (groups, g_object_unref);
+    return ret;
 }
 
 int ccnet_group_manager_create_org_group (CcnetGroupManager *mgr,
@@ -339,21 +339,52 @@ int ccnet_group_manager_remove_group (CcnetGroupManager *mgr,
                                       const char *user_name,
                                       GError **error)
 {
-    CcnetDB *db = mgr->priv->db;
-    char *sql;
+    GList list = { (gpointer)(long)group_id, NULL, NULL };
 
     /* No permission check here, since both group staff and seahub staff
      * can remove group.
      */
     
+    return ccnet_group_manager_remove_groups (mgr, &list, error);
+}
+
+int ccnet_group_manager_remove_groups (CcnetGroupManager *mgr,
+                                       GList *group_ids,
+                                       GError **error)
+{
+    CcnetDB *db = mgr->priv->db;
+    CcnetDBTrans *trans;
+    GList *ptr;
+    char *sql;
+    int group_id;
+
+    if (!group_ids)
+        return 0;
+
+    trans = ccnet_db_begin_transaction (db);
+    if (!trans) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to remove group");
+        return -1;
+    }
+
     if (ccnet_db_type(db) == CCNET_DB_TYPE_PGSQL)
         sql = "DELETE FROM \"Group\" WHERE group_id=?";
     else
         sql = "DELETE FROM `Group` WHERE group_id=?";
-    ccnet_db_statement_query (db, sql, 1, "int", group_id);
 
-    sql = "DELETE FROM GroupUser WHERE group_id=?";
-    ccnet_db_statement_query (db, sql, 1, "int", group_id);
+    for (ptr = group_ids; ptr; ptr = ptr->next) {
+        group_id = (int)(long)ptr->data;
+        ccnet_db_trans_query (trans, sql, 1, "int", group_id);
+        ccnet_db_trans_query (trans, "DELETE FROM GroupUser WHERE group_id=?",
+                              1, "int", group_id);
+    }
+
+    if (ccnet_db_commit (trans) < 0) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to remove group");
+        ccnet_db_trans_close (trans);
+        return -1;
+    }
+    ccnet_db_trans_close (trans);
     
     return 0;
 }
@@ -412,6 +443,115 @@ int ccnet_group_manager_add_member (CcnetGroupManager *mgr,
     return 0;
 }
 
+static gboolean
+get_group_user_names_cb (CcnetDBRow *row, void *data)
+{
+    GHashTable *names = data;
+
+    g_hash_table_replace (names,
+                          g_strdup (ccnet_db_row_get_column_text (row, 0)),
+                          GINT_TO_POINTER(1));
+    return TRUE;
+}
+
+/* A concurrent group_add_member may insert one of the rows between the
+ * select and the insert; the insert fails then and is tried again. */
+#define ADD_MEMBERS_ATTEMPTS 3
+
+/* Add the ones of @members not in the group yet, in one transaction. */
+static int
+add_new_members (CcnetDB *db, int group_id, GList *members)
+{
+    CcnetDBTrans *trans;
+    GHashTable *names;
+    GArray *group_ids, *is_staff;
+    GPtrArray *member_names;
+    GList *ptr;
+    char *name;
+    int ret = 0;
+
+    trans = ccnet_db_begin_transaction (db);
+    if (!trans)
+        return -1;
+
+    names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    if (ccnet_db_trans_foreach_row (trans,
+                                    "SELECT user_name FROM GroupUser "
+                                    "WHERE group_id = ?",
+                                    get_group_user_names_cb, names,
+                                    1, "int", group_id) < 0) {
+        g_hash_table_destroy (names);
+        ccnet_db_trans_close (trans);
+        return -1;
+    }
+
+    group_ids = g_array_new (FALSE, FALSE, sizeof(int));
+    is_staff = g_array_new (FALSE, TRUE, sizeof(int));
+    member_names = g_ptr_array_new ();
+
+    for (ptr = members; ptr; ptr = ptr->next) {
+        name = g_ascii_strdown (ptr->data, -1);
+        if (g_hash_table_lookup (names, name)) {
+            g_free (name);
+            continue;
+        }
+        /* the table owns it from now on */
+        g_hash_table_insert (names, name, GINT_TO_POINTER(1));
+        g_array_append_val (group_ids, group_id);
+        g_array_set_size (is_staff, is_staff->len + 1);
+        g_ptr_array_add (member_names, name);
+    }
+
+    if (member_names->len > 0) {
+        const char *types[] = { "int", "string", "int" };
+        const void *columns[] = { group_ids->data, member_names->pdata,
+                                  is_staff->data };
+
+        ret = ccnet_db_trans_bulk_insert (trans, "INSERT INTO GroupUser "
+                                          "(group_id, user_name, is_staff)",
+                                          3, types, columns,
+                                          member_names->len);
+    }
+    if (ret == 0)
+        ret = ccnet_db_commit (trans);
+    ccnet_db_trans_close (trans);
+
+    g_array_free (group_ids, TRUE);
+    g_array_free (is_staff, TRUE);
+    g_ptr_array_free (member_names, TRUE);
+    g_hash_table_destroy (names);
+    return ret;
+}
+
+int ccnet_group_manager_add_members (CcnetGroupManager *mgr,
+                                     int group_id,
+                                     const char *user_name,
+                                     GList *members,
+                                     GError **error)
+{
+    CcnetDB *db = mgr->priv->db;
+    int i;
+
+    if (!check_group_staff (db, group_id, user_name)) {
+        g_set_error (error, CCNET_DOMAIN, 0,
+                     "Permission error: only group staff can add member");
+        return -1; 
+    }    
+
+    if (!check_group_exists (db, group_id)) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Group not exists");
+        return -1;
+    }
+
+    for (i = 0; i < ADD_MEMBERS_ATTEMPTS; ++i) {
+        if (add_new_members (db, group_id, members) == 0)
+            return 0;
+    }
+
+    g_set_error (error, CCNET_DOMAIN, 0, "Failed to add members to group");
+    return -1;
+}
+
 int ccnet_group_manager_remove_member (CcnetGroupManager *mgr,
                                        int group_id,
                                        const char *user_name,
@@ -741,6 +881,92 @@ ccnet_group_manager_get_all_groups (CcnetGroupManager *mgr,
     return g_list_reverse (ret);
 }
 
+GList *
+ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
+                                        const char *user_name,
+                                        GError **error)
+{
+    CcnetDB *db = mgr->priv->db;
+    GList *ret = NULL;
+    char *sql;
+
+    if (ccnet_db_type(db) == CCNET_DB_TYPE_PGSQL)
+        sql = "SELECT g.group_id, g.group_name, g.creator_name, g.timestamp "
+            "FROM \"Group\" g, GroupUser u "
+            "WHERE g.group_id = u.group_id AND u.user_name = ? "
+            "ORDER BY g.group_id";
+    else
+        sql = "SELECT g.group_id, g.group_name, g.creator_name, g.timestamp "
+            "FROM `Group` g, GroupUser u "
+            "WHERE g.group_id = u.group_id AND u.user_name = ? "
+            "ORDER BY g.group_id";
+    if (ccnet_db_statement_foreach_row (db, sql,
+                                        get_all_ccnetgroups_cb, &ret,
+                                        1, "string", user_name) < 0) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to get groups");
+        g_list_free_full (ret, g_object_unref);
+        return NULL;
+    }
+
+    return g_list_reverse (ret);
+}
+
+GList *
+ccnet_group_manager_get_groups_by_ids (CcnetGroupManager *mgr,
+                                       GList *group_ids,
+                                       GError **error)
+{
+    CcnetDB *db = mgr->priv->db;
+    GList *groups = NULL, *ret = NULL, *ptr;
+    GHashTable *by_id;
+    CcnetGroup *group;
+    int *ids, n_ids, i, id;
+    char *sql;
+
+    n_ids = g_list_length (group_ids);
+    if (n_ids == 0)
+        return NULL;
+
+    ids = g_new (int, n_ids);
+    for (ptr = group_ids, i = 0; ptr; ptr = ptr->next, ++i)
+        ids[i] = (int)(long)ptr->data;
+
+    if (ccnet_db_type(db) == CCNET_DB_TYPE_PGSQL)
+        sql = "SELECT group_id, group_name, creator_name, timestamp "
+            "FROM \"Group\" WHERE group_id IN (?*)";
+    else
+        sql = "SELECT `group_id`, `group_name`, `creator_name`, `timestamp` "
+            "FROM `Group` WHERE `group_id` IN (?*)";
+    if (ccnet_db_statement_foreach_row_in (db, sql, "int", ids, n_ids,
+                                           get_all_ccnetgroups_cb, &groups,
+                                           0) < 0) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to get groups");
+        g_list_free_full (groups, g_object_unref);
+        g_free (ids);
+        return NULL;
+    }
+
+    /* in the order of @group_ids, missing groups are left out */
+    by_id = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                   NULL, g_object_unref);
+    for (ptr = groups; ptr; ptr = ptr->next) {
+        group = ptr->data;
+        g_object_get (group, "id", &id, NULL);
+        g_hash_table_replace (by_id, (gpointer)(long)id, group);
+    }
+    g_list_free (groups);
+
+    for (i = 0; i < n_ids; ++i) {
+        group = g_hash_table_lookup (by_id, (gpointer)(long)ids[i]);
+        if (group)
+            ret = g_list_prepend (ret, g_object_ref (group));
+    }
+
+    g_hash_table_destroy (by_id);
+    g_free (ids);
+    return g_list_reverse (ret);
+}
+
 int
 ccnet_group_manager_set_group_creator (CcnetGroupManager *mgr,
                                        int group_id,
@@ -40,12 +40,25 @@ int ccnet_group_manager_remove_group (CcnetGroupManager *mgr,
                                       const char *user_name,
                                       GError **error);
 
+/* Remove all of @group_ids in one transaction. */
+int ccnet_group_manager_remove_groups (CcnetGroupManager *mgr,
+                                       GList *group_ids,
+                                       GError **error);
+
 int ccnet_group_manager_add_member (CcnetGroupManager *mgr,
                                     int group_id,
                                     const char *user_name,
                                     const char *member_name,
                                     GError **error);
 
+/* Add the names in @members that aren't in the group yet, with one
+ * statement for each chunk of rows. */
+int ccnet_group_manager_add_members (CcnetGroupManager *mgr,
+                                     int group_id,
+                                     const char *user_name,
+                                     GList *members,
+                                     GError **error);
+
 int ccnet_group_manager_remove_member (CcnetGroupManager *mgr,
                                        int group_id,
                                        const char *user_name,
@@ -103,6 +116,19 @@ GList*
 ccnet_group_manager_get_all_groups (CcnetGroupManager *mgr,
                                     int start, int limit, GError **error);
 
+/* The groups @user_name is a member of, ordered by id, in one query. */
+GList *
+ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
+                                        const char *user_name,
+                                        GError **error);
+
+/* The groups in @group_ids (ints), in the same order. Ids of groups that
+ * don't exist are skipped. */
+GList *
+ccnet_group_manager_get_groups_by_ids (CcnetGroupManager *mgr,
+                                       GList *group_ids,
+                                       GError **error);
+
 int
 ccnet_group_manager_set_group_creator (CcnetGroupManager *mgr,
                                        int group_id,
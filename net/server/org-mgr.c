@@ -235,18 +235,25 @@ ccnet_org_manager_remove_org (CcnetOrgManager *mgr,
                               int org_id,
                               GError **error)
 {
-    CcnetDB *db = mgr->priv->db;
+    CcnetDBTrans *trans;
+    int ret;
+
+    trans = ccnet_db_begin_transaction (mgr->priv->db);
+    if (!trans)
+        return -1;
 
-    ccnet_db_statement_query (db, "DELETE FROM Organization WHERE org_id = ?",
-                              1, "int", org_id);
+    ccnet_db_trans_query (trans, "DELETE FROM Organization WHERE org_id = ?",
+                          1, "int", org_id);
 
-    ccnet_db_statement_query (db, "DELETE FROM OrgUser WHERE org_id = %d",
-                              1, "int", org_id);
+    ccnet_db_trans_query (trans, "DELETE FROM OrgUser WHERE org_id = ?",
+                          1, "int", org_id);
 
-    ccnet_db_statement_query (db, "DELETE FROM OrgGroup WHERE org_id = %d",
-                              1, "int", org_id);
+    ccnet_db_trans_query (trans, "DELETE FROM OrgGroup WHERE org_id = ?",
+                          1, "int", org_id);
 
-    return 0;
+    ret = ccnet_db_commit (trans);
+    ccnet_db_trans_close (trans);
+    return ret;
 }
 
 
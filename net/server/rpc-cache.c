@@ -0,0 +1,242 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include "rpc-cache.h"
+
+#define DEFAULT_TTL         30              /* seconds */
+#define DEFAULT_MAX_MEMORY  (64 << 20)
+
+enum {
+    FUNC_READER,
+    FUNC_WRITER,
+};
+
+typedef struct CacheFunc {
+    int          kind;
+    int          domains;
+} CacheFunc;
+
+typedef struct CacheEntry {
+    GList        link;          /* in lru, data points to the entry */
+    char        *key;           /* the serialized call */
+    char        *result;
+    gsize        len;
+    gsize        size;          /* memory charged for the entry */
+    int          domains;
+    time_t       expire;
+} CacheEntry;
+
+struct CcnetRpcCachePriv {
+    GHashTable  *funcs;         /* fname -> CacheFunc */
+    GHashTable  *entries;       /* key -> CacheEntry */
+    GQueue       lru;           /* most recently used first */
+    gsize        memory;
+};
+
+CcnetRpcCache *
+ccnet_rpc_cache_new ()
+{
+    CcnetRpcCache *cache = g_new0 (CcnetRpcCache, 1);
+
+    cache->priv = g_new0 (CcnetRpcCachePriv, 1);
+    cache->ttl = DEFAULT_TTL;
+    cache->max_memory = DEFAULT_MAX_MEMORY;
+    cache->generation = 1;
+
+    cache->priv->funcs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, g_free);
+    cache->priv->entries = g_hash_table_new (g_str_hash, g_str_equal);
+    g_queue_init (&cache->priv->lru);
+
+    return cache;
+}
+
+static void
+add_func (CcnetRpcCache *cache, const char *fname, int kind, int domains)
+{
+    CacheFunc *func = g_new0 (CacheFunc, 1);
+
+    func->kind = kind;
+    func->domains = domains;
+    g_hash_table_replace (cache->priv->funcs, g_strdup(fname), func);
+}
+
+void
+ccnet_rpc_cache_add_reader (CcnetRpcCache *cache,
+                            const char *fname, int domains)
+{
+    add_func (cache, fname, FUNC_READER, domains);
+}
+
+void
+ccnet_rpc_cache_add_writer (CcnetRpcCache *cache,
+                            const char *fname, int domains)
+{
+    add_func (cache, fname, FUNC_WRITER, domains);
+}
+
+gboolean
+ccnet_rpc_cache_is_writer (CcnetRpcCache *cache, const char *fname)
+{
+    CacheFunc *func;
+
+    if (!fname)
+        return FALSE;
+    func = g_hash_table_lookup (cache->priv->funcs, fname);
+    return func && func->kind == FUNC_WRITER;
+}
+
+static void
+remove_entry (CcnetRpcCache *cache, CacheEntry *entry)
+{
+    CcnetRpcCachePriv *priv = cache->priv;
+
+    g_hash_table_remove (priv->entries, entry->key);
+    g_queue_unlink (&priv->lru, &entry->link);
+    priv->memory -= entry->size;
+
+    g_free (entry->key);
+    g_free (entry->result);
+    g_free (entry);
+}
+
+static void
+invalidate (CcnetRpcCache *cache, int domains)
+{
+    GList *ptr, *next;
+    CacheEntry *entry;
+
+    for (ptr = cache->priv->lru.head; ptr; ptr = next) {
+        next = ptr->next;
+        entry = ptr->data;
+        if (entry->domains & domains) {
+            remove_entry (cache, entry);
+            cache->invalidations++;
+        }
+    }
+}
+
+/* searpc errors are {"err_code": ..., "err_msg": ...}, don't keep them */
+static gboolean
+is_error_result (const char *result, gsize len)
+{
+    return g_strstr_len (result, MIN (len, 32), "\"err_code\"") != NULL;
+}
+
+gboolean
+ccnet_rpc_cache_lookup (CcnetRpcCache *cache, const char *fname,
+                        const char *call, gsize call_len,
+                        char **result, gsize *len)
+{
+    CcnetRpcCachePriv *priv = cache->priv;
+    CacheFunc *func;
+    CacheEntry *entry;
+    char *key;
+
+    if (!cache->enabled || !fname)
+        return FALSE;
+
+    func = g_hash_table_lookup (priv->funcs, fname);
+    if (!func || func->kind != FUNC_READER)
+        return FALSE;
+
+    key = g_strndup (call, call_len);
+    entry = g_hash_table_lookup (priv->entries, key);
+    g_free (key);
+
+    if (entry && entry->expire <= time(NULL)) {
+        remove_entry (cache, entry);
+        entry = NULL;
+    }
+    if (!entry) {
+        cache->misses++;
+        return FALSE;
+    }
+
+    g_queue_unlink (&priv->lru, &entry->link);
+    g_queue_push_head_link (&priv->lru, &entry->link);
+
+    *result = g_memdup (entry->result, entry->len);
+    *len = entry->len;
+    cache->hits++;
+    return TRUE;
+}
+
+void
+ccnet_rpc_cache_end_call (CcnetRpcCache *cache, const char *fname,
+                          const char *call, gsize call_len,
+                          guint64 generation,
+                          const char *result, gsize len)
+{
+    CcnetRpcCachePriv *priv = cache->priv;
+    CacheFunc *func;
+    CacheEntry *entry;
+
+    if (!cache->enabled || !fname)
+        return;
+
+    func = g_hash_table_lookup (priv->funcs, fname);
+    if (!func)
+        return;
+
+    if (func->kind == FUNC_WRITER) {
+        /* also when the call failed, it may have done part of the work */
+        cache->generation++;
+        invalidate (cache, func->domains);
+        return;
+    }
+
+    /* a writer returned while this call ran, the result may be stale */
+    if (generation != cache->generation || !result ||
+        is_error_result (result, len))
+        return;
+
+    entry = g_new0 (CacheEntry, 1);
+    entry->key = g_strndup (call, call_len);
+    entry->size = sizeof(CacheEntry) + call_len + 1 + len;
+    if (entry->size > cache->max_memory / 16) {
+        /* don't let one listing flush the cache */
+        g_free (entry->key);
+        g_free (entry);
+        return;
+    }
+
+    /* the same call may have been stored by a concurrent caller */
+    CacheEntry *old = g_hash_table_lookup (priv->entries, entry->key);
+    if (old)
+        remove_entry (cache, old);
+
+    entry->link.data = entry;
+    entry->result = g_memdup (result, len);
+    entry->len = len;
+    entry->domains = func->domains;
+    entry->expire = time(NULL) + cache->ttl;
+
+    g_hash_table_insert (priv->entries, entry->key, entry);
+    g_queue_push_head_link (&priv->lru, &entry->link);
+    priv->memory += entry->size;
+
+    while (priv->memory > cache->max_memory) {
+        remove_entry (cache, priv->lru.tail->data);
+        cache->evictions++;
+    }
+}
+
+gint64
+ccnet_rpc_cache_get_stat (CcnetRpcCache *cache, const char *name)
+{
+    if (g_strcmp0 (name, "hits") == 0)
+        return cache->hits;
+    if (g_strcmp0 (name, "misses") == 0)
+        return cache->misses;
+    if (g_strcmp0 (name, "entries") == 0)
+        return g_hash_table_size (cache->priv->entries);
+    if (g_strcmp0 (name, "memory") == 0)
+        return cache->priv->memory;
+    if (g_strcmp0 (name, "invalidations") == 0)
+        return cache->invalidations;
+    if (g_strcmp0 (name, "evictions") == 0)
+        return cache->evictions;
+    return -1;
+}
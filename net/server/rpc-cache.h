@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/**
+ * Cache of threaded rpc results, keyed by the serialized call. Only
+ * functions added as readers are cached; a call to a function added
+ * as writer drops every entry sharing one of its domains. Everything
+ * here runs in the main loop.
+ */
+
+#ifndef CCNET_RPC_CACHE_H
+#define CCNET_RPC_CACHE_H
+
+#include <glib.h>
+
+enum {
+    RPC_CACHE_USER  = 1 << 0,
+    RPC_CACHE_GROUP = 1 << 1,
+    RPC_CACHE_ORG   = 1 << 2,
+};
+
+typedef struct CcnetRpcCache CcnetRpcCache;
+typedef struct CcnetRpcCachePriv CcnetRpcCachePriv;
+
+struct CcnetRpcCache {
+    gboolean             enabled;
+    int                  ttl;           /* seconds */
+    gsize                max_memory;    /* bytes */
+
+    /* bumped by every writer, results of calls started before
+     * aren't stored */
+    guint64              generation;
+
+    guint64              hits;
+    guint64              misses;
+    guint64              invalidations;
+    guint64              evictions;
+
+    CcnetRpcCachePriv   *priv;
+};
+
+CcnetRpcCache *ccnet_rpc_cache_new ();
+
+void ccnet_rpc_cache_add_reader (CcnetRpcCache *cache,
+                                 const char *fname, int domains);
+
+void ccnet_rpc_cache_add_writer (CcnetRpcCache *cache,
+                                 const char *fname, int domains);
+
+gboolean ccnet_rpc_cache_is_writer (CcnetRpcCache *cache,
+                                    const char *fname);
+
+/* On a hit, returns TRUE and a copy of the result in @result. */
+gboolean
+ccnet_rpc_cache_lookup (CcnetRpcCache *cache, const char *fname,
+                        const char *call, gsize call_len,
+                        char **result, gsize *len);
+
+/* To be called when a call to @fname started at @generation returns
+ * @result, which may be NULL. Stores it or invalidates entries. */
+void
+ccnet_rpc_cache_end_call (CcnetRpcCache *cache, const char *fname,
+                          const char *call, gsize call_len,
+                          guint64 generation,
+                          const char *result, gsize len);
+
+/* "hits", "misses", "entries", "memory", "invalidations" or
+ * "evictions"; -1 for an unknown name. */
+gint64
+ccnet_rpc_cache_get_stat (CcnetRpcCache *cache, const char *name);
+
+#endif
@@ -27,6 +27,7 @@
 #include "group-mgr.h"
 #include "org-mgr.h"
 #include "job-mgr.h"
+#include "rpc-cache.h"
 
 #define DEBUG_FLAG CCNET_DEBUG_OTHER
 #include "log.h"
@@ -57,6 +58,7 @@ ccnet_server_session_init (CcnetServerSession *server_session)
     server_session->user_mgr = ccnet_user_manager_new (session);
     server_session->group_mgr = ccnet_group_manager_new (session);
     server_session->org_mgr = ccnet_org_manager_new (session);
+    server_session->rpc_cache = ccnet_rpc_cache_new ();
 }
 
 CcnetServerSession *
@@ -65,6 +67,30 @@ ccnet_server_session_new (const char *config_dir_r)
     return g_object_new (CCNET_TYPE_SERVER_SESSION, NULL);
 }
 
+/* [RpcCache] ENABLED, TTL in seconds and MAX_MEMORY in MB. Off by
+ * default, other processes writing to the database aren't seen until
+ * the entries expire. */
+static void
+load_rpc_cache_config (CcnetSession *session)
+{
+    CcnetRpcCache *cache = ((CcnetServerSession *)session)->rpc_cache;
+    int ttl, max_memory;
+
+    cache->enabled = g_key_file_get_boolean (session->keyf, "RpcCache",
+                                             "ENABLED", NULL);
+    ttl = g_key_file_get_integer (session->keyf, "RpcCache", "TTL", NULL);
+    if (ttl > 0)
+        cache->ttl = ttl;
+    max_memory = g_key_file_get_integer (session->keyf, "RpcCache",
+                                         "MAX_MEMORY", NULL);
+    if (max_memory > 0)
+        cache->max_memory = (gsize)MIN (max_memory, 1024) << 20;
+
+    if (cache->enabled)
+        ccnet_message ("RPC cache enabled, ttl %ds, %luMB\n", cache->ttl,
+                       (unsigned long)(cache->max_memory >> 20));
+}
+
 int
 server_session_prepare (CcnetSession *session)
 {
@@ -88,6 +114,8 @@ server_session_prepare (CcnetSession *session)
         /* encrypt channel on default */
         session->encrypt_channel = 1;
 
+    load_rpc_cache_config (session);
+
     if (ccnet_user_manager_prepare (server_session->user_mgr) < 0)
         return -1;
 
@@ -213,6 +241,23 @@ static int init_pgsql_database (CcnetSession *session)
    return 0;
 }
 
+/* [Database] MIN_CONNECTIONS, MAX_CONNECTIONS and CONNECTION_TIMEOUT,
+ * the seconds to wait for a connection when all are in use. */
+static void
+load_db_pool_config (CcnetSession *session)
+{
+    int min_conns, max_conns, timeout;
+
+    min_conns = g_key_file_get_integer (session->keyf, "Database",
+                                        "MIN_CONNECTIONS", NULL);
+    max_conns = g_key_file_get_integer (session->keyf, "Database",
+                                        "MAX_CONNECTIONS", NULL);
+    timeout = g_key_file_get_integer (session->keyf, "Database",
+                                      "CONNECTION_TIMEOUT", NULL);
+
+    ccnet_db_set_pool_config (session->db, min_conns, max_conns, timeout);
+}
+
 static int
 load_database_config (CcnetSession *session)
 {
@@ -234,6 +279,10 @@ load_database_config (CcnetSession *session)
         ret = -1;
     }
 
+    /* the sqlite dbs are opened by the managers */
+    if (ret == 0 && session->db)
+        load_db_pool_config (session);
+
     return ret;
 }
 
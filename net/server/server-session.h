@@ -22,6 +22,8 @@ struct CcnetServerSession
     struct _CcnetUserManager   *user_mgr;
     struct _CcnetGroupManager  *group_mgr;
     struct _CcnetOrgManager    *org_mgr;
+
+    struct CcnetRpcCache       *rpc_cache;  /* see rpc-cache.h */
 };
 
 struct _CcnetServerSessionClass
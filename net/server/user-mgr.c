@@ -808,21 +808,46 @@ int
 ccnet_user_manager_remove_emailuser (CcnetUserManager *manager,
                                      const char *email)
 {
-    CcnetDB *db = manager->priv->db;
-    int ret;
+    GList list = { (gpointer)email, NULL, NULL };
 
-    ccnet_db_statement_query (db,
-                              "DELETE FROM UserRole WHERE email=?",
-                              1, "string", email);
+    return ccnet_user_manager_remove_emailusers (manager, &list);
+}
 
-    ret = ccnet_db_statement_query (db,
-                                    "DELETE FROM EmailUser WHERE email=?",
-                                    1, "string", email);
+int
+ccnet_user_manager_remove_emailusers (CcnetUserManager *manager,
+                                      GList *emails)
+{
+    CcnetDBTrans *trans;
+    GList *ptr;
+    int ret, n_removed = 0;
 
+    if (!emails)
+        return 0;
+
+    trans = ccnet_db_begin_transaction (manager->priv->db);
+    if (!trans)
+        return -1;
+
+    for (ptr = emails; ptr; ptr = ptr->next) {
+        /* unknown and repeated emails don't count */
+        if (ccnet_db_trans_exists (trans,
+                                   "SELECT 1 FROM EmailUser WHERE email=?",
+                                   1, "string", ptr->data))
+            ++n_removed;
+        ccnet_db_trans_query (trans,
+                              "DELETE FROM UserRole WHERE email=?",
+                              1, "string", ptr->data);
+        ccnet_db_trans_query (trans,
+                              "DELETE FROM EmailUser WHERE email=?",
+                              1, "string", ptr->data);
+    }
+
+    ret = ccnet_db_commit (trans);
+    ccnet_db_trans_close (trans);
     if (ret < 0)
         return ret;
 
-    manager->priv->cur_users --;
+    manager->priv->cur_users -= n_removed;
     return 0;
 }
 
@@ -1166,33 +1191,58 @@ ccnet_user_manager_count_emailusers (CcnetUserManager *manager)
     return count;
 }
 
-#if 0
 GList*
 ccnet_user_manager_filter_emailusers_by_emails(CcnetUserManager *manager,
                                                const char *emails)
 {
     CcnetDB *db = manager->priv->db;
     char *copy = g_strdup (emails), *saveptr;
+    GHashTable *seen;
+    GPtrArray *keys;
     GList *ret = NULL;
+    int rc;
 
 #ifdef HAVE_LDAP
-    if (manager->use_ldap)
+    if (manager->use_ldap) {
+        g_free (copy);
         return NULL;            /* todo */
+    }
 #endif
 
-    GString *sql = g_string_new(NULL);
-
-    g_string_append (sql, "SELECT * FROM EmailUser WHERE Email IN (");
+    /* match them as given and in lower case, like get_emailuser */
+    seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    keys = g_ptr_array_new ();
     char *name = strtok_r (copy, ", ", &saveptr);
     while (name != NULL) {
-        g_string_append_printf (sql, "'%s',", name);
+        char *name_l = g_ascii_strdown (name, -1);
+        if (!g_hash_table_lookup (seen, name)) {
+            g_hash_table_insert (seen, g_strdup(name), name);
+            g_ptr_array_add (keys, name);
+        }
+        if (!g_hash_table_lookup (seen, name_l)) {
+            g_hash_table_insert (seen, name_l, name_l);
+            g_ptr_array_add (keys, name_l);
+        } else
+            g_free (name_l);
         name = strtok_r (NULL, ", ", &saveptr);
     }
-    g_string_erase (sql, sql->len-1, 1); /* remove last "," */
-    g_string_append (sql, ")");
 
-    if (ccnet_db_foreach_selected_row (db, sql->str, get_emailusers_cb,
-        &ret) < 0) {
+    rc = ccnet_db_statement_foreach_row_in (db,
+                                            "SELECT t1.id, t1.email, "
+                                            "t1.is_staff, t1.is_active, t1.ctime, "
+                                            "t2.role FROM EmailUser AS t1 "
+                                            "LEFT JOIN UserRole AS t2 "
+                                            "ON t1.email = t2.email "
+                                            "WHERE t1.email IN (?*)",
+                                            "string", keys->pdata, keys->len,
+                                            get_emailusers_cb, &ret,
+                                            0);
+
+    g_ptr_array_free (keys, TRUE);
+    g_hash_table_destroy (seen);
+    g_free (copy);
+
+    if (rc < 0) {
         while (ret != NULL) {
             g_object_unref (ret->data);
             ret = g_list_delete_link (ret, ret);
@@ -1200,12 +1250,8 @@ ccnet_user_manager_filter_emailusers_by_emails(CcnetUserManager *manager,
         return NULL;
     }
 
-    g_free (copy);
-    g_string_free (sql, TRUE);
-    
     return g_list_reverse (ret);
 }
-#endif
 
 int
 ccnet_user_manager_update_emailuser (CcnetUserManager *manager,
@@ -75,6 +75,11 @@ int
 ccnet_user_manager_remove_emailuser (CcnetUserManager *manager,
                                      const char *email);
 
+/* Remove all of @emails in one transaction. */
+int
+ccnet_user_manager_remove_emailusers (CcnetUserManager *manager,
+                                      GList *emails);
+
 int
 ccnet_user_manager_validate_emailuser (CcnetUserManager *manager,
                                        const char *email,
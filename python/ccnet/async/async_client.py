@@ -4,6 +4,7 @@ import libevent
 from ccnet.client import Client, parse_update, parse_response
 
 from ccnet.packet import response_to_packet, parse_header, Packet
+from ccnet.packet import is_v2_header, parse_header_v2, CCNET_HEADER_V2_LENGTH
 from ccnet.packet import to_response_id, to_master_id, to_slave_id,  to_packet_id
 from ccnet.packet import CCNET_MSG_REQUEST, CCNET_MSG_UPDATE, CCNET_MSG_RESPONSE, \
     CCNET_HEADER_LENGTH, CCNET_MAX_PACKET_LENGTH
@@ -203,10 +204,17 @@ class AsyncClient(Client):
         while (True):
             raw = inbuf.copyout(CCNET_HEADER_LENGTH)
             header = parse_header(raw)
-            if len(inbuf) < CCNET_HEADER_LENGTH + header.length:
+            hlen = CCNET_HEADER_LENGTH
+            if is_v2_header(header):
+                if len(inbuf) < CCNET_HEADER_V2_LENGTH:
+                    break
+                header = parse_header_v2(inbuf.copyout(CCNET_HEADER_V2_LENGTH))
+                hlen = CCNET_HEADER_V2_LENGTH
+
+            if len(inbuf) < hlen + header.length:
                 break
 
-            inbuf.drain(CCNET_HEADER_LENGTH)
+            inbuf.drain(hlen)
             data = inbuf.copyout(header.length)
             pkt = Packet(header, data)
 
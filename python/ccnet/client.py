@@ -6,7 +6,7 @@ import ConfigParser
 
 from ccnet.packet import to_request_id, to_update_id
 from ccnet.packet import request_to_packet, update_to_packet
-from ccnet.packet import write_packet
+from ccnet.packet import write_packet, send_hello
 
 from ccnet.errors import NetworkError
 
@@ -115,9 +115,12 @@ class Client(object):
 
     def connect_daemon(self):
         if is_win32():
-            return self.connect_daemon_with_socket()
+            ret = self.connect_daemon_with_socket()
         else:
-            return self.connect_daemon_with_pipe()
+            ret = self.connect_daemon_with_pipe()
+
+        send_hello(self._connfd)
+        return ret
 
     def is_connected(self):
         return self._connfd != None
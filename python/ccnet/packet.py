@@ -50,6 +50,15 @@ CCNET_HEADER_LENGTH = struct.calcsize(CCNET_HEADER_FORMAT)
 
 CCNET_MAX_PACKET_LENGTH = 65535
 
+# Protocol version 2 header: version, type, flags, reserved, id, length.
+# It is only sent by the daemon after we announced version 2 in a hello
+# packet, see send_hello().
+CCNET_PROTO_VERSION_2 = 2
+CCNET_HEADER_V2_FORMAT = '>BBBBII'
+CCNET_HEADER_V2_LENGTH = struct.calcsize(CCNET_HEADER_V2_FORMAT)
+
+CCNET_MAX_PACKET_LENGTH_V2 = 16 * 1024 * 1024
+
 class PacketHeader(object):
     def __init__(self, ver, ptype, length, id):
         self.ver = ver
@@ -77,6 +86,21 @@ def parse_header(buf):
     
     return PacketHeader(ver, ptype, length, id)
 
+def is_v2_header(header):
+    return header.ver == CCNET_PROTO_VERSION_2 and \
+        header.ptype != CCNET_MSG_HANDSHAKE
+
+def parse_header_v2(buf):
+    try:
+        ver, ptype, _, _, id, length = struct.unpack(CCNET_HEADER_V2_FORMAT, buf)
+    except struct.error, e:
+        raise NetworkError('error when unpack packet header: %s' % e)
+
+    if length > CCNET_MAX_PACKET_LENGTH_V2:
+        raise NetworkError('Packet too large: %d bytes' % length)
+
+    return PacketHeader(ver, ptype, length, id)
+
 def format_response(code, code_msg, content):
     body = code
     if code_msg:
@@ -113,6 +137,9 @@ def read_packet(fd):
         raise NetworkError('Only read %d bytes header, expected 8' % len(hdr))
 
     header = parse_header(hdr)
+    if is_v2_header(header):
+        rest = recvall(fd, CCNET_HEADER_V2_LENGTH - CCNET_HEADER_LENGTH)
+        header = parse_header_v2(hdr + rest)
 
     if header.length == 0:
         body = ''
@@ -123,6 +150,12 @@ def read_packet(fd):
 
     return Packet(header, body)
 
+def send_hello(fd):
+    '''Tell the daemon we can read protocol v2 packets. Old daemons drop
+    packets with id 0 silently.'''
+    hdr = PacketHeader(CCNET_PROTO_VERSION_2, CCNET_MSG_HANDSHAKE, 0, 0)
+    sendall(fd, hdr.to_string())
+
 def write_packet(fd, packet):
     hdr = packet.header.to_string()
     sendall(fd, hdr)
@@ -2,7 +2,11 @@ from pysearpc import SearpcClient, searpc_func, SearpcError
 
 from ccnet.status_code import SC_CLIENT_CALL, SS_CLIENT_CALL, \
     SC_CLIENT_MORE, SS_CLIENT_MORE, SC_SERVER_RET, \
-    SC_SERVER_MORE, SC_PROC_DEAD
+    SC_SERVER_MORE, SC_PROC_DEAD, SC_CLIENT_STREAM_CALL, \
+    SS_CLIENT_STREAM_CALL, SC_CLIENT_CREDIT, SS_CLIENT_CREDIT, \
+    SC_CLIENT_BATCH_CALL, SS_CLIENT_BATCH_CALL, \
+    SC_CLIENT_PARALLEL_BATCH_CALL, SS_CLIENT_PARALLEL_BATCH_CALL, \
+    SC_BAD_UPDATE_CODE
 
 from ccnet.errors import NetworkError
 
@@ -11,6 +15,19 @@ class DeadProcError(Exception):
         return "Processor is dead"
 
 
+STREAM_CAP = "stream-window"
+
+def parse_stream_window(content):
+    """Parse the "stream-window=N" capability in the reply to start."""
+    content = content.rstrip('\0')
+    if not content.startswith(STREAM_CAP + "="):
+        return 0
+    try:
+        return max(int(content[len(STREAM_CAP) + 1:]), 0)
+    except ValueError:
+        return 0
+
+
 class RpcClientBase(SearpcClient):
     
     def __init__(self, ccnet_client_pool, service_name, retry_num=1,
@@ -34,29 +51,48 @@ class RpcClientBase(SearpcClient):
         rsp = client.read_response()
         if rsp.code != "200":
             raise SearpcError("Error received: %s %s (In _start_service)" % (rsp.code, rsp.code_msg))
+        if not hasattr(client, 'stream_windows'):
+            client.stream_windows = {}
+        client.stream_windows[req_id] = parse_stream_window(rsp.content)
         return req_id
 
     def _real_call(self, client, req_id, fcall_str):
-        client.send_update(req_id, SC_CLIENT_CALL, SS_CLIENT_CALL, fcall_str)
-                
+        window = getattr(client, 'stream_windows', {}).get(req_id, 0)
+        if window > 0:
+            client.send_update(req_id, SC_CLIENT_STREAM_CALL,
+                               SS_CLIENT_STREAM_CALL, fcall_str)
+        else:
+            client.send_update(req_id, SC_CLIENT_CALL, SS_CLIENT_CALL, fcall_str)
+
         rsp = client.read_response()
         if rsp.code == SC_SERVER_RET:
             return rsp.content
         elif rsp.code == SC_SERVER_MORE:
-            buf = rsp.content
+            # the server pushes up to `window` segments ahead, credits
+            # are returned in batches of half a window
+            buf = [rsp.content]
+            received = 0
             while True:
-                client.send_update(req_id, SC_CLIENT_MORE,
-                                   SS_CLIENT_MORE, '')
+                if window == 0:
+                    client.send_update(req_id, SC_CLIENT_MORE,
+                                       SS_CLIENT_MORE, '')
+                else:
+                    received += 1
+                    if received >= (window + 1) / 2:
+                        client.send_update(req_id, SC_CLIENT_CREDIT,
+                                           SS_CLIENT_CREDIT,
+                                           str(received) + '\0')
+                        received = 0
                 rsp = client.read_response()
                 if rsp.code == SC_SERVER_MORE:
-                    buf += rsp.content
+                    buf.append(rsp.content)
                 elif rsp.code == SC_SERVER_RET:
-                    buf += rsp.content
+                    buf.append(rsp.content)
                     break
                 else:
                     raise SearpcError("Error received: %s %s (In Read More)" % (rsp.code, rsp.code_msg))
 
-            return buf
+            return ''.join(buf)
         elif rsp.code == SC_PROC_DEAD:
             raise DeadProcError()
         else:
@@ -102,6 +138,74 @@ class RpcClientBase(SearpcClient):
                 else:
                     raise
 
+    def _real_batch_call(self, client, req_id, fcall_strs, parallel):
+        if parallel:
+            client.send_update(req_id, SC_CLIENT_PARALLEL_BATCH_CALL,
+                               SS_CLIENT_PARALLEL_BATCH_CALL,
+                               '\0'.join(fcall_strs) + '\0')
+        else:
+            client.send_update(req_id, SC_CLIENT_BATCH_CALL,
+                               SS_CLIENT_BATCH_CALL,
+                               '\0'.join(fcall_strs) + '\0')
+
+        # results come in lock-step, like a call without stream window
+        buf = []
+        while True:
+            rsp = client.read_response()
+            if rsp.code == SC_SERVER_MORE:
+                buf.append(rsp.content)
+                client.send_update(req_id, SC_CLIENT_MORE, SS_CLIENT_MORE, '')
+            elif rsp.code == SC_SERVER_RET:
+                buf.append(rsp.content)
+                break
+            elif rsp.code == SC_BAD_UPDATE_CODE:
+                return None
+            elif rsp.code == SC_PROC_DEAD and not buf:
+                # the pooled request was gone, nothing ran
+                raise DeadProcError()
+            else:
+                raise SearpcError("Error received: %s %s (In Batch)" % (rsp.code, rsp.code_msg))
+
+        results = ''.join(buf).split('\0')
+        if len(results) != len(fcall_strs) + 1 or results[-1] != '':
+            raise SearpcError("Bad batch result")
+        return results[:-1]
+
+    def call_batch(self, fcall_strs, parallel=False):
+        """Call the remote functions `fcall_strs` in one round trip and
+        return their results in order. With `parallel`, the server may
+        run them concurrently."""
+
+        if not fcall_strs:
+            return []
+
+        client = self.pool.get_client()
+        if self.req_pool:
+            req_id = client.req_ids.get(self.service_name, -1)
+            if req_id == -1:
+                req_id = self._start_service(client)
+            try:
+                ret = self._real_batch_call(client, req_id, fcall_strs,
+                                            parallel)
+            except DeadProcError:
+                req_id = self._start_service(client)
+                ret = self._real_batch_call(client, req_id, fcall_strs,
+                                            parallel)
+            # the server ends the request if it rejects the batch
+            client.req_ids[self.service_name] = req_id if ret is not None else -1
+        else:
+            req_id = self._start_service(client)
+            ret = self._real_batch_call(client, req_id, fcall_strs, parallel)
+            if ret is not None:
+                client.send_update(req_id, "103", "service is done", "")
+        self.pool.return_client(client)
+
+        if ret is None:
+            # the server rejected the batch without running it, it
+            # doesn't know batches; call one by one
+            ret = [self.call_remote_func_sync(f) for f in fcall_strs]
+        return ret
+
 class CcnetRpcClient(RpcClientBase):
 
     def __init__(self, ccnet_client_pool, retry_num=1, *args, **kwargs):
@@ -168,6 +272,38 @@ class CcnetRpcClient(RpcClientBase):
     def list_peer_stat(self, key, value):
         pass
 
+    @searpc_func("int", ["string"])
+    def get_accept_stat(self, name):
+        pass
+
+    @searpc_func("int", ["string"])
+    def get_proc_pool_stat(self, name):
+        pass
+
+    @searpc_func("int", [])
+    def get_crypto_queue_depth(self):
+        pass
+
+    @searpc_func("int", [])
+    def get_resume_attempts(self):
+        pass
+
+    @searpc_func("int", [])
+    def get_resume_hits(self):
+        pass
+
+    @searpc_func("int", ["string"])
+    def get_rpc_cache_stat(self, name):
+        pass
+
+    @searpc_func("int", ["string"])
+    def get_db_stat(self, name):
+        pass
+
+    @searpc_func("int", ["string", "string"])
+    def get_rpc_query_stat(self, fname, name):
+        pass
+
 
 class CcnetThreadedRpcClient(RpcClientBase):
 
@@ -208,7 +344,7 @@ class CcnetThreadedRpcClient(RpcClientBase):
         pass
 
     @searpc_func("objlist", ["string"])
-    def filter_emailusers_by_emails(self):
+    def filter_emailusers_by_emails(self, emails):
         pass
     
     @searpc_func("int", ["int", "string", "int", "int"])
@@ -262,6 +398,10 @@ class CcnetThreadedRpcClient(RpcClientBase):
     @searpc_func("int", ["int", "string", "string"])
     def group_add_member(self, group_id, user_name, member_name):
         pass
+
+    @searpc_func("int", ["int", "string", "string"])
+    def group_add_members(self, group_id, user_name, member_names):
+        pass
     
     @searpc_func("int", ["int", "string", "string"])
     def group_remove_member(self, group_id, user_name, member_name):
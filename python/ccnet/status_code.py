@@ -69,6 +69,14 @@ SC_CLIENT_MORE = '302'
 SS_CLIENT_MORE = 'MORE'
 SC_CLIENT_CALL_MORE = '303'
 SS_CLIENT_CALL_MORE = 'CLIENT HAS MORE'
+SC_CLIENT_STREAM_CALL = '304'
+SS_CLIENT_STREAM_CALL = 'CLIENT STREAM CALL'
+SC_CLIENT_CREDIT = '305'
+SS_CLIENT_CREDIT = 'CREDIT'
+SC_CLIENT_BATCH_CALL = '306'
+SS_CLIENT_BATCH_CALL = 'CLIENT BATCH CALL'
+SC_CLIENT_PARALLEL_BATCH_CALL = '307'
+SS_CLIENT_PARALLEL_BATCH_CALL = 'CLIENT PARALLEL BATCH CALL'
 SC_SERVER_RET  = '311'
 SS_SERVER_RET  = 'SERVER RET'
 SC_SERVER_MORE = '312'
@@ -0,0 +1,51 @@
+# Run against a ccnet-server with [RpcCache] ENABLED = true, the reads
+# below would be answered from the cache if the batch didn't bypass it.
+
+import sys
+import os
+import json
+from ccnet import ClientPool, CcnetThreadedRpcClient
+
+CCNET_CONF_DIR = os.path.expanduser('~/.ccnet')
+
+OWNER = 'batch-owner@test.com'
+MEMBER = 'batch-member@test.com'
+
+def fcall(fname, *args):
+    return json.dumps([fname] + list(args))
+
+def ret_of(result):
+    return json.loads(result)['ret']
+
+def test_read_after_write(rpc, parallel):
+    group_id = rpc.create_group('batch-test', OWNER)
+    assert group_id > 0
+    try:
+        # put the answer from before the write in the rpc cache
+        assert rpc.is_group_user(group_id, MEMBER) == 0
+
+        results = rpc.call_batch([
+            fcall('group_add_member', group_id, OWNER, MEMBER),
+            fcall('is_group_user', group_id, MEMBER),
+        ], parallel=parallel)
+        assert ret_of(results[0]) == 0
+        if not parallel:
+            # the read runs after the write and must see it
+            assert ret_of(results[1]) == 1
+
+        # and later calls don't get the old answer either
+        assert rpc.is_group_user(group_id, MEMBER) == 1
+    finally:
+        rpc.remove_group(group_id, OWNER)
+
+def main():
+    conf_dir = sys.argv[1] if len(sys.argv) > 1 else CCNET_CONF_DIR
+    rpc = CcnetThreadedRpcClient(ClientPool(conf_dir))
+
+    test_read_after_write(rpc, False)
+    test_read_after_write(rpc, True)
+
+    print 'test passed'
+
+if __name__ == '__main__':
+    main()